@@ -0,0 +1,573 @@
+/**
+ * @file
+ * @brief benchmark baseline recording and regression check
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Reads the JSON lines printed by the benchmarks, usually from several
+ * repeated runs, and groups the samples of each tracked metric: creation
+ * throughput (bench-create), startup latency (bench-exec), and pipe
+ * throughput (bench-throughput). Each group is summarized by its median
+ * and a 95% confidence interval of the median taken from order statistics,
+ * which needs no assumption about the shape of the noise.
+ *
+ * record writes the summaries to a versioned baseline file. check compares
+ * a new run against it and exits with status 1 when a metric got worse by
+ * more than the threshold and the confidence intervals do not overlap, so
+ * one noisy run does not fail the check.
+ *
+ * Build from the top-level directory:
+ * cc -O2 -o build/bench-compare bench/compare.c -lm
+ *
+ * Example:
+ * for i in 1 2 3 4 5; do build/bench-create 10000; done > build/new.json
+ * build/bench-compare record bench/baseline.txt build/new.json
+ * build/bench-compare check bench/baseline.txt build/new.json
+ */
+
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * First line of a baseline file, followed by the format version.
+ */
+#define BENCH_CMP_MAGIC "mkfifo-bench-baseline"
+
+/**
+ * Current baseline file format version.
+ */
+#define BENCH_CMP_VERSION 1
+
+/**
+ * Longest metric key or JSON line handled.
+ */
+#define BENCH_CMP_LINE_MAX 1024
+
+/**
+ * Default regression threshold in percent.
+ */
+#define BENCH_CMP_THRESHOLD 5.0
+
+/**
+ * How to turn one kind of benchmark line into a metric.
+ */
+struct bench_cmp_metric{
+  /**
+   * Value of the "bench" field.
+   */
+  const char *bench;
+
+  /**
+   * Field holding the measurement.
+   */
+  const char *value;
+
+  /**
+   * Larger values are better, for example throughput.
+   */
+  bool higher_is_better;
+
+  /**
+   * Fields identifying the configuration, NULL-terminated.
+   */
+  const char *keys[4];
+};
+
+/**
+ * Every tracked metric.
+ */
+static const struct bench_cmp_metric bench_cmp_metrics[] = {
+  {"create", "ops_per_sec", true, {"engine", "layout", "fifos", NULL}},
+  {"exec", "p50_us", false, {"binary", NULL, NULL, NULL}},
+  {"throughput",
+   "gb_per_sec",
+   true,
+   {"method", "pipe_size", "write_size", NULL}}
+};
+
+/**
+ * Samples, or a baseline summary, of one metric in one configuration.
+ */
+struct bench_cmp_group{
+  /**
+   * Benchmark, configuration, and measured field, separated by spaces.
+   */
+  char *key;
+
+  /**
+   * Larger values are better.
+   */
+  bool higher_is_better;
+
+  /**
+   * Samples read from the benchmark output.
+   */
+  double *samples;
+
+  /**
+   * Number of entries in @ref samples.
+   */
+  size_t n;
+
+  /**
+   * Allocated entries in @ref samples.
+   */
+  size_t cap;
+
+  /**
+   * Median of the samples.
+   */
+  double median;
+
+  /**
+   * Lower end of the 95% confidence interval of the median.
+   */
+  double lo;
+
+  /**
+   * Upper end of the 95% confidence interval of the median.
+   */
+  double hi;
+};
+
+/**
+ * Growable list of @ref bench_cmp_group.
+ */
+struct bench_cmp_set{
+  /**
+   * Groups in the order first seen.
+   */
+  struct bench_cmp_group *groups;
+
+  /**
+   * Number of entries in @ref groups.
+   */
+  size_t n;
+
+  /**
+   * Allocated entries in @ref groups.
+   */
+  size_t cap;
+};
+
+/**
+ * Copy the value of a field from a flat JSON object, without quotes.
+ *
+ * @param[in]  line JSON object printed by a benchmark.
+ * @param[in]  name Field name.
+ * @param[out] buf  Value.
+ * @param[in]  size Size of @p buf.
+ * @retval     true  Found the field.
+ * @retval     false No such field.
+ */
+static bool
+bench_cmp_field(const char *const line,
+                const char *const name,
+                char *const buf,
+                const size_t size){
+  char pattern[64];
+  const char *p;
+  size_t len;
+
+  snprintf(pattern, sizeof(pattern), "\"%s\":", name);
+  if((p = strstr(line, pattern)) == NULL){
+    return false;
+  }
+  p += strlen(pattern);
+  if(*p == '"'){
+    p += 1;
+    len = strcspn(p, "\"");
+  }
+  else{
+    len = strcspn(p, ",}");
+  }
+  if(len >= size){
+    return false;
+  }
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+  return true;
+}
+
+/**
+ * Find or add a group.
+ *
+ * @param[in,out] set              See @ref bench_cmp_set.
+ * @param[in]     key              See @ref bench_cmp_group.
+ * @param[in]     higher_is_better See @ref bench_cmp_group.
+ * @return                         Group with @p key.
+ */
+static struct bench_cmp_group *
+bench_cmp_group_get(struct bench_cmp_set *const set,
+                    const char *const key,
+                    const bool higher_is_better){
+  struct bench_cmp_group *group;
+  size_t i;
+
+  for(i = 0; i < set->n; i++){
+    if(strcmp(set->groups[i].key, key) == 0){
+      return &set->groups[i];
+    }
+  }
+  if(set->n == set->cap){
+    set->cap = set->cap ? set->cap * 2 : 16;
+    set->groups = realloc(set->groups, set->cap * sizeof(*set->groups));
+    if(set->groups == NULL){
+      err(2, "realloc");
+    }
+  }
+  group = &set->groups[set->n++];
+  memset(group, 0, sizeof(*group));
+  if((group->key = strdup(key)) == NULL){
+    err(2, "strdup");
+  }
+  group->higher_is_better = higher_is_better;
+  return group;
+}
+
+/**
+ * Add one sample to a group.
+ *
+ * @param[in,out] group  See @ref bench_cmp_group.
+ * @param[in]     sample Measured value.
+ */
+static void
+bench_cmp_group_add(struct bench_cmp_group *const group,
+                    const double sample){
+  if(group->n == group->cap){
+    group->cap = group->cap ? group->cap * 2 : 8;
+    group->samples = realloc(group->samples,
+                             group->cap * sizeof(*group->samples));
+    if(group->samples == NULL){
+      err(2, "realloc");
+    }
+  }
+  group->samples[group->n++] = sample;
+}
+
+/**
+ * Collect the tracked metrics from one JSON line.
+ *
+ * @param[in,out] set  See @ref bench_cmp_set.
+ * @param[in]     line JSON object printed by a benchmark.
+ */
+static void
+bench_cmp_parse_line(struct bench_cmp_set *const set,
+                     const char *const line){
+  const struct bench_cmp_metric *metric;
+  char key[BENCH_CMP_LINE_MAX];
+  char bench[64];
+  char value[256];
+  size_t len;
+  size_t i;
+  size_t j;
+
+  if(!bench_cmp_field(line, "bench", bench, sizeof(bench))){
+    return;
+  }
+  for(i = 0; i < sizeof(bench_cmp_metrics) / sizeof(bench_cmp_metrics[0]);
+      i++){
+    metric = &bench_cmp_metrics[i];
+    if(strcmp(bench, metric->bench) != 0){
+      continue;
+    }
+    len = (size_t)snprintf(key, sizeof(key), "%s", bench);
+    for(j = 0; metric->keys[j]; j++){
+      if(!bench_cmp_field(line, metric->keys[j], value, sizeof(value))){
+        return;
+      }
+      len += (size_t)snprintf(&key[len], sizeof(key) - len, " %s=%s",
+                              metric->keys[j], value);
+    }
+    if(!bench_cmp_field(line, metric->value, value, sizeof(value))){
+      return;
+    }
+    snprintf(&key[len], sizeof(key) - len, " %s", metric->value);
+    bench_cmp_group_add(bench_cmp_group_get(set,
+                                            key,
+                                            metric->higher_is_better),
+                        strtod(value, NULL));
+  }
+}
+
+/**
+ * Read benchmark output from a file, or STDIN for "-".
+ *
+ * @param[in,out] set  See @ref bench_cmp_set.
+ * @param[in]     path File to read.
+ */
+static void
+bench_cmp_read_results(struct bench_cmp_set *const set,
+                       const char *const path){
+  char line[BENCH_CMP_LINE_MAX];
+  FILE *fp;
+
+  fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if(fp == NULL){
+    err(2, "%s", path);
+  }
+  while(fgets(line, sizeof(line), fp)){
+    bench_cmp_parse_line(set, line);
+  }
+  if(fp != stdin){
+    fclose(fp);
+  }
+}
+
+/**
+ * qsort() comparison for doubles.
+ *
+ * @param[in] a First value.
+ * @param[in] b Second value.
+ * @return      Negative, zero, or positive like strcmp().
+ */
+static int
+bench_cmp_double(const void *const a,
+                 const void *const b){
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Compute the median and its 95% confidence interval.
+ *
+ * The interval runs between the order statistics n/2 -/+ 0.98 sqrt(n),
+ * which covers the true median with about 95% probability for any
+ * distribution. With five runs or fewer that is the full range.
+ *
+ * @param[in,out] group See @ref bench_cmp_group.
+ */
+static void
+bench_cmp_summarize(struct bench_cmp_group *const group){
+  const size_t n = group->n;
+  double half;
+  double lo;
+  double hi;
+
+  qsort(group->samples, n, sizeof(*group->samples), bench_cmp_double);
+  group->median = n % 2 ? group->samples[n / 2] :
+                  (group->samples[n / 2 - 1] + group->samples[n / 2]) / 2;
+  half = 0.98 * sqrt((double)n);
+  lo = floor((double)n / 2 - half);
+  hi = ceil((double)n / 2 + half);
+  group->lo = group->samples[lo < 0 ? 0 : (size_t)lo];
+  group->hi = group->samples[hi > (double)(n - 1) ? n - 1 : (size_t)hi];
+}
+
+/**
+ * Write a baseline file, replacing any previous one atomically.
+ *
+ * @param[in] set  Summarized results.
+ * @param[in] path Baseline file.
+ */
+static void
+bench_cmp_write_baseline(const struct bench_cmp_set *const set,
+                         const char *const path){
+  const struct bench_cmp_group *group;
+  char tmp[BENCH_CMP_LINE_MAX];
+  FILE *fp;
+  size_t i;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if((fp = fopen(tmp, "w")) == NULL){
+    err(2, "%s", tmp);
+  }
+  fprintf(fp, "%s %d\n", BENCH_CMP_MAGIC, BENCH_CMP_VERSION);
+  for(i = 0; i < set->n; i++){
+    group = &set->groups[i];
+    fprintf(fp,
+            "%s\t%s\t%zu\t%.6g\t%.6g\t%.6g\n",
+            group->key,
+            group->higher_is_better ? "higher" : "lower",
+            group->n,
+            group->median,
+            group->lo,
+            group->hi);
+  }
+  if(fclose(fp) != 0 || rename(tmp, path) != 0){
+    err(2, "%s", path);
+  }
+}
+
+/**
+ * Read a baseline file written by @ref bench_cmp_write_baseline.
+ *
+ * @param[out] set  Baseline summaries.
+ * @param[in]  path Baseline file.
+ */
+static void
+bench_cmp_read_baseline(struct bench_cmp_set *const set,
+                        const char *const path){
+  char line[BENCH_CMP_LINE_MAX];
+  struct bench_cmp_group *group;
+  char direction[16];
+  char *tab;
+  int version;
+  FILE *fp;
+
+  if((fp = fopen(path, "r")) == NULL){
+    err(2, "%s", path);
+  }
+  if(fscanf(fp, BENCH_CMP_MAGIC " %d\n", &version) != 1){
+    errx(2, "%s: not a baseline file", path);
+  }
+  if(version != BENCH_CMP_VERSION){
+    errx(2, "%s: unsupported baseline version %d", path, version);
+  }
+  while(fgets(line, sizeof(line), fp)){
+    if((tab = strchr(line, '\t')) == NULL){
+      continue;
+    }
+    *tab++ = '\0';
+    group = bench_cmp_group_get(set, line, true);
+    if(sscanf(tab,
+              "%15s %zu %lf %lf %lf",
+              direction,
+              &group->n,
+              &group->median,
+              &group->lo,
+              &group->hi) != 5){
+      errx(2, "%s: bad line: %s", path, line);
+    }
+    group->higher_is_better = strcmp(direction, "higher") == 0;
+  }
+  fclose(fp);
+}
+
+/**
+ * Compare a new run against the baseline and print one line per metric.
+ *
+ * @param[in] base      Baseline summaries.
+ * @param[in] set       Summaries of the new run.
+ * @param[in] threshold Smallest change in percent counted as a regression.
+ * @return              Number of regressions.
+ */
+static size_t
+bench_cmp_check(const struct bench_cmp_set *const base,
+                const struct bench_cmp_set *const set,
+                const double threshold){
+  const struct bench_cmp_group *old;
+  const struct bench_cmp_group *cur;
+  const char *verdict;
+  size_t regressions;
+  double change;
+  bool separated;
+  size_t i;
+  size_t j;
+
+  regressions = 0;
+  for(i = 0; i < set->n; i++){
+    cur = &set->groups[i];
+    old = NULL;
+    for(j = 0; j < base->n; j++){
+      if(strcmp(base->groups[j].key, cur->key) == 0){
+        old = &base->groups[j];
+      }
+    }
+    if(old == NULL){
+      printf("new        %s: %.6g\n", cur->key, cur->median);
+      continue;
+    }
+    change = old->median == 0 ? 0 :
+             (cur->median - old->median) / old->median * 100;
+    if(!cur->higher_is_better){
+      change = -change;
+    }
+    separated = cur->hi < old->lo || cur->lo > old->hi;
+    if(separated && change <= -threshold){
+      verdict = "REGRESSION";
+      regressions += 1;
+    }
+    else if(separated && change >= threshold){
+      verdict = "improved  ";
+    }
+    else{
+      verdict = "ok        ";
+    }
+    printf("%s %s: %.6g -> %.6g (%+.1f%%, CI %.6g..%.6g vs %.6g..%.6g)\n",
+           verdict,
+           cur->key,
+           old->median,
+           cur->median,
+           change,
+           old->lo,
+           old->hi,
+           cur->lo,
+           cur->hi);
+  }
+  return regressions;
+}
+
+/**
+ * Benchmark comparison entry point.
+ *
+ * Usage: bench-compare [-t percent] record|check baseline [results...]
+ *
+ * Results default to STDIN.
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Argument list.
+ * @retval    0    Recorded, or no regression found.
+ * @retval    1    At least one metric regressed.
+ * @retval    2    Usage or I/O error.
+ */
+int
+main(int argc,
+     char *argv[]){
+  struct bench_cmp_set base;
+  struct bench_cmp_set set;
+  double threshold;
+  size_t regressions;
+  size_t i;
+  int c;
+
+  threshold = BENCH_CMP_THRESHOLD;
+  while((c = getopt(argc, argv, "t:")) != -1){
+    switch(c){
+      case 't':
+        threshold = strtod(optarg, NULL);
+        break;
+      default:
+        return 2;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if(argc < 2 ||
+     (strcmp(argv[0], "record") != 0 && strcmp(argv[0], "check") != 0)){
+    fprintf(stderr,
+            "usage: bench-compare [-t percent] record|check baseline "
+            "[results...]\n");
+    return 2;
+  }
+  memset(&set, 0, sizeof(set));
+  if(argc == 2){
+    bench_cmp_read_results(&set, "-");
+  }
+  for(c = 2; c < argc; c++){
+    bench_cmp_read_results(&set, argv[c]);
+  }
+  if(set.n == 0){
+    errx(2, "no benchmark results");
+  }
+  for(i = 0; i < set.n; i++){
+    bench_cmp_summarize(&set.groups[i]);
+  }
+  if(strcmp(argv[0], "record") == 0){
+    bench_cmp_write_baseline(&set, argv[1]);
+    return 0;
+  }
+  memset(&base, 0, sizeof(base));
+  bench_cmp_read_baseline(&base, argv[1]);
+  regressions = bench_cmp_check(&base, &set, threshold);
+  printf("%zu regression(s)\n", regressions);
+  return regressions ? 1 : 0;
+}
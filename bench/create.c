@@ -0,0 +1,258 @@
+/**
+ * @file
+ * @brief FIFO creation benchmark
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Creates and removes large numbers of FIFOs with every creation engine
+ * and directory layout. Each run prints one JSON object per line with the
+ * creation rate, per-create latency percentiles, and system calls per FIFO.
+ *
+ * This file includes the mkfifo source directly so it can drive the
+ * creation engine and read its counters.
+ *
+ * Build from the top-level directory:
+ * cc -DTEST -o build/bench-create bench/create.c -lpthread
+ */
+
+#include "../src/mkfifo.c"
+
+#include <sys/types.h>
+#include <assert.h>
+#include <ftw.h>
+
+/**
+ * Directory holding every FIFO created by the benchmark.
+ */
+#define BENCH_CREATE_ROOT "build/bench-create-fifos"
+
+/**
+ * Number of shard directories in the sharded layout.
+ */
+#define BENCH_CREATE_SHARDS 256
+
+/**
+ * Number of FIFOs in each leaf directory of the deep layout.
+ */
+#define BENCH_CREATE_DEEP_LEAF 1000
+
+/**
+ * Directory layouts the FIFOs get spread over.
+ */
+enum bench_create_layout{
+  /**
+   * All FIFOs in one directory.
+   */
+  BENCH_CREATE_FLAT,
+
+  /**
+   * FIFOs split over @ref BENCH_CREATE_SHARDS directories.
+   */
+  BENCH_CREATE_SHARDED,
+
+  /**
+   * FIFOs in leaf directories eight levels down.
+   */
+  BENCH_CREATE_DEEP
+};
+
+/**
+ * Create every missing directory leading up to the last component of
+ * @p path.
+ *
+ * @param[in] path Path of a file to create.
+ */
+static void
+bench_create_parents(char *const path){
+  char *slash;
+
+  for(slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')){
+    *slash = '\0';
+    assert(mkdir(path, 0755) == 0 || errno == EEXIST);
+    *slash = '/';
+  }
+}
+
+/**
+ * Build the list of FIFO paths for a layout and create their directories.
+ *
+ * @param[in] layout See @ref bench_create_layout.
+ * @param[in] n      Number of paths.
+ * @return           List of @p n paths, allocated along with the paths in
+ *                   one block to free().
+ */
+static char **
+bench_create_paths(const enum bench_create_layout layout,
+                   const size_t n){
+  const size_t PATH_LEN = sizeof(BENCH_CREATE_ROOT) + 64;
+  char **paths;
+  char *names;
+  size_t i;
+  int len;
+
+  paths = malloc(n * sizeof(*paths) + n * PATH_LEN);
+  assert(paths);
+  names = (char *)&paths[n];
+  for(i = 0; i < n; i++){
+    paths[i] = &names[i * PATH_LEN];
+    if(layout == BENCH_CREATE_FLAT){
+      len = snprintf(paths[i], PATH_LEN, "%s/flat/f%zu", BENCH_CREATE_ROOT, i);
+    }
+    else if(layout == BENCH_CREATE_SHARDED){
+      len = snprintf(paths[i],
+                     PATH_LEN,
+                     "%s/sharded/%02zx/f%zu",
+                     BENCH_CREATE_ROOT,
+                     i * BENCH_CREATE_SHARDS / n,
+                     i);
+    }
+    else{
+      len = snprintf(paths[i],
+                     PATH_LEN,
+                     "%s/deep/a/b/c/d/e/f/g/%04zx/f%zu",
+                     BENCH_CREATE_ROOT,
+                     i / BENCH_CREATE_DEEP_LEAF,
+                     i);
+    }
+    assert(len > 0 && (size_t)len < PATH_LEN);
+    if(i == 0 ||
+       layout == BENCH_CREATE_SHARDED ||
+       (layout == BENCH_CREATE_DEEP && i % BENCH_CREATE_DEEP_LEAF == 0)){
+      bench_create_parents(paths[i]);
+    }
+  }
+  return paths;
+}
+
+/**
+ * nftw() callback that removes every entry of the benchmark tree.
+ *
+ * @param[in] path   Entry to remove.
+ * @param[in] sb     Unused.
+ * @param[in] type   Unused.
+ * @param[in] ftwbuf Unused.
+ * @retval    0      Continue the walk.
+ */
+static int
+bench_create_rm(const char *const path,
+                const struct stat *const sb,
+                const int type,
+                struct FTW *const ftwbuf){
+  (void)sb;
+  (void)type;
+  (void)ftwbuf;
+  remove(path);
+  return 0;
+}
+
+/**
+ * Compare callback for qsort() on latencies.
+ *
+ * @param[in] a First latency.
+ * @param[in] b Second latency.
+ * @return      Negative, zero, or positive like strcmp().
+ */
+static int
+bench_create_cmp(const void *const a,
+                 const void *const b){
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Create and remove @p n FIFOs with one engine and print the result.
+ *
+ * @param[in] layout_name Name of the @ref bench_create_layout in the output.
+ * @param[in] engine      See @ref mkfifo_engine.
+ * @param[in] engine_name Name of @p engine in the output.
+ * @param[in] paths       FIFO paths.
+ * @param[in] n           Number of entries in @p paths.
+ */
+static void
+bench_create_run(const char *const layout_name,
+                 const enum mkfifo_engine engine,
+                 const char *const engine_name,
+                 char *const paths[],
+                 const size_t n){
+  struct mkfifo_ctx mkfifo_ctx;
+  uint64_t start;
+  uint64_t elapsed;
+  size_t i;
+
+  memset(&mkfifo_ctx, 0, sizeof(mkfifo_ctx));
+  mkfifo_ctx.mode = S_IRUSR | S_IWUSR |
+                    S_IRGRP | S_IWGRP |
+                    S_IROTH | S_IWOTH;
+  mkfifo_ctx.engine = engine;
+  mkfifo_ctx.latency_ns = calloc(n, sizeof(*mkfifo_ctx.latency_ns));
+  assert(mkfifo_ctx.latency_ns);
+  start = mkfifo_clock_ns();
+  mkfifo_create_all(&mkfifo_ctx, n, paths);
+  elapsed = mkfifo_clock_ns() - start;
+  assert(mkfifo_ctx.status_code == EXIT_SUCCESS);
+  for(i = 0; i < n; i++){
+    assert(unlink(paths[i]) == 0);
+  }
+  qsort(mkfifo_ctx.latency_ns,
+        n,
+        sizeof(*mkfifo_ctx.latency_ns),
+        bench_create_cmp);
+  printf("{\"bench\":\"create\",\"fifos\":%zu,\"layout\":\"%s\","
+         "\"engine\":\"%s\",\"ops_per_sec\":%.1f,"
+         "\"p50_ns\":%llu,\"p99_ns\":%llu,\"syscalls_per_fifo\":%.3f}\n",
+         n,
+         layout_name,
+         engine_name,
+         (double)n / ((double)elapsed / 1e9),
+         (unsigned long long)mkfifo_ctx.latency_ns[n / 2],
+         (unsigned long long)mkfifo_ctx.latency_ns[n * 99 / 100],
+         (double)mkfifo_ctx.create_syscalls / (double)n);
+  fflush(stdout);
+  free(mkfifo_ctx.latency_ns);
+}
+
+/**
+ * Benchmark FIFO creation.
+ *
+ * Usage: bench-create [max-fifos]
+ *
+ * Runs 1k, 10k, and 100k FIFOs by default, and continues in powers of ten
+ * up to max-fifos, for example 1000000.
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Argument list.
+ * @retval    0    Benchmark completed.
+ */
+int
+main(int argc,
+     char *argv[]){
+  const char *const layout_names[] = {"flat", "sharded", "deep"};
+  const char *const engine_names[] = {"serial", "dirfd", "thread"};
+  char **paths;
+  size_t max;
+  size_t n;
+  size_t layout;
+  size_t engine;
+
+  max = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+  nftw(BENCH_CREATE_ROOT, bench_create_rm, 16, FTW_DEPTH | FTW_PHYS);
+  assert(mkdir(BENCH_CREATE_ROOT, 0755) == 0);
+  for(n = 1000; n <= max; n *= 10){
+    for(layout = 0; layout < 3; layout++){
+      paths = bench_create_paths((enum bench_create_layout)layout, n);
+      for(engine = 0; engine < 3; engine++){
+        bench_create_run(layout_names[layout],
+                         (enum mkfifo_engine)engine,
+                         engine_names[engine],
+                         paths,
+                         n);
+      }
+      free(paths);
+    }
+  }
+  nftw(BENCH_CREATE_ROOT, bench_create_rm, 16, FTW_DEPTH | FTW_PHYS);
+  return 0;
+}
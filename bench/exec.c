@@ -0,0 +1,187 @@
+/**
+ * @file
+ * @brief mkfifo process startup benchmark
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Scripts often run mkfifo once per FIFO, so most of the cost is creating
+ * the process rather than the FIFO itself. This measures fork+exec+exit of
+ * the mkfifo binary creating one FIFO, and of a baseline binary that does
+ * nothing, then prints one JSON object per binary with the median and
+ * minimum microseconds per invocation. The final object reports how much
+ * mkfifo costs on top of the baseline.
+ *
+ * Build from the top-level directory:
+ * cc -O2 -o build/bench-exec bench/exec.c
+ *
+ * Startup-optimized mkfifo build (static-pie needs libc support; -static
+ * works everywhere else):
+ * cc -O2 -static-pie -o build/mkfifo src/mkfifo.c -lpthread
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * FIFO created by each mkfifo invocation.
+ */
+#define BENCH_EXEC_FIFO "build/bench-exec-fifo"
+
+/**
+ * Default number of invocations of each binary.
+ */
+#define BENCH_EXEC_RUNS 2000
+
+/**
+ * Number of invocations made before recording.
+ */
+#define BENCH_EXEC_WARMUP 50
+
+/**
+ * Current monotonic time in nanoseconds.
+ *
+ * @return Nanoseconds since an arbitrary point.
+ */
+static uint64_t
+bench_exec_now(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * qsort() comparison for uint64_t.
+ *
+ * @param[in] a First value.
+ * @param[in] b Second value.
+ * @return      Negative, zero, or positive like strcmp().
+ */
+static int
+bench_exec_cmp(const void *const a,
+               const void *const b){
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Run @p argv to completion once.
+ *
+ * @param[in] argv Program and arguments, with argv[0] the path to execute.
+ * @return         Nanoseconds from fork() until the child was reaped.
+ */
+static uint64_t
+bench_exec_once(char *const argv[]){
+  uint64_t start;
+  pid_t pid;
+  int status;
+
+  start = bench_exec_now();
+  pid = fork();
+  if(pid < 0){
+    err(1, "fork");
+  }
+  if(pid == 0){
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  if(waitpid(pid, &status, 0) != pid){
+    err(1, "waitpid");
+  }
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+    errx(1, "%s failed", argv[0]);
+  }
+  return bench_exec_now() - start;
+}
+
+/**
+ * Time @p runs invocations of @p argv and print the result.
+ *
+ * @param[in]  argv    Program and arguments.
+ * @param[in]  creates Remove @ref BENCH_EXEC_FIFO after each invocation.
+ * @param[in]  runs    Number of recorded invocations.
+ * @param[out] samples Scratch space for @p runs samples.
+ * @return             Median nanoseconds per invocation.
+ */
+static uint64_t
+bench_exec_run(char *const argv[],
+               const int creates,
+               const size_t runs,
+               uint64_t *const samples){
+  size_t i;
+
+  for(i = 0; i < BENCH_EXEC_WARMUP + runs; i++){
+    if(i < BENCH_EXEC_WARMUP){
+      bench_exec_once(argv);
+    }
+    else{
+      samples[i - BENCH_EXEC_WARMUP] = bench_exec_once(argv);
+    }
+    if(creates && unlink(BENCH_EXEC_FIFO) != 0){
+      err(1, "unlink: %s", BENCH_EXEC_FIFO);
+    }
+  }
+  qsort(samples, runs, sizeof(*samples), bench_exec_cmp);
+  printf("{\"bench\":\"exec\",\"binary\":\"%s\",\"runs\":%zu,"
+         "\"p50_us\":%.1f,\"min_us\":%.1f}\n",
+         argv[0],
+         runs,
+         (double)samples[runs / 2] / 1000.0,
+         (double)samples[0] / 1000.0);
+  fflush(stdout);
+  return samples[runs / 2];
+}
+
+/**
+ * Benchmark entry point.
+ *
+ * Usage: bench-exec [mkfifo [baseline [runs]]]
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Paths to the mkfifo and baseline binaries (default
+ *                 build/mkfifo and /bin/true) and the number of runs.
+ * @return         EXIT_SUCCESS
+ */
+int
+main(int argc,
+     char *argv[]){
+  char *mkfifo_argv[3];
+  char *baseline_argv[2];
+  uint64_t *samples;
+  uint64_t mkfifo_ns;
+  uint64_t baseline_ns;
+  size_t runs;
+
+  mkfifo_argv[0] = argc > 1 ? argv[1] : "build/mkfifo";
+  mkfifo_argv[1] = BENCH_EXEC_FIFO;
+  mkfifo_argv[2] = NULL;
+  baseline_argv[0] = argc > 2 ? argv[2] : "/bin/true";
+  baseline_argv[1] = NULL;
+  runs = argc > 3 ? strtoul(argv[3], NULL, 10) : BENCH_EXEC_RUNS;
+  if(runs == 0){
+    errx(1, "invalid run count");
+  }
+  if((samples = malloc(runs * sizeof(*samples))) == NULL){
+    err(1, "malloc");
+  }
+  unlink(BENCH_EXEC_FIFO);
+  baseline_ns = bench_exec_run(baseline_argv, 0, runs, samples);
+  mkfifo_ns = bench_exec_run(mkfifo_argv, 1, runs, samples);
+  printf("{\"bench\":\"exec-overhead\",\"binary\":\"%s\","
+         "\"baseline\":\"%s\",\"overhead_us\":%.1f}\n",
+         mkfifo_argv[0],
+         baseline_argv[0],
+         ((double)mkfifo_ns - (double)baseline_ns) / 1000.0);
+  free(samples);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,411 @@
+/**
+ * @file
+ * @brief FIFO ping-pong latency benchmark
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Bounces small messages between two processes over a pair of FIFOs and
+ * records the round trip times in a log-linear (HDR-style) histogram. Reads
+ * either block, busy-poll a non-blocking descriptor, or wait in epoll. Each
+ * read mode prints one JSON object per line with p50, p99, p99.9, and max
+ * round trip times. Requires Linux for epoll and CPU pinning.
+ *
+ * This file includes the mkfifo source directly so it can create the FIFOs
+ * with the creation engine.
+ *
+ * Build from the top-level directory:
+ * cc -DTEST -o build/bench-latency bench/latency.c -lpthread
+ */
+
+#include "../src/mkfifo.c"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <sched.h>
+
+/**
+ * FIFO carrying messages from the pinger to the ponger.
+ */
+#define BENCH_LAT_PING "build/bench-latency-ping"
+
+/**
+ * FIFO carrying messages from the ponger back to the pinger.
+ */
+#define BENCH_LAT_PONG "build/bench-latency-pong"
+
+/**
+ * Size of each message.
+ */
+#define BENCH_LAT_MSG 64
+
+/**
+ * Number of round trips made before recording.
+ */
+#define BENCH_LAT_WARMUP 1000
+
+/**
+ * Bits of precision kept within each power of two.
+ */
+#define BENCH_LAT_SUB_BITS 5
+
+/**
+ * Number of histogram buckets, enough for round trips up to 2^40 ns.
+ */
+#define BENCH_LAT_BUCKETS ((40 + 1) << BENCH_LAT_SUB_BITS)
+
+/**
+ * How each side waits for the next message.
+ */
+enum bench_lat_mode{
+  /**
+   * Blocking read().
+   */
+  BENCH_LAT_BLOCK,
+
+  /**
+   * Spin on read() from a non-blocking descriptor.
+   */
+  BENCH_LAT_SPIN,
+
+  /**
+   * Wait in epoll_wait() before each read().
+   */
+  BENCH_LAT_EPOLL
+};
+
+/**
+ * Log-linear histogram of round trip times.
+ */
+struct bench_lat_hist{
+  /**
+   * Number of samples in each bucket.
+   */
+  uint64_t counts[BENCH_LAT_BUCKETS];
+
+  /**
+   * Number of samples recorded.
+   */
+  uint64_t total;
+
+  /**
+   * Largest sample recorded.
+   */
+  uint64_t max;
+};
+
+/**
+ * Find the histogram bucket of a value.
+ *
+ * Values below 2^(SUB_BITS + 1) get one bucket each. Larger values share
+ * 2^SUB_BITS buckets per power of two, which keeps the relative error
+ * below 2^-SUB_BITS.
+ *
+ * @param[in] v Value in nanoseconds.
+ * @return      Bucket index.
+ */
+static size_t
+bench_lat_bucket(const uint64_t v){
+  unsigned int shift;
+
+  if(v < (1u << (BENCH_LAT_SUB_BITS + 1))){
+    return (size_t)v;
+  }
+  shift = 0;
+  while((v >> shift) >= (1u << (BENCH_LAT_SUB_BITS + 1))){
+    shift += 1;
+  }
+  return ((size_t)shift << BENCH_LAT_SUB_BITS) + (size_t)(v >> shift);
+}
+
+/**
+ * Get the highest value that falls into a histogram bucket.
+ *
+ * @param[in] bucket Bucket index from @ref bench_lat_bucket.
+ * @return           Value in nanoseconds.
+ */
+static uint64_t
+bench_lat_bucket_value(const size_t bucket){
+  unsigned int shift;
+  uint64_t sub;
+
+  if(bucket < (1u << (BENCH_LAT_SUB_BITS + 1))){
+    return bucket;
+  }
+  shift = (unsigned int)(bucket >> BENCH_LAT_SUB_BITS) - 1;
+  sub = (bucket & ((1u << BENCH_LAT_SUB_BITS) - 1)) +
+        (1u << BENCH_LAT_SUB_BITS);
+  return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Record one sample.
+ *
+ * @param[in,out] hist See @ref bench_lat_hist.
+ * @param[in]     v    Round trip time in nanoseconds.
+ */
+static void
+bench_lat_record(struct bench_lat_hist *const hist,
+                 const uint64_t v){
+  size_t bucket;
+
+  bucket = bench_lat_bucket(v);
+  if(bucket >= BENCH_LAT_BUCKETS){
+    bucket = BENCH_LAT_BUCKETS - 1;
+  }
+  hist->counts[bucket] += 1;
+  hist->total += 1;
+  if(v > hist->max){
+    hist->max = v;
+  }
+}
+
+/**
+ * Get a percentile from the histogram.
+ *
+ * @param[in] hist See @ref bench_lat_hist.
+ * @param[in] pct  Percentile between 0 and 100.
+ * @return         Value in nanoseconds.
+ */
+static uint64_t
+bench_lat_percentile(const struct bench_lat_hist *const hist,
+                     const double pct){
+  uint64_t want;
+  uint64_t seen;
+  size_t i;
+
+  want = (uint64_t)((double)hist->total * pct / 100.0);
+  if(want == 0){
+    want = 1;
+  }
+  seen = 0;
+  for(i = 0; i < BENCH_LAT_BUCKETS; i++){
+    seen += hist->counts[i];
+    if(seen >= want){
+      return bench_lat_bucket_value(i);
+    }
+  }
+  return hist->max;
+}
+
+/**
+ * Pin the calling process to one CPU.
+ *
+ * @param[in] cpu CPU number, or negative to leave the process unpinned.
+ */
+static void
+bench_lat_pin(const int cpu){
+  cpu_set_t set;
+
+  if(cpu >= 0){
+    CPU_ZERO(&set);
+    CPU_SET((size_t)cpu, &set);
+    assert(sched_setaffinity(0, sizeof(set), &set) == 0);
+  }
+}
+
+/**
+ * Read exactly one message.
+ *
+ * @param[in] mode     See @ref bench_lat_mode.
+ * @param[in] fd       FIFO to read, non-blocking unless @p mode is
+ *                     @ref BENCH_LAT_BLOCK.
+ * @param[in] epoll_fd Epoll instance watching @p fd.
+ * @param[out] msg     Receives @ref BENCH_LAT_MSG bytes.
+ */
+static void
+bench_lat_read(const enum bench_lat_mode mode,
+               const int fd,
+               const int epoll_fd,
+               char *const msg){
+  struct epoll_event ev;
+  size_t done;
+  ssize_t nread;
+
+  for(done = 0; done < BENCH_LAT_MSG; ){
+    if(mode == BENCH_LAT_EPOLL){
+      assert(epoll_wait(epoll_fd, &ev, 1, -1) == 1);
+    }
+    nread = read(fd, &msg[done], BENCH_LAT_MSG - done);
+    if(nread < 0){
+      assert(errno == EAGAIN);
+      continue;
+    }
+    assert(nread > 0);
+    done += (size_t)nread;
+  }
+}
+
+/**
+ * Open one side of the FIFO pair and set up the read mode.
+ *
+ * @param[in]  mode     See @ref bench_lat_mode.
+ * @param[in]  pinger   Open the pinger side instead of the ponger side.
+ * @param[out] read_fd  FIFO this side reads.
+ * @param[out] write_fd FIFO this side writes.
+ * @return              Epoll instance watching @p read_fd.
+ */
+static int
+bench_lat_open(const enum bench_lat_mode mode,
+               const bool pinger,
+               int *const read_fd,
+               int *const write_fd){
+  struct epoll_event ev;
+  int epoll_fd;
+
+  if(pinger){
+    *write_fd = open(BENCH_LAT_PING, O_WRONLY);
+    *read_fd = open(BENCH_LAT_PONG, O_RDONLY);
+  }
+  else{
+    *read_fd = open(BENCH_LAT_PING, O_RDONLY);
+    *write_fd = open(BENCH_LAT_PONG, O_WRONLY);
+  }
+  assert(*read_fd >= 0 && *write_fd >= 0);
+  if(mode != BENCH_LAT_BLOCK){
+    assert(fcntl(*read_fd, F_SETFL, O_NONBLOCK) == 0);
+  }
+  epoll_fd = epoll_create1(0);
+  assert(epoll_fd >= 0);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  assert(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, *read_fd, &ev) == 0);
+  return epoll_fd;
+}
+
+/**
+ * Bounce every message back to the pinger.
+ *
+ * @param[in] mode See @ref bench_lat_mode.
+ * @param[in] n    Number of round trips including warm-up.
+ * @param[in] cpu  CPU to pin to, or negative.
+ */
+static void
+bench_lat_ponger(const enum bench_lat_mode mode,
+                 const size_t n,
+                 const int cpu){
+  char msg[BENCH_LAT_MSG];
+  int read_fd;
+  int write_fd;
+  int epoll_fd;
+  size_t i;
+
+  bench_lat_pin(cpu);
+  epoll_fd = bench_lat_open(mode, false, &read_fd, &write_fd);
+  for(i = 0; i < n; i++){
+    bench_lat_read(mode, read_fd, epoll_fd, msg);
+    assert(write(write_fd, msg, sizeof(msg)) == sizeof(msg));
+  }
+  _exit(0);
+}
+
+/**
+ * Measure round trips with one read mode and print the result.
+ *
+ * @param[in] mode      See @ref bench_lat_mode.
+ * @param[in] mode_name Name of @p mode in the output.
+ * @param[in] n         Number of recorded round trips.
+ * @param[in] cpu_ping  CPU for the pinger, or negative.
+ * @param[in] cpu_pong  CPU for the ponger, or negative.
+ */
+static void
+bench_lat_run(const enum bench_lat_mode mode,
+              const char *const mode_name,
+              const size_t n,
+              const int cpu_ping,
+              const int cpu_pong){
+  struct bench_lat_hist *hist;
+  struct mkfifo_ctx mkfifo_ctx;
+  char msg[BENCH_LAT_MSG];
+  uint64_t start;
+  int read_fd;
+  int write_fd;
+  int epoll_fd;
+  int status;
+  size_t i;
+  pid_t pid;
+
+  memset(&mkfifo_ctx, 0, sizeof(mkfifo_ctx));
+  mkfifo_ctx.mode = S_IRUSR | S_IWUSR;
+  remove(BENCH_LAT_PING);
+  remove(BENCH_LAT_PONG);
+  assert(mkfifo_path(&mkfifo_ctx,
+                     NULL,
+                     BENCH_LAT_PING,
+                     &mkfifo_ctx.create_syscalls) == 0);
+  assert(mkfifo_path(&mkfifo_ctx,
+                     NULL,
+                     BENCH_LAT_PONG,
+                     &mkfifo_ctx.create_syscalls) == 0);
+  hist = calloc(1, sizeof(*hist));
+  assert(hist);
+  pid = fork();
+  assert(pid >= 0);
+  if(pid == 0){
+    bench_lat_ponger(mode, n + BENCH_LAT_WARMUP, cpu_pong);
+  }
+  bench_lat_pin(cpu_ping);
+  epoll_fd = bench_lat_open(mode, true, &read_fd, &write_fd);
+  memset(msg, 'l', sizeof(msg));
+  for(i = 0; i < n + BENCH_LAT_WARMUP; i++){
+    start = mkfifo_clock_ns();
+    assert(write(write_fd, msg, sizeof(msg)) == sizeof(msg));
+    bench_lat_read(mode, read_fd, epoll_fd, msg);
+    if(i >= BENCH_LAT_WARMUP){
+      bench_lat_record(hist, mkfifo_clock_ns() - start);
+    }
+  }
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  printf("{\"bench\":\"latency\",\"mode\":\"%s\",\"msg_size\":%d,"
+         "\"round_trips\":%zu,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+         "\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+         mode_name,
+         BENCH_LAT_MSG,
+         n,
+         (unsigned long long)bench_lat_percentile(hist, 50),
+         (unsigned long long)bench_lat_percentile(hist, 99),
+         (unsigned long long)bench_lat_percentile(hist, 99.9),
+         (unsigned long long)hist->max);
+  fflush(stdout);
+  close(read_fd);
+  close(write_fd);
+  close(epoll_fd);
+  free(hist);
+  remove(BENCH_LAT_PING);
+  remove(BENCH_LAT_PONG);
+}
+
+/**
+ * Benchmark FIFO round trip latency.
+ *
+ * Usage: bench-latency [round-trips [cpu-ping cpu-pong]]
+ *
+ * Busy-poll mode needs the two processes on different CPUs to be useful.
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Argument list.
+ * @retval    0    Benchmark completed.
+ */
+int
+main(int argc,
+     char *argv[]){
+  const char *const mode_names[] = {"block", "spin", "epoll"};
+  size_t n;
+  size_t mode;
+  int cpu_ping;
+  int cpu_pong;
+
+  n = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+  cpu_ping = argc > 3 ? atoi(argv[2]) : -1;
+  cpu_pong = argc > 3 ? atoi(argv[3]) : -1;
+  for(mode = 0; mode < 3; mode++){
+    bench_lat_run((enum bench_lat_mode)mode,
+                  mode_names[mode],
+                  n,
+                  cpu_ping,
+                  cpu_pong);
+  }
+  return 0;
+}
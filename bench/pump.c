@@ -0,0 +1,216 @@
+/**
+ * @file
+ * @brief pump backend benchmark
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Compares the read/write, splice, and vmsplice pump backends by sending
+ * the same file through a FIFO with each of them.
+ *
+ * Build from the top-level directory:
+ * cc -DTEST -o build/bench-pump src/mkfifo.c bench/pump.c
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test/test.h"
+
+/**
+ * Input file sent through the FIFO.
+ */
+#define BENCH_PUMP_INPUT "build/bench-pump-in"
+
+/**
+ * FIFO created by the pump.
+ */
+#define BENCH_PUMP_FIFO "build/bench-pump-fifo"
+
+/**
+ * Size of the buffer used to write the input file and drain the FIFO.
+ */
+#define BENCH_PUMP_BUF (1024 * 1024)
+
+/**
+ * Get a monotonic timestamp in seconds.
+ *
+ * @return Seconds since an unspecified starting point.
+ */
+static double
+bench_now(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Create the input file and read it once so every backend starts with the
+ * file in the page cache.
+ *
+ * @param[in] size Size of the input file in bytes.
+ */
+static void
+bench_pump_prepare(const size_t size){
+  char *buf;
+  size_t off;
+  size_t len;
+  int fd;
+
+  buf = malloc(BENCH_PUMP_BUF);
+  assert(buf);
+  memset(buf, 'p', BENCH_PUMP_BUF);
+  fd = open(BENCH_PUMP_INPUT, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  for(off = 0; off < size; off += len){
+    len = size - off < BENCH_PUMP_BUF ? size - off : BENCH_PUMP_BUF;
+    assert(write(fd, buf, len) == (ssize_t)len);
+  }
+  assert(close(fd) == 0);
+  fd = open(BENCH_PUMP_INPUT, O_RDONLY);
+  assert(fd >= 0);
+  while(read(fd, buf, BENCH_PUMP_BUF) > 0){
+  }
+  assert(close(fd) == 0);
+  free(buf);
+}
+
+/**
+ * Fork a process that drains the FIFO once it exists.
+ *
+ * @param[in] size Number of bytes the reader must receive.
+ * @return         Process ID of the reader.
+ */
+static pid_t
+bench_pump_reader(const size_t size){
+  struct stat sb;
+  size_t total;
+  ssize_t nread;
+  char *buf;
+  int fd;
+  pid_t pid;
+
+  pid = fork();
+  assert(pid >= 0);
+  if(pid == 0){
+    while(stat(BENCH_PUMP_FIFO, &sb) != 0){
+      usleep(100);
+    }
+    fd = open(BENCH_PUMP_FIFO, O_RDONLY);
+    assert(fd >= 0);
+    buf = malloc(BENCH_PUMP_BUF);
+    assert(buf);
+    total = 0;
+    while((nread = read(fd, buf, BENCH_PUMP_BUF)) > 0){
+      total += (size_t)nread;
+    }
+    _exit(total == size ? 0 : 1);
+  }
+  return pid;
+}
+
+/**
+ * Send the input file through a new FIFO with one backend.
+ *
+ * @param[in] backend Backend name given to (-b backend).
+ * @param[in] size    Size of the input file in bytes.
+ * @return            Elapsed seconds.
+ */
+static double
+bench_pump_run(const char *const backend,
+               const size_t size){
+  char *argv[7];
+  double start;
+  int status;
+  pid_t reader;
+  pid_t pump;
+
+  remove(BENCH_PUMP_FIFO);
+  argv[0] = "mkfifo";
+  argv[1] = "-b";
+  argv[2] = (char *)backend;
+  argv[3] = "-p";
+  argv[4] = BENCH_PUMP_INPUT;
+  argv[5] = BENCH_PUMP_FIFO;
+  argv[6] = NULL;
+  reader = bench_pump_reader(size);
+  start = bench_now();
+  pump = fork();
+  assert(pump >= 0);
+  if(pump == 0){
+    fclose(stderr);
+    _exit(mkfifo_main(6, argv));
+  }
+  assert(waitpid(pump, &status, 0) == pump);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(waitpid(reader, &status, 0) == reader);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return bench_now() - start;
+}
+
+/**
+ * Compare callback for qsort() on doubles.
+ *
+ * @param[in] a First value.
+ * @param[in] b Second value.
+ * @return      Negative, zero, or positive like strcmp().
+ */
+static int
+bench_cmp_double(const void *const a,
+                 const void *const b){
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Benchmark the pump backends.
+ *
+ * Usage: bench-pump [size-mib [runs]]
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Argument list.
+ * @retval    0    Benchmark completed.
+ */
+int
+main(int argc,
+     char *argv[]){
+  const char *const backends[] = {"rw", "splice", "vmsplice"};
+  double *elapsed;
+  size_t size;
+  size_t runs;
+  size_t i;
+  size_t j;
+
+  size = (size_t)(argc > 1 ? atol(argv[1]) : 256) * 1024 * 1024;
+  runs = (size_t)(argc > 2 ? atol(argv[2]) : 5);
+  assert(size > 0 && runs > 0);
+  elapsed = calloc(runs, sizeof(*elapsed));
+  assert(elapsed);
+  bench_pump_prepare(size);
+  printf("%-9s %12s %12s\n", "backend", "median MiB/s", "best MiB/s");
+  for(i = 0; i < sizeof(backends) / sizeof(backends[0]); i++){
+    for(j = 0; j < runs; j++){
+      elapsed[j] = bench_pump_run(backends[i], size);
+    }
+    qsort(elapsed, runs, sizeof(*elapsed), bench_cmp_double);
+    printf("%-9s %12.1f %12.1f\n",
+           backends[i],
+           (double)size / (1024 * 1024) / elapsed[runs / 2],
+           (double)size / (1024 * 1024) / elapsed[0]);
+  }
+  remove(BENCH_PUMP_FIFO);
+  remove(BENCH_PUMP_INPUT);
+  free(elapsed);
+  return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * @file
+ * @brief FIFO data throughput benchmark
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Sends data through a FIFO between a writer and a reader process while
+ * sweeping the write size, the pipe capacity, and the transfer method used
+ * by the writer. Each run prints one JSON object per line with the
+ * throughput and the context switches per GB of both processes. Requires
+ * Linux for splice(), vmsplice(), and F_SETPIPE_SZ.
+ *
+ * This file includes the mkfifo source directly so it can create the FIFO
+ * with the creation engine.
+ *
+ * Build from the top-level directory:
+ * cc -DTEST -o build/bench-throughput bench/throughput.c -lpthread
+ */
+
+#include "../src/mkfifo.c"
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+
+/**
+ * FIFO the data goes through.
+ */
+#define BENCH_TP_FIFO "build/bench-throughput-fifo"
+
+/**
+ * Source file used by the splice method.
+ */
+#define BENCH_TP_INPUT "build/bench-throughput-in"
+
+/**
+ * Largest amount of data sent in one run.
+ */
+#define BENCH_TP_MAX_BYTES (256 * 1024 * 1024)
+
+/**
+ * Largest number of writes made in one run.
+ */
+#define BENCH_TP_MAX_WRITES (1024 * 1024)
+
+/**
+ * Transfer methods used by the writer.
+ */
+enum bench_tp_method{
+  /**
+   * write() from a user space buffer.
+   */
+  BENCH_TP_RW,
+
+  /**
+   * splice() from a cached file.
+   */
+  BENCH_TP_SPLICE,
+
+  /**
+   * vmsplice() from a page-aligned user space buffer.
+   */
+  BENCH_TP_VMSPLICE
+};
+
+/**
+ * Run the writer side of one transfer.
+ *
+ * @param[in] method    See @ref bench_tp_method.
+ * @param[in] wsize     Bytes per write.
+ * @param[in] nwrites   Number of writes.
+ * @param[in] pipe_size Pipe capacity to request.
+ */
+static void
+bench_tp_writer(const enum bench_tp_method method,
+                const size_t wsize,
+                const size_t nwrites,
+                const int pipe_size){
+  struct iovec iov;
+  char *buf;
+  size_t done;
+  size_t i;
+  ssize_t rc;
+  off_t off;
+  int in_fd;
+  int fd;
+
+  fd = open(BENCH_TP_FIFO, O_WRONLY);
+  assert(fd >= 0);
+#ifdef F_SETPIPE_SZ
+  assert(fcntl(fd, F_SETPIPE_SZ, pipe_size) >= pipe_size);
+#else /* !(F_SETPIPE_SZ) */
+  (void)pipe_size;
+#endif /* F_SETPIPE_SZ */
+  assert(posix_memalign((void **)&buf, 4096, wsize) == 0);
+  memset(buf, 'w', wsize);
+  in_fd = open(BENCH_TP_INPUT, O_RDONLY);
+  assert(in_fd >= 0);
+  off = 0;
+  for(i = 0; i < nwrites; i++){
+    for(done = 0; done < wsize; done += (size_t)rc){
+      if(method == BENCH_TP_SPLICE){
+        rc = splice(in_fd, &off, fd, NULL, wsize - done, SPLICE_F_MOVE);
+      }
+      else if(method == BENCH_TP_VMSPLICE){
+        iov.iov_base = &buf[done];
+        iov.iov_len = wsize - done;
+        rc = vmsplice(fd, &iov, 1, 0);
+      }
+      else{
+        rc = write(fd, &buf[done], wsize - done);
+      }
+      assert(rc > 0);
+    }
+  }
+  _exit(0);
+}
+
+/**
+ * Run the reader side of one transfer.
+ *
+ * @param[in] wsize Bytes per write, used to size the read buffer.
+ * @param[in] total Number of bytes expected.
+ */
+static void
+bench_tp_reader(const size_t wsize,
+                const size_t total){
+  size_t bufsize;
+  size_t done;
+  ssize_t nread;
+  char *buf;
+  int fd;
+
+  bufsize = wsize < 65536 ? 65536 : wsize;
+  buf = malloc(bufsize);
+  assert(buf);
+  fd = open(BENCH_TP_FIFO, O_RDONLY);
+  assert(fd >= 0);
+  for(done = 0; done < total; done += (size_t)nread){
+    nread = read(fd, buf, bufsize);
+    assert(nread > 0);
+  }
+  _exit(0);
+}
+
+/**
+ * Send data through a new FIFO with one combination of settings and print
+ * the result.
+ *
+ * @param[in] method      See @ref bench_tp_method.
+ * @param[in] method_name Name of @p method in the output.
+ * @param[in] wsize       Bytes per write.
+ * @param[in] pipe_size   Pipe capacity to request.
+ */
+static void
+bench_tp_run(const enum bench_tp_method method,
+             const char *const method_name,
+             const size_t wsize,
+             const int pipe_size){
+  struct mkfifo_ctx mkfifo_ctx;
+  struct rusage ru;
+  uint64_t start;
+  double elapsed;
+  double gb;
+  long ctxsw;
+  size_t nwrites;
+  int status;
+  pid_t pids[2];
+  int i;
+
+  memset(&mkfifo_ctx, 0, sizeof(mkfifo_ctx));
+  mkfifo_ctx.mode = S_IRUSR | S_IWUSR;
+  remove(BENCH_TP_FIFO);
+  assert(mkfifo_path(&mkfifo_ctx,
+                     NULL,
+                     BENCH_TP_FIFO,
+                     &mkfifo_ctx.create_syscalls) == 0);
+  nwrites = BENCH_TP_MAX_BYTES / wsize;
+  if(nwrites > BENCH_TP_MAX_WRITES){
+    nwrites = BENCH_TP_MAX_WRITES;
+  }
+  start = mkfifo_clock_ns();
+  pids[0] = fork();
+  assert(pids[0] >= 0);
+  if(pids[0] == 0){
+    bench_tp_reader(wsize, wsize * nwrites);
+  }
+  pids[1] = fork();
+  assert(pids[1] >= 0);
+  if(pids[1] == 0){
+    bench_tp_writer(method, wsize, nwrites, pipe_size);
+  }
+  ctxsw = 0;
+  for(i = 0; i < 2; i++){
+    assert(wait4(pids[i], &status, 0, &ru) == pids[i]);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ctxsw += ru.ru_nvcsw + ru.ru_nivcsw;
+  }
+  elapsed = (double)(mkfifo_clock_ns() - start) / 1e9;
+  gb = (double)(wsize * nwrites) / 1e9;
+  printf("{\"bench\":\"throughput\",\"method\":\"%s\",\"write_size\":%zu,"
+         "\"pipe_size\":%d,\"bytes\":%zu,\"gb_per_sec\":%.4f,"
+         "\"ctxsw_per_gb\":%.1f}\n",
+         method_name,
+         wsize,
+         pipe_size,
+         wsize * nwrites,
+         gb / elapsed,
+         (double)ctxsw / gb);
+  fflush(stdout);
+  remove(BENCH_TP_FIFO);
+}
+
+/**
+ * Create the cached source file used by the splice method.
+ */
+static void
+bench_tp_prepare(void){
+  char *buf;
+  size_t off;
+  int fd;
+
+  buf = malloc(1024 * 1024);
+  assert(buf);
+  memset(buf, 's', 1024 * 1024);
+  fd = open(BENCH_TP_INPUT, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  for(off = 0; off < BENCH_TP_MAX_BYTES; off += 1024 * 1024){
+    assert(write(fd, buf, 1024 * 1024) == 1024 * 1024);
+  }
+  assert(lseek(fd, 0, SEEK_SET) == 0);
+  while(read(fd, buf, 1024 * 1024) > 0){
+  }
+  assert(close(fd) == 0);
+  free(buf);
+}
+
+/**
+ * Benchmark FIFO data throughput.
+ *
+ * Usage: bench-throughput
+ *
+ * @retval 0 Benchmark completed.
+ */
+int
+main(void){
+  const char *const method_names[] = {"rw", "splice", "vmsplice"};
+  const int pipe_sizes[] = {4096, 65536, 262144, 1048576};
+  size_t method;
+  size_t wsize;
+  size_t i;
+
+  bench_tp_prepare();
+  for(method = 0; method < 3; method++){
+    for(i = 0; i < sizeof(pipe_sizes) / sizeof(pipe_sizes[0]); i++){
+      for(wsize = 1; wsize <= 1024 * 1024; wsize *= 16){
+        bench_tp_run((enum bench_tp_method)method,
+                     method_names[method],
+                     wsize,
+                     pipe_sizes[i]);
+      }
+    }
+  }
+  remove(BENCH_TP_INPUT);
+  return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file
+ * @brief mkfifo as a bash loadable builtin
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Runs @ref mkfifo_run inside the shell, so creating a FIFO from a script
+ * costs the mkfifo() call instead of a fork and exec. mkfifo_run() already
+ * resets getopt on every call, never exits, and leaves the umask and signal
+ * dispositions alone. The shell itself owns the --lease leases.
+ *
+ * Build from the top-level directory, with the bash headers installed
+ * (bash-builtins on Debian):
+ * cc -O2 -fPIC -shared -DMKFIFO_LIBRARY -I/usr/include/bash \
+ *    -I/usr/include/bash/include -I/usr/include/bash/builtins \
+ *    -o build/mkfifo.so src/builtin.c src/mkfifo.c -lpthread
+ *
+ * Load it with:
+ * enable -f build/mkfifo.so mkfifo
+ */
+
+#include <config.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "shell.h"
+#include "common.h"
+
+int
+mkfifo_run(int argc,
+           char *argv[],
+           pid_t owner);
+
+/**
+ * Builtin entry point, called by bash with the arguments after the name.
+ *
+ * SIGPIPE is ignored while mkfifo runs and restored afterwards, so a
+ * reader of a pumped FIFO going away fails the write instead of killing
+ * the shell.
+ *
+ * @param[in] list Arguments.
+ * @retval    EXECUTION_SUCCESS All FIFO files successfully created.
+ * @retval    EXECUTION_FAILURE Failed to create at least one FIFO file.
+ * @retval    EX_USAGE          --help.
+ * @retval    other             Status of the command run by --exec or of
+ *                              the failing stage of --pipeline: its exit
+ *                              status, 126 or 127 if it could not run, or
+ *                              128 plus the signal that killed it.
+ */
+int
+mkfifo_builtin(WORD_LIST *list){
+  struct sigaction ignore;
+  struct sigaction saved;
+  char **argv;
+  int argc;
+  int status;
+
+  CHECK_HELPOPT(list);
+  argv = make_builtin_argv(list, &argc);
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, &saved);
+  status = mkfifo_run(argc, argv, getpid());
+  sigaction(SIGPIPE, &saved, NULL);
+  xfree(argv);
+  if(status == EXIT_SUCCESS){
+    return EXECUTION_SUCCESS;
+  }
+  return status == EXIT_FAILURE ? EXECUTION_FAILURE : status;
+}
+
+/**
+ * Long help shown by (help mkfifo).
+ */
+char *mkfifo_doc[] = {
+  "Create FIFOs.",
+  "",
+  "Create each FILE as a named pipe, without starting a process. Accepts",
+  "the same options as the mkfifo utility:",
+  "",
+  "  mkfifo [--perf] [--stats] [-e engine] [-m mode] [-t | --claim pool]",
+  "         [--lease ttl --lease-index file]",
+  "         [-p input [-b backend] [-s policy]] [-M output [-r format]]",
+  "         file...",
+  "  mkfifo [--stats] [-m mode] --daemon socket",
+  "  mkfifo --gc --lease-index file",
+  "  mkfifo [-m mode] --exec name[:r|:w][,...] -- command [argument...]",
+  "  mkfifo [-e engine] [-m mode] --pipeline spec",
+  "  mkfifo [-e engine] [-m mode] --pool dir --pool-size n",
+  "",
+  "Exit Status:",
+  "Returns success unless a FIFO could not be created or an invalid option",
+  "is given. With --exec, returns the status of the command, and with",
+  "--pipeline that of the last failing stage: 126 or 127 if it could not",
+  "run, or 128 plus the number of the signal that killed it.",
+  (char *)NULL
+};
+
+/**
+ * Builtin description looked up by (enable -f mkfifo.so mkfifo).
+ */
+struct builtin mkfifo_struct = {
+  "mkfifo",
+  mkfifo_builtin,
+  BUILTIN_ENABLED,
+  mkfifo_doc,
+  "mkfifo [--perf] [--stats] [-e engine] [-m mode] [-t | --claim pool] "
+  "[--lease ttl --lease-index file] [-p input [-b backend] [-s policy]] "
+  "[-M output [-r format]] file... | --daemon socket | --gc | "
+  "--exec name[:r|:w][,...] -- command [argument...] | --pipeline spec | "
+  "--pool dir --pool-size n",
+  0
+};
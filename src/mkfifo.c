@@ -6,132 +6,6620 @@
  * This software has been placed into the public domain using CC0.
  */
 
+#ifdef __linux__
+/**
+ * Enable splice() and friends on Linux.
+ */
+# define _GNU_SOURCE
+#endif /* __linux__ */
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/epoll.h>
+# include <sys/inotify.h>
+# include <sys/syscall.h>
+# include <sys/timerfd.h>
+# include <sys/uio.h>
+#endif /* __linux__ */
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#ifdef TEST
+#include "mkfifo.h"
+
+#ifdef TEST
+/**
+ * Declare some functions with extern linkage, allowing the test suite to call
+ * those functions.
+ */
+# define LINKAGE extern
+# include "../test/test.h"
+#elif defined(MKFIFO_LIBRARY)
+/**
+ * The library build has no main(), so keep @ref mkfifo_run and
+ * @ref mkfifo_main extern rather than unused. @ref mkfifo_batch is the
+ * supported interface.
+ */
+# define LINKAGE extern
+#else /* !(TEST) && !(MKFIFO_LIBRARY) */
+/**
+ * Define all functions as static when not testing.
+ */
+# define LINKAGE static
+#endif /* TEST */
+
+/*
+ * USDT probes for bpftrace, perf, and SystemTap, when sys/sdt.h is available.
+ * Build with -DMKFIFO_NO_USDT to leave them out.
+ */
+#if defined(__linux__) && !defined(MKFIFO_NO_USDT) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+# endif
+#endif
+
+#ifdef STAP_PROBE1
+/**
+ * USDT probe with one argument in the mkfifo provider.
+ */
+# define MKFIFO_PROBE1(name, a) STAP_PROBE1(mkfifo, name, a)
+
+/**
+ * USDT probe with two arguments in the mkfifo provider.
+ */
+# define MKFIFO_PROBE2(name, a, b) STAP_PROBE2(mkfifo, name, a, b)
+
+/**
+ * USDT probe with three arguments in the mkfifo provider.
+ */
+# define MKFIFO_PROBE3(name, a, b, c) STAP_PROBE3(mkfifo, name, a, b, c)
+#else /* !(STAP_PROBE1) */
+/**
+ * USDT probe compiled out, keeping its argument referenced.
+ */
+# define MKFIFO_PROBE1(name, a) ((void)(a))
+
+/**
+ * USDT probe compiled out, keeping its arguments referenced.
+ */
+# define MKFIFO_PROBE2(name, a, b) ((void)(a), (void)(b))
+
+/**
+ * USDT probe compiled out, keeping its arguments referenced.
+ */
+# define MKFIFO_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif /* STAP_PROBE1 */
+
+/**
+ * Number of directories kept open by each @ref mkfifo_dircache.
+ */
+#define MKFIFO_DIRCACHE_SIZE 64
+
+/**
+ * Maximum number of threads used by @ref MKFIFO_ENGINE_THREAD.
+ */
+#define MKFIFO_THREADS_MAX 16
+
+/**
+ * Number of paths that justify starting another creation thread.
+ */
+#define MKFIFO_THREAD_MIN_PATHS 256
+
+/**
+ * Size of each chunk moved through the FIFO by the pump.
+ */
+#define MKFIFO_PUMP_CHUNK (64 * 1024)
+
+/**
+ * Size of each window of the input file mapped by the vmsplice backend.
+ */
+#define MKFIFO_VMSPLICE_WINDOW (4 * 1024 * 1024)
+
+/**
+ * Number of merged bytes collected before writing them to the output.
+ */
+#define MKFIFO_MERGE_BATCH (256 * 1024)
+
+/**
+ * Maximum number of ready inputs handled per wakeup in merge mode.
+ */
+#define MKFIFO_MERGE_EVENTS 64
+
+/**
+ * Largest record accepted in merge mode, including its header.
+ */
+#define MKFIFO_RECORD_MAX (16 * 1024 * 1024)
+
+/**
+ * Largest request accepted by @ref mkfifo_daemon.
+ */
+#define MKFIFO_DAEMON_MSG_MAX (64 * 1024)
+
+/**
+ * Most descriptors passed back in one reply by @ref mkfifo_daemon, which
+ * is SCM_MAX_FD on Linux.
+ */
+#define MKFIFO_DAEMON_FDS_MAX 253
+
+/**
+ * Fewest trailing X characters accepted in a (-t) template.
+ */
+#define MKFIFO_TEMPLATE_MIN_X 6
+
+/**
+ * Most names tried for one (-t) template before giving up with EEXIST.
+ */
+#define MKFIFO_TEMPLATE_TRIES 100
+
+/**
+ * Room for a --pool entry name, .fill.PID.SEQ or fifo.PID.SEQ.
+ */
+#define MKFIFO_POOL_NAME_MAX 64
+
+/**
+ * Pipe size requested for a --pipeline edge that does not give one.
+ */
+#define MKFIFO_PIPELINE_PIPE_SIZE (1024 * 1024)
+
+/**
+ * Milliseconds between occupancy samples of the --pipeline edges.
+ */
+#define MKFIFO_PIPELINE_TICK_MS 10
+
+/**
+ * Milliseconds between retries of the writers waiting in a
+ * @ref mkfifo_opener, for readers blocked in open() that inotify cannot
+ * report.
+ */
+#define MKFIFO_OPENER_RETRY_MS 10
+
+/**
+ * Size of the big-endian length header in front of each length-delimited
+ * record.
+ */
+#define MKFIFO_FRAME_HDR 4
+
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+/**
+ * Program name in diagnostics, as err.h prints it. getprogname() needs
+ * libbsd on glibc.
+ */
+# define MKFIFO_PROGNAME program_invocation_short_name
+#else /* !(__GLIBC__ && _GNU_SOURCE) */
+/**
+ * Program name in diagnostics, as err.h prints it.
+ */
+# define MKFIFO_PROGNAME getprogname()
+#endif /* __GLIBC__ && _GNU_SOURCE */
+
+/**
+ * Directory held open by a @ref mkfifo_dircache.
+ */
+struct mkfifo_dircache_entry{
+  /**
+   * Directory path, or NULL if the entry is unused.
+   */
+  char *dir;
+
+  /**
+   * Length of @ref dir.
+   */
+  size_t len;
+
+  /**
+   * Open directory file descriptor.
+   */
+  int fd;
+};
+
+/**
+ * Directory file descriptors reused across FIFOs in the same directory.
+ */
+struct mkfifo_dircache{
+  /**
+   * Direct-mapped on a hash of the directory path.
+   */
+  struct mkfifo_dircache_entry entries[MKFIFO_DIRCACHE_SIZE];
+
+  /**
+   * Number of open, close, and mkfifoat system calls made.
+   */
+  uint64_t syscalls;
+
+  /**
+   * Time spent resolving directories, only measured with --stats.
+   */
+  uint64_t dir_ns;
+
+  /**
+   * Check on every hit that the directory was not removed, for caches that
+   * outlive one batch like the one in @ref mkfifo_daemon.
+   */
+  bool revalidate;
+};
+
+/**
+ * Number of errno values tracked individually in @ref mkfifo_stats.
+ */
+#define MKFIFO_STATS_ERRNO_MAX 256
+
+/**
+ * Number of counters opened by --perf.
+ */
+#define MKFIFO_PERF_COUNTERS 4
+
+/**
+ * Transfer counters collected while pumping data into a FIFO.
+ */
+struct mkfifo_pump_stats{
+  /**
+   * Number of bytes written into the FIFO.
+   */
+  uint64_t bytes;
+
+  /**
+   * Number of read, write, and splice system calls made.
+   */
+  uint64_t syscalls;
+
+  /**
+   * Set once splice() has moved data, after which errors are not treated as
+   * missing support.
+   */
+  bool spliced;
+
+  /**
+   * Name of the transfer method that moved the data.
+   */
+  const char *method;
+};
+
+/**
+ * Transfer method used to pump data into a single FIFO (-b backend).
+ */
+enum mkfifo_pump_backend{
+  /**
+   * Use splice() and fall back to read/write when not supported.
+   */
+  MKFIFO_BACKEND_AUTO,
+
+  /**
+   * Copy through a user space buffer with read() and write().
+   */
+  MKFIFO_BACKEND_RW,
+
+  /**
+   * Move pages from the input with splice().
+   */
+  MKFIFO_BACKEND_SPLICE,
+
+  /**
+   * Map the input file and gift its pages with vmsplice().
+   */
+  MKFIFO_BACKEND_VMSPLICE
+};
+
+/**
+ * What the fan-out mode does when one of the output FIFOs cannot accept
+ * more data (-s policy).
+ */
+enum mkfifo_slow_policy{
+  /**
+   * Wait for the consumer, stalling every other output.
+   */
+  MKFIFO_SLOW_BLOCK,
+
+  /**
+   * Discard the data that the consumer has no room for.
+   */
+  MKFIFO_SLOW_DROP,
+
+  /**
+   * Close the output and stop feeding the consumer.
+   */
+  MKFIFO_SLOW_DISCONNECT
+};
+
+/**
+ * One output FIFO in fan-out mode.
+ */
+struct mkfifo_fanout_out{
+  /**
+   * FIFO path.
+   */
+  const char *path;
+
+  /**
+   * Write end of the FIFO, or -1 after disconnecting.
+   */
+  int fd;
+
+  /**
+   * Number of bytes delivered to this output.
+   */
+  uint64_t bytes;
+
+  /**
+   * Number of chunks that found the output without enough room.
+   */
+  uint64_t stalls;
+
+  /**
+   * Number of bytes discarded by @ref MKFIFO_SLOW_DROP.
+   */
+  uint64_t dropped;
+};
+
+/**
+ * How records are delimited in pump and merge mode (-r format).
+ */
+enum mkfifo_record_format{
+  /**
+   * No record boundaries, the pump copies raw bytes and merge mode splits
+   * records on newlines.
+   */
+  MKFIFO_RECORD_NONE,
+
+  /**
+   * Each record ends with a newline.
+   */
+  MKFIFO_RECORD_LINE,
+
+  /**
+   * Each record starts with a @ref MKFIFO_FRAME_HDR byte length.
+   */
+  MKFIFO_RECORD_LENGTH
+};
+
+/**
+ * One input of records, either a FIFO in merge mode or the pump input.
+ */
+struct mkfifo_record_in{
+  /**
+   * Input path.
+   */
+  const char *path;
+
+  /**
+   * Input file descriptor, or -1 after all writers have closed the FIFO.
+   */
+  int fd;
+
+  /**
+   * Data read from the input that does not form a complete record yet.
+   */
+  char *buf;
+
+  /**
+   * Number of bytes in @ref buf.
+   */
+  size_t len;
+
+  /**
+   * Allocated size of @ref buf.
+   */
+  size_t cap;
+
+  /**
+   * Offset in @ref buf already searched for a newline.
+   */
+  size_t scan;
+
+  /**
+   * Number of complete records taken from this input.
+   */
+  uint64_t records;
+};
+
+/**
+ * Pump output that writes whole records into a FIFO shared with other
+ * writers.
+ */
+struct mkfifo_record_out{
+  /**
+   * Write end of the FIFO.
+   */
+  int fd;
+
+  /**
+   * Small records collected into a single atomic write.
+   */
+  char batch[PIPE_BUF];
+
+  /**
+   * Number of bytes in @ref batch.
+   */
+  size_t len;
+};
+
+/**
+ * State of a merge run.
+ */
+struct mkfifo_merge{
+  /**
+   * Input FIFOs.
+   */
+  struct mkfifo_record_in *inputs;
+
+  /**
+   * Number of entries in @ref inputs.
+   */
+  size_t ninputs;
+
+  /**
+   * Number of inputs that still have writers.
+   */
+  size_t open_inputs;
+
+  /**
+   * Waits for readable inputs.
+   */
+  int epoll_fd;
+
+  /**
+   * Merged output file descriptor.
+   */
+  int out_fd;
+
+  /**
+   * Complete records waiting to be written to @ref out_fd.
+   */
+  char *out;
+
+  /**
+   * Number of bytes in @ref out.
+   */
+  size_t out_len;
+
+  /**
+   * Total number of records merged.
+   */
+  uint64_t records;
+
+  /**
+   * Bytes and write() calls made on the output.
+   */
+  struct mkfifo_pump_stats stats;
+};
+
+/**
+ * Counters and phase timings printed by --stats.
+ */
+struct mkfifo_stats{
+  /**
+   * Number of paths given on the command line.
+   */
+  size_t processed;
+
+  /**
+   * Number of FIFOs created.
+   */
+  size_t created;
+
+  /**
+   * Number of paths that already existed (EEXIST).
+   */
+  size_t existing;
+
+  /**
+   * Number of paths that failed for any other reason.
+   */
+  size_t failed;
+
+  /**
+   * Failures counted by errno, with larger values in the last slot.
+   */
+  size_t failed_errno[MKFIFO_STATS_ERRNO_MAX];
+
+  /**
+   * Time spent in @ref mkfifo_parse_mode.
+   */
+  uint64_t parse_ns;
+
+  /**
+   * Time spent resolving directories in the directory cache.
+   */
+  uint64_t dir_ns;
+};
+
+/**
+ * Leases recorded for the FIFOs created by one invocation (--lease ttl).
+ *
+ * Each created FIFO adds one line to @ref buf, and the whole batch gets
+ * appended to the lease index with a single write() at the end.
+ */
+struct mkfifo_lease{
+  /**
+   * Lease index file (--lease-index file).
+   */
+  const char *index;
+
+  /**
+   * Wall clock time in seconds after which the FIFOs may be collected.
+   */
+  long long expiry;
+
+  /**
+   * Process that owns the FIFOs, see @ref mkfifo_run. Its FIFOs outlive
+   * their expiry for as long as it runs.
+   */
+  long owner;
+
+  /**
+   * Working directory prepended to relative paths, or NULL.
+   */
+  char *cwd;
+
+  /**
+   * Index lines not written yet.
+   */
+  char *buf;
+
+  /**
+   * Number of bytes in @ref buf.
+   */
+  size_t len;
+
+  /**
+   * Allocated size of @ref buf.
+   */
+  size_t cap;
+};
+
+/**
+ * Identity of one FIFO held open by some process, see @ref mkfifo_gc.
+ */
+struct mkfifo_gc_inode{
+  /**
+   * Device of the FIFO.
+   */
+  dev_t dev;
+
+  /**
+   * Inode of the FIFO.
+   */
+  ino_t ino;
+};
+
+/**
+ * FIFO created in the private directory of --exec.
+ */
+struct mkfifo_exec_fifo{
+  /**
+   * Name inside the private directory.
+   */
+  const char *name;
+
+  /**
+   * Full path substituted for {name}.
+   */
+  char *path;
+
+  /**
+   * O_RDONLY or O_RDWR to pass the FIFO to the command open, or -1.
+   */
+  int open_flags;
+
+  /**
+   * Descriptor opened for the command, or -1.
+   */
+  int fd;
+
+  /**
+   * Descriptor number the command inherits @ref fd as.
+   */
+  int target;
+};
+
+/**
+ * Stage of a --pipeline spec.
+ */
+struct mkfifo_pipeline_stage{
+  /**
+   * Name given in the spec.
+   */
+  const char *name;
+
+  /**
+   * Command run with /bin/sh -c.
+   */
+  const char *command;
+
+  /**
+   * Running process, or -1 before it starts and after it is reaped.
+   */
+  pid_t pid;
+
+  /**
+   * Exit status like the shell reports it, or -1 until reaped.
+   */
+  int status;
+
+  /**
+   * Time the stage started.
+   */
+  uint64_t start_ns;
+
+  /**
+   * Time from start until reaped.
+   */
+  uint64_t wall_ns;
+
+  /**
+   * Time spent writing to a full edge or reading from an empty one.
+   */
+  uint64_t blocked_ns;
+
+  /**
+   * Time other stages spent blocked on this one.
+   */
+  uint64_t blocking_ns;
+
+  /**
+   * Set while sampling if the stage is blocked during the current tick.
+   */
+  bool blocked;
+
+  /**
+   * Set while sampling if the stage blocks another during the current tick.
+   */
+  bool blocking;
+};
+
+/**
+ * FIFO between two stages of a --pipeline spec.
+ */
+struct mkfifo_pipeline_edge{
+  /**
+   * Name given in the spec, and of the FIFO in the private directory.
+   */
+  const char *name;
+
+  /**
+   * Name of the stage writing to the edge.
+   */
+  const char *from_name;
+
+  /**
+   * Name of the stage reading from the edge.
+   */
+  const char *to_name;
+
+  /**
+   * Full path substituted for {name}.
+   */
+  char *path;
+
+  /**
+   * Index of the writing stage.
+   */
+  size_t from;
+
+  /**
+   * Index of the reading stage.
+   */
+  size_t to;
+
+  /**
+   * Pipe size requested in the spec, then the one the kernel applied, or 0
+   * if unknown.
+   */
+  int size;
+
+  /**
+   * Read end, kept open to sample the occupancy until the reader exits,
+   * or -1.
+   */
+  int rfd;
+
+  /**
+   * Write end, closed once every stage started, or -1.
+   */
+  int wfd;
+
+  /**
+   * Number of occupancy samples.
+   */
+  uint64_t samples;
+
+  /**
+   * Sum of the sampled occupancy in bytes.
+   */
+  uint64_t bytes_sum;
+
+  /**
+   * Highest sampled occupancy in bytes.
+   */
+  uint64_t bytes_max;
+
+  /**
+   * Time the edge was too full for another atomic write.
+   */
+  uint64_t full_ns;
+
+  /**
+   * Time the edge was empty while the writer was still running.
+   */
+  uint64_t empty_ns;
+};
+
+/**
+ * Parsed --pipeline spec.
+ */
+struct mkfifo_pipeline{
+  /**
+   * Contents of the spec, split in place.
+   */
+  char *text;
+
+  /**
+   * See @ref mkfifo_pipeline_stage.
+   */
+  struct mkfifo_pipeline_stage *stages;
+
+  /**
+   * Number of entries in @ref stages.
+   */
+  size_t nstages;
+
+  /**
+   * See @ref mkfifo_pipeline_edge.
+   */
+  struct mkfifo_pipeline_edge *edges;
+
+  /**
+   * Number of entries in @ref edges.
+   */
+  size_t nedges;
+};
+
+/**
+ * Counters bracketing the creation phase for --perf.
+ *
+ * Uses perf_event_open() where available. Counters the kernel refuses stay
+ * closed, and if none open the context switches and page faults come from
+ * getrusage() instead.
+ */
+struct mkfifo_perf{
+  /**
+   * perf_event descriptors in the order of @ref mkfifo_perf_names, or -1.
+   */
+  int fd[MKFIFO_PERF_COUNTERS];
+
+  /**
+   * Counter values, valid where @ref fd is open or filled from getrusage().
+   */
+  uint64_t value[MKFIFO_PERF_COUNTERS];
+
+  /**
+   * Set for each entry in @ref value that holds a measurement.
+   */
+  bool valid[MKFIFO_PERF_COUNTERS];
+
+  /**
+   * Resource usage when the counters started, for the getrusage() fallback.
+   */
+  struct rusage start;
+
+  /**
+   * Where the counters came from: hardware, software, or rusage.
+   */
+  const char *source;
+};
+
+/**
+ * mkfifo utility context.
+ */
+struct mkfifo_ctx{
+  /**
+   * Exit status set to one of the following values.
+   *   - EXIT_SUCCESS
+   *   - EXIT_FAILURE
+   */
+  int status_code;
+
+  /**
+   * File permissions used in mkfifo().
+   */
+  mode_t mode;
+
+  /**
+   * Mode given with (-m mode), applied with chmod() after creation so the
+   * process umask does not have to change.
+   */
+  bool mode_set;
+
+  /**
+   * Input file to pump into the FIFO (-p input), "-" for STDIN, or NULL.
+   */
+  const char *pump_input;
+
+  /**
+   * Slow consumer handling when pumping into multiple FIFOs (-s policy).
+   */
+  enum mkfifo_slow_policy slow_policy;
+
+  /**
+   * Transfer method used when pumping into one FIFO (-b backend).
+   */
+  enum mkfifo_pump_backend pump_backend;
+
+  /**
+   * Merge the FIFOs into this output file (-M output), "-" for STDOUT, or
+   * NULL.
+   */
+  const char *merge_output;
+
+  /**
+   * Record delimiter used in merge mode (-r format).
+   */
+  enum mkfifo_record_format record_format;
+
+  /**
+   * How FIFOs get created (-e engine).
+   */
+  enum mkfifo_engine engine;
+
+  /**
+   * If not NULL, receives the creation latency of each path in nanoseconds.
+   */
+  uint64_t *latency_ns;
+
+  /**
+   * Number of system calls made while creating the FIFOs.
+   */
+  uint64_t create_syscalls;
+
+  /**
+   * Statistics collected for --stats, or NULL to skip all counting and
+   * timing.
+   */
+  struct mkfifo_stats *stats;
+
+  /**
+   * Counters collected for --perf, or NULL.
+   */
+  struct mkfifo_perf *perf;
+
+  /**
+   * Serve requests on this Unix socket (--daemon socket), or NULL.
+   */
+  const char *daemon_socket;
+
+  /**
+   * Leases of the FIFOs created by this invocation, or NULL without
+   * --lease.
+   */
+  struct mkfifo_lease *lease;
+};
+
+/**
+ * Serializes getopt_long(), whose state is global, so @ref mkfifo_run can
+ * run on several threads at once.
+ */
+static pthread_mutex_t mkfifo_getopt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * JSON names of the counters in @ref mkfifo_perf.
+ */
+static const char *const mkfifo_perf_names[MKFIFO_PERF_COUNTERS] = {
+  "cycles",
+  "instructions",
+  "context_switches",
+  "page_faults"
+};
+
+/**
+ * Range of paths created by one thread of @ref mkfifo_create_all.
+ */
+struct mkfifo_create_job{
+  /**
+   * See @ref mkfifo_ctx.
+   */
+  const struct mkfifo_ctx *mkfifo_ctx;
+
+  /**
+   * All paths to create.
+   */
+  const char *const *paths;
+
+  /**
+   * Receives the result of @ref mkfifo_path for each path.
+   */
+  int *errs;
+
+  /**
+   * Index of the first path in this range.
+   */
+  size_t first;
+
+  /**
+   * Index after the last path in this range.
+   */
+  size_t last;
+
+  /**
+   * Directory cache used by this range.
+   */
+  struct mkfifo_dircache cache;
+
+  /**
+   * Thread creating this range.
+   */
+  pthread_t thread;
+
+  /**
+   * Set if @ref thread is running, otherwise the range gets created by the
+   * calling thread.
+   */
+  bool started;
+};
+
+/**
+ * Print an error message to STDERR and set an error status code.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     errno_msg  Include a standard message describing errno.
+ * @param[in]     fmt        Format string used by vwarn.
+ */
+static void
+mkfifo_warn(struct mkfifo_ctx *const mkfifo_ctx,
+            const bool errno_msg,
+            const char *const fmt, ...){
+  va_list ap;
+  int errno_save;
+
+  errno_save = errno;
+  MKFIFO_PROBE2(warn_entry, fmt, errno_save);
+  mkfifo_ctx->status_code = EXIT_FAILURE;
+  va_start(ap, fmt);
+  if(errno_msg){
+    vwarn(fmt, ap);
+  }
+  else{
+    vwarnx(fmt, ap);
+  }
+  va_end(ap);
+  MKFIFO_PROBE2(warn_return, fmt, errno_save);
+}
+
+/**
+ * Check if mkfifo() failed only because another writer already created the
+ * FIFO that a record pump (-p input -r format) wants to share.
+ *
+ * @param[in] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in] path       Path that mkfifo() failed to create.
+ * @retval    true       Path is an existing FIFO that the pump can join.
+ * @retval    false      Report the mkfifo() error, with errno preserved.
+ */
+static bool
+mkfifo_is_shared(const struct mkfifo_ctx *const mkfifo_ctx,
+                 const char *const path){
+  struct stat sb;
+  int errno_save;
+
+  errno_save = errno;
+  if(errno_save == EEXIST &&
+     mkfifo_ctx->pump_input &&
+     mkfifo_ctx->record_format != MKFIFO_RECORD_NONE &&
+     stat(path, &sb) == 0 &&
+     S_ISFIFO(sb.st_mode)){
+    return true;
+  }
+  errno = errno_save;
+  return false;
+}
+
+/**
+ * Get a monotonic timestamp in nanoseconds.
+ *
+ * @return Nanoseconds since an unspecified starting point.
+ */
+static uint64_t
+mkfifo_clock_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Release every directory held by a directory cache.
+ *
+ * @param[in,out] cache See @ref mkfifo_dircache.
+ */
+static void
+mkfifo_dircache_free(struct mkfifo_dircache *const cache){
+  size_t i;
+
+  for(i = 0; i < MKFIFO_DIRCACHE_SIZE; i++){
+    if(cache->entries[i].dir){
+      close(cache->entries[i].fd);
+      free(cache->entries[i].dir);
+      cache->entries[i].dir = NULL;
+    }
+  }
+}
+
+/**
+ * Get a file descriptor for the directory that contains @p path.
+ *
+ * Directories get opened once and stay open in a small hash table, so
+ * creating many FIFOs in the same directories does not resolve the
+ * directory part of every path again. A directory replaced while cached
+ * keeps receiving FIFOs through its old descriptor, unless the cache
+ * revalidates and the old directory was removed.
+ *
+ * @param[in,out] cache See @ref mkfifo_dircache.
+ * @param[in]     path  Path of the FIFO to create.
+ * @param[out]    base  Part of @p path to create relative to the result.
+ * @retval        >=0   Directory file descriptor.
+ * @retval        -1    Failed to open the directory with errno set.
+ * @return              AT_FDCWD to create @p base relative to the working
+ *                      directory.
+ */
+static int
+mkfifo_dircache_get(struct mkfifo_dircache *const cache,
+                    const char *const path,
+                    const char **const base){
+  struct mkfifo_dircache_entry *entry;
+  const char *slash;
+  struct stat sb;
+  uint32_t hash;
+  size_t len;
+  size_t i;
+
+  slash = strrchr(path, '/');
+  if(slash == NULL || slash[1] == '\0'){
+    *base = path;
+    return AT_FDCWD;
+  }
+  *base = slash + 1;
+  len = slash == path ? 1 : (size_t)(slash - path);
+  hash = 2166136261u;
+  for(i = 0; i < len; i++){
+    hash = (hash ^ (unsigned char)path[i]) * 16777619u;
+  }
+  entry = &cache->entries[hash % MKFIFO_DIRCACHE_SIZE];
+  if(entry->dir && entry->len == len && memcmp(entry->dir, path, len) == 0){
+    if(!cache->revalidate){
+      return entry->fd;
+    }
+    cache->syscalls += 1;
+    if(fstat(entry->fd, &sb) == 0 && sb.st_nlink > 0){
+      return entry->fd;
+    }
+  }
+  if(entry->dir){
+    cache->syscalls += 1;
+    close(entry->fd);
+    free(entry->dir);
+    entry->dir = NULL;
+  }
+  if((entry->dir = malloc(len + 1)) == NULL){
+    return -1;
+  }
+  memcpy(entry->dir, path, len);
+  entry->dir[len] = '\0';
+  entry->len = len;
+  cache->syscalls += 1;
+  entry->fd = open(entry->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(entry->fd < 0){
+    free(entry->dir);
+    entry->dir = NULL;
+    return -1;
+  }
+  return entry->fd;
+}
+
+/**
+ * Apply an exact mode to a FIFO that was just created, without following a
+ * symlink that replaced it in the meantime.
+ *
+ * Where fchmodat() does not support AT_SYMLINK_NOFOLLOW, the FIFO is opened
+ * with O_NOFOLLOW instead, without waiting for a writer, and must still be
+ * the same FIFO before fchmod().
+ *
+ * @param[in] dir_fd Directory @p name is relative to, or AT_FDCWD.
+ * @param[in] name   FIFO to change.
+ * @param[in] mode   File permissions.
+ * @retval    0      Changed the mode.
+ * @retval    >0     errno describing the failure, ELOOP or EEXIST if
+ *                   @p name is no longer a FIFO.
+ */
+static int
+mkfifo_chmod(const int dir_fd,
+             const char *const name,
+             const mode_t mode){
+  struct stat before;
+  struct stat sb;
+  int err;
+  int fd;
+
+  if(fchmodat(dir_fd, name, mode, AT_SYMLINK_NOFOLLOW) == 0){
+    return 0;
+  }
+  if(errno != EOPNOTSUPP && errno != ENOTSUP){
+    return errno;
+  }
+  if(fstatat(dir_fd, name, &before, AT_SYMLINK_NOFOLLOW) != 0){
+    return errno;
+  }
+  if(!S_ISFIFO(before.st_mode)){
+    return S_ISLNK(before.st_mode) ? ELOOP : EEXIST;
+  }
+  fd = openat(dir_fd, name, O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC);
+  if(fd < 0){
+    return errno;
+  }
+  err = 0;
+  if(fstat(fd, &sb) != 0){
+    err = errno;
+  }
+  else if(!S_ISFIFO(sb.st_mode) ||
+          sb.st_dev != before.st_dev ||
+          sb.st_ino != before.st_ino){
+    err = EEXIST;
+  }
+  else if(fchmod(fd, mode) != 0){
+    err = errno;
+  }
+  close(fd);
+  return err;
+}
+
+/**
+ * Create a new FIFO using mkfifo(), or mkfifoat() relative to a cached
+ * directory.
+ *
+ * Safe to call from several threads as long as each uses its own @p cache.
+ * An explicit (-m mode) is applied after creation with @ref mkfifo_chmod,
+ * which like coreutils does not follow a symlink put in place of the FIFO,
+ * instead of clearing the umask for the whole process.
+ * If the directory cannot be cached, for example because it does not exist
+ * or the process is out of file descriptors, this falls back to mkfifo() so
+ * the error matches the serial engine.
+ *
+ * @param[in]     mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] cache      Directory cache, or NULL to use mkfifo().
+ * @param[in]     path       Path to new FIFO file to create.
+ * @param[in,out] syscalls   Incremented for each mkfifo and chmod call made.
+ * @retval        0          Created the FIFO.
+ * @retval        >0         errno describing the failure.
+ */
+static int
+mkfifo_path(const struct mkfifo_ctx *const mkfifo_ctx,
+            struct mkfifo_dircache *const cache,
+            const char *const path,
+            uint64_t *const syscalls){
+  const char *base;
+  uint64_t start;
+  int dir_fd;
+  int err;
+
+  MKFIFO_PROBE2(path_entry, path, mkfifo_ctx->mode);
+  dir_fd = -1;
+  if(cache && mkfifo_ctx->stats){
+    start = mkfifo_clock_ns();
+    dir_fd = mkfifo_dircache_get(cache, path, &base);
+    cache->dir_ns += mkfifo_clock_ns() - start;
+  }
+  else if(cache){
+    dir_fd = mkfifo_dircache_get(cache, path, &base);
+  }
+  *syscalls += 1;
+  if(dir_fd == -1){
+    err = mkfifo(path, mkfifo_ctx->mode) == 0 ? 0 : errno;
+    if(err == 0 && mkfifo_ctx->mode_set){
+      *syscalls += 1;
+      err = mkfifo_chmod(AT_FDCWD, path, mkfifo_ctx->mode);
+    }
+  }
+  else{
+    err = mkfifoat(dir_fd, base, mkfifo_ctx->mode) == 0 ? 0 : errno;
+    if(err == 0 && mkfifo_ctx->mode_set){
+      *syscalls += 1;
+      err = mkfifo_chmod(dir_fd, base, mkfifo_ctx->mode);
+    }
+  }
+  MKFIFO_PROBE3(path_return, path, mkfifo_ctx->mode, err);
+  return err;
+}
+
+/**
+ * Count the result of @ref mkfifo_path for --stats.
+ *
+ * @param[in,out] stats See @ref mkfifo_stats.
+ * @param[in]     err   Result of @ref mkfifo_path.
+ */
+static void
+mkfifo_stats_count(struct mkfifo_stats *const stats,
+                   const int err){
+  stats->processed += 1;
+  if(err == 0){
+    stats->created += 1;
+  }
+  else if(err == EEXIST){
+    stats->existing += 1;
+  }
+  else{
+    stats->failed += 1;
+    stats->failed_errno[err < MKFIFO_STATS_ERRNO_MAX ?
+                        err : MKFIFO_STATS_ERRNO_MAX - 1] += 1;
+  }
+}
+
+/**
+ * Add a lease line for a FIFO that was just created.
+ *
+ * The line records the device and inode so the collector never removes a
+ * different FIFO that later took the same path.
+ *
+ * @param[in,out] lease See @ref mkfifo_lease.
+ * @param[in]     path  FIFO created by @ref mkfifo_path.
+ * @retval        0     Added the lease.
+ * @retval        -1    Failed with errno set.
+ */
+static int
+mkfifo_lease_add(struct mkfifo_lease *const lease,
+                 const char *const path){
+  struct stat sb;
+  size_t need;
+  char *buf;
+  int len;
+
+  if(strchr(path, '\n')){
+    errno = EINVAL;
+    return -1;
+  }
+  if(lstat(path, &sb) != 0){
+    return -1;
+  }
+  need = strlen(path) + (lease->cwd ? strlen(lease->cwd) : 0) + 96;
+  if(lease->cap - lease->len < need){
+    buf = realloc(lease->buf, lease->cap * 2 + need);
+    if(buf == NULL){
+      return -1;
+    }
+    lease->buf = buf;
+    lease->cap = lease->cap * 2 + need;
+  }
+  len = snprintf(&lease->buf[lease->len],
+                 lease->cap - lease->len,
+                 "%lld %ld %llu %llu %s%s%s\n",
+                 lease->expiry,
+                 lease->owner,
+                 (unsigned long long)sb.st_dev,
+                 (unsigned long long)sb.st_ino,
+                 path[0] != '/' && lease->cwd ? lease->cwd : "",
+                 path[0] != '/' && lease->cwd ? "/" : "",
+                 path);
+  lease->len += (size_t)len;
+  return 0;
+}
+
+/**
+ * Report the result of @ref mkfifo_path.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     path       Path to new FIFO file.
+ * @param[in]     err        Result of @ref mkfifo_path.
+ */
+static void
+mkfifo_path_report(struct mkfifo_ctx *const mkfifo_ctx,
+                   const char *const path,
+                   const int err){
+  if(mkfifo_ctx->stats){
+    mkfifo_stats_count(mkfifo_ctx->stats, err);
+  }
+  if(err == 0 && mkfifo_ctx->lease &&
+     mkfifo_lease_add(mkfifo_ctx->lease, path) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "cannot lease fifo: %s", path);
+  }
+  if(err != 0){
+    errno = err;
+    if(!mkfifo_is_shared(mkfifo_ctx, path)){
+      mkfifo_warn(mkfifo_ctx, true, "cannot create fifo: %s", path);
+    }
+  }
+}
+
+/**
+ * Create a contiguous range of FIFOs, recording the result of each.
+ *
+ * @param[in,out] job See @ref mkfifo_create_job.
+ */
+static void
+mkfifo_create_range(struct mkfifo_create_job *const job){
+  const struct mkfifo_ctx *const mkfifo_ctx = job->mkfifo_ctx;
+  uint64_t start;
+  size_t i;
+
+  for(i = job->first; i < job->last; i++){
+    if(mkfifo_ctx->latency_ns){
+      start = mkfifo_clock_ns();
+      job->errs[i] = mkfifo_path(mkfifo_ctx,
+                                 &job->cache,
+                                 job->paths[i],
+                                 &job->cache.syscalls);
+      mkfifo_ctx->latency_ns[i] = mkfifo_clock_ns() - start;
+    }
+    else{
+      job->errs[i] = mkfifo_path(mkfifo_ctx,
+                                 &job->cache,
+                                 job->paths[i],
+                                 &job->cache.syscalls);
+    }
+  }
+  mkfifo_dircache_free(&job->cache);
+}
+
+/**
+ * Create FIFOs one at a time with mkfifo() for @ref MKFIFO_ENGINE_SERIAL,
+ * reporting each failure as it happens.
+ *
+ * This is the default path, where one invocation usually creates a single
+ * FIFO, so it stays off the heap entirely.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     npaths     Number of paths in @p paths.
+ * @param[in]     paths      Paths to new FIFO files to create.
+ */
+static void
+mkfifo_create_serial(struct mkfifo_ctx *const mkfifo_ctx,
+                     const size_t npaths,
+                     char *const paths[]){
+  uint64_t start;
+  size_t i;
+  int err;
+
+  for(i = 0; i < npaths; i++){
+    if(mkfifo_ctx->latency_ns){
+      start = mkfifo_clock_ns();
+      err = mkfifo_path(mkfifo_ctx,
+                        NULL,
+                        paths[i],
+                        &mkfifo_ctx->create_syscalls);
+      mkfifo_ctx->latency_ns[i] = mkfifo_clock_ns() - start;
+    }
+    else{
+      err = mkfifo_path(mkfifo_ctx,
+                        NULL,
+                        paths[i],
+                        &mkfifo_ctx->create_syscalls);
+    }
+    mkfifo_path_report(mkfifo_ctx, paths[i], err);
+  }
+}
+
+/**
+ * Thread entry point for @ref MKFIFO_ENGINE_THREAD.
+ *
+ * @param[in,out] arg See @ref mkfifo_create_job.
+ * @return            NULL
+ */
+static void *
+mkfifo_create_thread(void *const arg){
+  mkfifo_create_range(arg);
+  return NULL;
+}
+
+/**
+ * Create FIFOs with the selected engine and record the result of each.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     npaths     Number of paths in @p paths.
+ * @param[in]     paths      Paths to new FIFO files to create.
+ * @param[out]    errs       0 or errno for each path.
+ * @retval        0          Tried every path.
+ * @retval        -1         Out of memory, with errno set.
+ */
+static int
+mkfifo_create_batch(struct mkfifo_ctx *const mkfifo_ctx,
+                    const size_t npaths,
+                    const char *const paths[],
+                    int errs[]){
+  struct mkfifo_create_job *jobs;
+  size_t njobs;
+  long ncpu;
+  size_t i;
+
+  if(mkfifo_ctx->engine == MKFIFO_ENGINE_SERIAL){
+    for(i = 0; i < npaths; i++){
+      errs[i] = mkfifo_path(mkfifo_ctx,
+                            NULL,
+                            paths[i],
+                            &mkfifo_ctx->create_syscalls);
+    }
+    return 0;
+  }
+  njobs = 1;
+  if(mkfifo_ctx->engine == MKFIFO_ENGINE_THREAD){
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    njobs = npaths / MKFIFO_THREAD_MIN_PATHS + 1;
+    if(ncpu > 0 && njobs > (size_t)ncpu){
+      njobs = (size_t)ncpu;
+    }
+    if(njobs > MKFIFO_THREADS_MAX){
+      njobs = MKFIFO_THREADS_MAX;
+    }
+  }
+  if((jobs = calloc(njobs, sizeof(*jobs))) == NULL){
+    return -1;
+  }
+  for(i = 0; i < njobs; i++){
+    jobs[i].mkfifo_ctx = mkfifo_ctx;
+    jobs[i].paths = paths;
+    jobs[i].errs = errs;
+    jobs[i].first = npaths * i / njobs;
+    jobs[i].last = npaths * (i + 1) / njobs;
+    jobs[i].started = i > 0 &&
+                      pthread_create(&jobs[i].thread,
+                                     NULL,
+                                     mkfifo_create_thread,
+                                     &jobs[i]) == 0;
+  }
+  for(i = 0; i < njobs; i++){
+    if(jobs[i].started){
+      pthread_join(jobs[i].thread, NULL);
+    }
+    else{
+      mkfifo_create_range(&jobs[i]);
+    }
+    mkfifo_ctx->create_syscalls += jobs[i].cache.syscalls;
+    if(mkfifo_ctx->stats){
+      mkfifo_ctx->stats->dir_ns += jobs[i].cache.dir_ns;
+    }
+  }
+  free(jobs);
+  return 0;
+}
+
+/**
+ * Create every FIFO given on the command line with the selected (-e engine)
+ * and report the ones that failed, in command line order.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     npaths     Number of paths in @p paths.
+ * @param[in]     paths      Paths to new FIFO files to create.
+ */
+static void
+mkfifo_create_all(struct mkfifo_ctx *const mkfifo_ctx,
+                  const size_t npaths,
+                  char *const paths[]){
+  size_t i;
+  int *errs;
+
+  if(mkfifo_ctx->engine == MKFIFO_ENGINE_SERIAL){
+    mkfifo_create_serial(mkfifo_ctx, npaths, paths);
+    return;
+  }
+  if((errs = calloc(npaths, sizeof(*errs))) == NULL ||
+     mkfifo_create_batch(mkfifo_ctx,
+                         npaths,
+                         (const char *const *)paths,
+                         errs) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "calloc");
+    free(errs);
+    return;
+  }
+  for(i = 0; i < npaths; i++){
+    mkfifo_path_report(mkfifo_ctx, paths[i], errs[i]);
+  }
+  free(errs);
+}
+
+/**
+ * Next value of a splitmix64 generator, used to fill in (-t) templates.
+ *
+ * @param[in,out] state Generator state.
+ * @return              Pseudo-random value.
+ */
+static uint64_t
+mkfifo_random(uint64_t *const state){
+  uint64_t z;
+
+  *state += 0x9e3779b97f4a7c15u;
+  z = *state;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Count the X characters ending the last component of a (-t) template.
+ *
+ * @param[in] template Template path.
+ * @return             Number of trailing X characters.
+ */
+static size_t
+mkfifo_template_xs(const char *const template){
+  size_t len;
+  size_t n;
+
+  len = strlen(template);
+  for(n = 0; n < len && template[len - n - 1] == 'X'; n++){
+  }
+  return n;
+}
+
+/**
+ * Create a FIFO from each template, replacing its trailing X characters
+ * (-t), and print the name of each FIFO created to STDOUT.
+ *
+ * Replaces mktemp -u followed by mkfifo, which races with other creators
+ * and costs two processes. The X characters get filled in from a generator
+ * seeded once per call, and the FIFO gets created with mkfifoat() relative
+ * to a cached directory descriptor, so neither a lookup of the name nor the
+ * size of the directory adds to the cost. A name that exists already is
+ * drawn again, up to @ref MKFIFO_TEMPLATE_TRIES times. With the minimum of
+ * @ref MKFIFO_TEMPLATE_MIN_X characters there are 62^6 names, so even a
+ * directory holding millions of them rarely costs a retry.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     ntemplates Number of templates in @p templates.
+ * @param[in]     templates  Template paths ending in X characters.
+ * @param[out]    names      Created names to free, or NULL where out of
+ *                           memory.
+ */
+static void
+mkfifo_create_templates(struct mkfifo_ctx *const mkfifo_ctx,
+                        const size_t ntemplates,
+                        char *const templates[],
+                        char *names[]){
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz"
+                                 "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "0123456789";
+  struct mkfifo_dircache cache;
+  uint64_t state;
+  uint64_t bits;
+  uint64_t start;
+  size_t tries;
+  size_t len;
+  size_t nx;
+  size_t i;
+  size_t j;
+  int err;
+
+  memset(&cache, 0, sizeof(cache));
+  start = mkfifo_clock_ns();
+  state = start ^ ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)&cache;
+  for(i = 0; i < ntemplates; i++){
+    if((names[i] = strdup(templates[i])) == NULL){
+      mkfifo_warn(mkfifo_ctx, true, "malloc");
+      continue;
+    }
+    if((nx = mkfifo_template_xs(names[i])) < MKFIFO_TEMPLATE_MIN_X){
+      mkfifo_warn(mkfifo_ctx, false, "invalid template: %s", names[i]);
+      continue;
+    }
+    len = strlen(names[i]);
+    start = mkfifo_clock_ns();
+    for(tries = 1;; tries++){
+      bits = 0;
+      for(j = 0; j < nx; j++){
+        if(j % 10 == 0){
+          bits = mkfifo_random(&state);
+        }
+        names[i][len - nx + j] = alphabet[bits % (sizeof(alphabet) - 1)];
+        bits /= sizeof(alphabet) - 1;
+      }
+      err = mkfifo_path(mkfifo_ctx, &cache, names[i], &cache.syscalls);
+      if(err != EEXIST || tries == MKFIFO_TEMPLATE_TRIES){
+        break;
+      }
+    }
+    if(mkfifo_ctx->latency_ns){
+      mkfifo_ctx->latency_ns[i] = mkfifo_clock_ns() - start;
+    }
+    mkfifo_path_report(mkfifo_ctx, names[i], err);
+    if(err == 0){
+      puts(names[i]);
+    }
+  }
+  fflush(stdout);
+  mkfifo_ctx->create_syscalls += cache.syscalls;
+  if(mkfifo_ctx->stats){
+    mkfifo_ctx->stats->dir_ns += cache.dir_ns;
+  }
+  mkfifo_dircache_free(&cache);
+}
+
+int
+mkfifo_batch(const struct mkfifo_batch_ctx *const batch_ctx,
+             const char *const paths[],
+             const size_t npaths,
+             int results[]){
+  struct mkfifo_ctx mkfifo_ctx;
+  size_t failed;
+  size_t i;
+
+  memset(&mkfifo_ctx, 0, sizeof(mkfifo_ctx));
+  mkfifo_ctx.mode = batch_ctx->mode;
+  mkfifo_ctx.mode_set = batch_ctx->exact_mode;
+  mkfifo_ctx.engine = batch_ctx->engine;
+  if(mkfifo_create_batch(&mkfifo_ctx, npaths, paths, results) != 0){
+    return -1;
+  }
+  failed = 0;
+  for(i = 0; i < npaths; i++){
+    if(results[i] != 0){
+      failed += 1;
+    }
+  }
+  return failed > INT_MAX ? INT_MAX : (int)failed;
+}
+
+/**
+ * Move one FIFO out of a pool directory with renameat2(RENAME_NOREPLACE),
+ * so each pool FIFO goes to exactly one claimer and never replaces
+ * @p path.
+ *
+ * Names starting with '.' are skipped, since the filler is still setting
+ * those up, and so is anything but a FIFO, checked with fstatat() when the
+ * filesystem does not report d_type. A FIFO another claimer took first
+ * fails with ENOENT while the pool entry is gone, and the next one is tried.
+ *
+ * @param[in] dp   Pool directory stream, advanced past the FIFOs tried.
+ * @param[in] path New path of the FIFO.
+ * @retval    0    Claimed a FIFO.
+ * @retval    >0   errno, EAGAIN once the pool has no FIFO left, or ENOSYS
+ *                 without renameat2().
+ */
+static int
+mkfifo_pool_take(DIR *const dp,
+                 const char *const path){
+#ifdef RENAME_NOREPLACE
+  struct dirent *ent;
+  struct stat sb;
+  int err;
+
+  while((ent = readdir(dp))){
+    if(ent->d_name[0] == '.' ||
+       (ent->d_type != DT_FIFO && ent->d_type != DT_UNKNOWN) ||
+       (ent->d_type == DT_UNKNOWN &&
+        (fstatat(dirfd(dp), ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0 ||
+         !S_ISFIFO(sb.st_mode)))){
+      continue;
+    }
+    if(renameat2(dirfd(dp),
+                 ent->d_name,
+                 AT_FDCWD,
+                 path,
+                 RENAME_NOREPLACE) == 0){
+      return 0;
+    }
+    err = errno;
+    if(err != ENOENT ||
+       faccessat(dirfd(dp), ent->d_name, F_OK, AT_SYMLINK_NOFOLLOW) == 0){
+      return err;
+    }
+  }
+  return EAGAIN;
+#else /* !(RENAME_NOREPLACE) */
+  (void)dp;
+  (void)path;
+  return ENOSYS;
+#endif /* RENAME_NOREPLACE */
+}
+
+int
+mkfifo_pool_claim(const char *const pool,
+                  const char *const path){
+  DIR *dp;
+  int err;
+
+  if((dp = opendir(pool)) == NULL){
+    return -1;
+  }
+  err = mkfifo_pool_take(dp, path);
+  closedir(dp);
+  if(err != 0){
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Claim a FIFO from a pool for each path (--claim pool).
+ *
+ * A claimed FIFO keeps the mode and owner it got in the pool, so the claim
+ * costs one rename instead of mkfifo, chmod, and chown. A path gets
+ * created with mkfifo() and (-m mode) instead when the pool is empty, on
+ * another filesystem, or cannot be renamed from without replacing.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     pool       Pool directory kept full by @ref mkfifo_pool.
+ * @param[in]     npaths     Number of paths in @p paths.
+ * @param[in]     paths      New paths of the FIFOs.
+ */
+static void
+mkfifo_pool_claim_all(struct mkfifo_ctx *const mkfifo_ctx,
+                      const char *const pool,
+                      const size_t npaths,
+                      char *const paths[]){
+  uint64_t start;
+  size_t i;
+  DIR *dp;
+  int err;
+
+  if((dp = opendir(pool)) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "%s", pool);
+    return;
+  }
+  for(i = 0; i < npaths; i++){
+    start = mkfifo_ctx->latency_ns ? mkfifo_clock_ns() : 0;
+    err = mkfifo_pool_take(dp, paths[i]);
+    if(err == EAGAIN || err == EXDEV || err == EINVAL || err == ENOSYS){
+      err = mkfifo_path(mkfifo_ctx,
+                        NULL,
+                        paths[i],
+                        &mkfifo_ctx->create_syscalls);
+    }
+    else{
+      mkfifo_ctx->create_syscalls += 1;
+    }
+    if(mkfifo_ctx->latency_ns){
+      mkfifo_ctx->latency_ns[i] = mkfifo_clock_ns() - start;
+    }
+    mkfifo_path_report(mkfifo_ctx, paths[i], err);
+  }
+  closedir(dp);
+}
+
+/**
+ * Count the ready FIFOs of a pool, ignoring names starting with '.'.
+ *
+ * @param[in] pool Pool directory.
+ * @return         Number of ready FIFOs, or -1 with errno set.
+ */
+static long
+mkfifo_pool_count(const char *const pool){
+  struct dirent *ent;
+  long count;
+  DIR *dp;
+
+  if((dp = opendir(pool)) == NULL){
+    return -1;
+  }
+  count = 0;
+  while((ent = readdir(dp))){
+    count += ent->d_name[0] != '.';
+  }
+  closedir(dp);
+  return count;
+}
+
+/**
+ * Check whether the pool directory was removed, which stops the filler.
+ *
+ * @param[in] dir_fd Descriptor of the pool directory.
+ * @retval    true   Removed.
+ * @retval    false  Still linked.
+ */
+static bool
+mkfifo_pool_removed(const int dir_fd){
+  struct stat sb;
+
+  return fstat(dir_fd, &sb) != 0 || sb.st_nlink == 0;
+}
+
+/**
+ * Rename a FIFO set up under a '.fill.' name into view, as fifo.PID.SEQ with
+ * the same suffix, without replacing anything. The sequence restarts with
+ * every filler, so after PID reuse an entry left by an earlier filler can
+ * have that name, and the next sequence number is tried instead.
+ *
+ * @param[in]     dir_fd Descriptor of the pool directory.
+ * @param[in]     fill   Name the FIFO was created under.
+ * @param[in,out] seq    Sequence number making the names unique.
+ * @retval        0      Renamed the FIFO.
+ * @retval        >0     errno.
+ */
+static int
+mkfifo_pool_publish(const int dir_fd,
+                    const char *const fill,
+                    unsigned long long *const seq){
+  char visible[MKFIFO_POOL_NAME_MAX];
+  int err;
+
+  snprintf(visible, sizeof(visible), "fifo%s", &fill[5]);
+  for(;;){
+    err = ENOSYS;
+#ifdef RENAME_NOREPLACE
+    if(renameat2(dir_fd, fill, dir_fd, visible, RENAME_NOREPLACE) == 0){
+      return 0;
+    }
+    err = errno;
+#endif /* RENAME_NOREPLACE */
+    if(err == EINVAL || err == ENOSYS){
+      /* Without renameat2(), linkat() refuses to replace just as well. */
+      if(linkat(dir_fd, fill, dir_fd, visible, 0) == 0){
+        unlinkat(dir_fd, fill, 0);
+        return 0;
+      }
+      err = errno;
+    }
+    if(err != EEXIST){
+      return err;
+    }
+    snprintf(visible, sizeof(visible), "fifo.%ld.%llu", (long)getpid(), *seq);
+    *seq += 1;
+  }
+}
+
+/**
+ * Create FIFOs until the pool holds @p need more.
+ *
+ * Each FIFO gets created in one batch with the selected (-e engine) under
+ * a name starting with '.', and renamed into view once its mode is final,
+ * so a claimer never gets one before (-m mode) applies.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     pool       Pool directory.
+ * @param[in]     dir_fd     Descriptor of @p pool.
+ * @param[in]     need       Number of FIFOs to add.
+ * @param[in,out] seq        Sequence number making the names unique.
+ * @retval        0          Added every FIFO.
+ * @retval        -1         Failed, after a warning unless the pool was
+ *                           removed.
+ */
+static int
+mkfifo_pool_refill(struct mkfifo_ctx *const mkfifo_ctx,
+                   const char *const pool,
+                   const int dir_fd,
+                   const size_t need,
+                   unsigned long long *const seq){
+  char **paths;
+  size_t base;
+  size_t len;
+  size_t i;
+  int *errs;
+  int rc;
+
+  base = strlen(pool) + 1;
+  len = base + MKFIFO_POOL_NAME_MAX;
+  paths = calloc(need, sizeof(*paths));
+  errs = calloc(need, sizeof(*errs));
+  for(i = 0; paths && errs && i < need; i++){
+    if((paths[i] = malloc(len)) == NULL){
+      break;
+    }
+    snprintf(paths[i], len, "%s/.fill.%ld.%llu", pool, (long)getpid(), *seq);
+    *seq += 1;
+  }
+  rc = 0;
+  if(i < need ||
+     mkfifo_create_batch(mkfifo_ctx,
+                         need,
+                         (const char *const *)paths,
+                         errs) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+    rc = -1;
+  }
+  for(i = 0; rc == 0 && i < need; i++){
+    if(errs[i] == 0 &&
+       (errs[i] = mkfifo_pool_publish(dir_fd, &paths[i][base], seq)) != 0){
+      unlinkat(dir_fd, &paths[i][base], 0);
+    }
+    if(errs[i] != 0){
+      rc = -1;
+    }
+  }
+  for(i = 0; rc != 0 && errs && i < need && !mkfifo_pool_removed(dir_fd);
+      i++){
+    if(errs[i] != 0){
+      mkfifo_path_report(mkfifo_ctx, paths[i], errs[i]);
+    }
+  }
+  for(i = 0; paths && i < need; i++){
+    free(paths[i]);
+  }
+  free(paths);
+  free(errs);
+  return rc;
+}
+
+/**
+ * Wait until a FIFO might have left the pool.
+ *
+ * @param[in] watch_fd inotify descriptor watching the pool, or -1 to sleep
+ *                     for a tick instead.
+ */
+static void
+mkfifo_pool_wait(const int watch_fd){
+#ifdef __linux__
+  char buf[4096];
+
+  if(watch_fd >= 0){
+    while(read(watch_fd, buf, sizeof(buf)) < 0 && errno == EINTR){
+    }
+    return;
+  }
+#else /* !(__linux__) */
+  (void)watch_fd;
+#endif /* __linux__ */
+  poll(NULL, 0, 100);
+}
+
+/**
+ * Keep a pool directory filled with ready FIFOs for
+ * @ref mkfifo_pool_claim and --claim (--pool dir --pool-size n).
+ *
+ * Takes creating, chmod(), and chown() off the request path: the filler
+ * runs as the owner the FIFOs should have, and a claim is a single rename
+ * out of the pool. Whenever the pool holds fewer than @p size FIFOs, the
+ * missing ones get created in one batch, see @ref mkfifo_pool_refill. On
+ * Linux inotify wakes the filler when FIFOs are claimed, elsewhere it
+ * checks every 100 ms. Leftovers of a filler that was killed while
+ * creating get removed on start, so only one filler should serve a pool.
+ *
+ * Runs until the pool directory is removed, which exits with EXIT_SUCCESS,
+ * or creating a FIFO fails.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     pool       Pool directory.
+ * @param[in]     size_str   Number of FIFOs to keep ready.
+ */
+static void
+mkfifo_pool(struct mkfifo_ctx *const mkfifo_ctx,
+            const char *const pool,
+            const char *const size_str){
+  unsigned long long seq;
+  struct dirent *ent;
+  unsigned long size;
+  char *end;
+  long count;
+  DIR *dp;
+  int watch_fd;
+  int dir_fd;
+  int fd;
+
+  errno = 0;
+  size = strtoul(size_str, &end, 10);
+  if(errno != 0 || *end != '\0' || size == 0 || size > INT_MAX){
+    mkfifo_warn(mkfifo_ctx, false, "invalid pool size: %s", size_str);
+    return;
+  }
+  if((dir_fd = open(pool, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "%s", pool);
+    return;
+  }
+  watch_fd = -1;
+#ifdef __linux__
+  if((watch_fd = inotify_init1(IN_CLOEXEC)) >= 0 &&
+     inotify_add_watch(watch_fd,
+                       pool,
+                       IN_MOVED_FROM | IN_DELETE |
+                       IN_DELETE_SELF | IN_MOVE_SELF) < 0){
+    close(watch_fd);
+    watch_fd = -1;
+  }
+#endif /* __linux__ */
+  if((fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0)) >= 0 && (dp = fdopendir(fd))){
+    while((ent = readdir(dp))){
+      if(strncmp(ent->d_name, ".fill.", 6) == 0){
+        unlinkat(dir_fd, ent->d_name, 0);
+      }
+    }
+    closedir(dp);
+  }
+  else if(fd >= 0){
+    close(fd);
+  }
+  seq = 0;
+  while(!mkfifo_pool_removed(dir_fd)){
+    if((count = mkfifo_pool_count(pool)) < 0){
+      if(!mkfifo_pool_removed(dir_fd)){
+        mkfifo_warn(mkfifo_ctx, true, "%s", pool);
+      }
+      break;
+    }
+    if((unsigned long)count < size &&
+       mkfifo_pool_refill(mkfifo_ctx,
+                          pool,
+                          dir_fd,
+                          size - (unsigned long)count,
+                          &seq) != 0){
+      break;
+    }
+    if((unsigned long)count >= size){
+      mkfifo_pool_wait(watch_fd);
+    }
+  }
+  if(watch_fd >= 0){
+    close(watch_fd);
+  }
+  close(dir_fd);
+}
+
+#ifdef __linux__
+/**
+ * Open waiting in a @ref mkfifo_opener for the other side of its FIFO.
+ */
+struct mkfifo_open_pending{
+  /**
+   * Copy of the FIFO path.
+   */
+  char *path;
+
+  /**
+   * Flags passed to open(), including O_NONBLOCK.
+   */
+  int flags;
+
+  /**
+   * inotify watch on @ref path.
+   */
+  int wd;
+
+  /**
+   * Called once when the open completes or fails.
+   */
+  mkfifo_open_cb cb;
+
+  /**
+   * Passed to @ref cb.
+   */
+  void *arg;
+};
+
+/**
+ * Pending FIFO opens driven by inotify and a retry timer behind one epoll
+ * descriptor.
+ */
+struct mkfifo_opener{
+  /**
+   * epoll descriptor over @ref inotify_fd and @ref timer_fd.
+   */
+  int fd;
+
+  /**
+   * inotify descriptor, readable when a watched FIFO was opened or removed.
+   */
+  int inotify_fd;
+
+  /**
+   * timerfd, armed every @ref MKFIFO_OPENER_RETRY_MS while opens are
+   * pending. A reader blocked in open() only shows up in inotify once a
+   * writer let it complete, so the writers also get retried on this.
+   */
+  int timer_fd;
+
+  /**
+   * Pending opens, in no particular order.
+   */
+  struct mkfifo_open_pending *pending;
+
+  /**
+   * Number of entries in @ref pending.
+   */
+  size_t n;
+
+  /**
+   * Allocated entries in @ref pending.
+   */
+  size_t cap;
+};
+
+struct mkfifo_opener *
+mkfifo_opener_create(void){
+  struct mkfifo_opener *opener;
+  struct epoll_event ev;
+  int errno_save;
+
+  if((opener = calloc(1, sizeof(*opener))) == NULL){
+    return NULL;
+  }
+  opener->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  opener->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC);
+  opener->fd = epoll_create1(EPOLL_CLOEXEC);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  if(opener->inotify_fd < 0 ||
+     opener->timer_fd < 0 ||
+     opener->fd < 0 ||
+     epoll_ctl(opener->fd, EPOLL_CTL_ADD, opener->inotify_fd, &ev) != 0 ||
+     epoll_ctl(opener->fd, EPOLL_CTL_ADD, opener->timer_fd, &ev) != 0){
+    errno_save = errno;
+    if(opener->fd >= 0){
+      close(opener->fd);
+    }
+    if(opener->timer_fd >= 0){
+      close(opener->timer_fd);
+    }
+    if(opener->inotify_fd >= 0){
+      close(opener->inotify_fd);
+    }
+    free(opener);
+    errno = errno_save;
+    return NULL;
+  }
+  return opener;
+}
+
+int
+mkfifo_opener_fd(const struct mkfifo_opener *const opener){
+  return opener->fd;
+}
+
+/**
+ * Drop an inotify watch unless a pending open still uses it.
+ *
+ * @param[in,out] opener See @ref mkfifo_opener.
+ * @param[in]     wd     Watch to drop.
+ */
+static void
+mkfifo_opener_unwatch(struct mkfifo_opener *const opener,
+                      const int wd){
+  int errno_save;
+  size_t i;
+
+  for(i = 0; i < opener->n && opener->pending[i].wd != wd; i++){
+  }
+  if(i == opener->n){
+    errno_save = errno;
+    inotify_rm_watch(opener->inotify_fd, wd);
+    errno = errno_save;
+  }
+}
+
+/**
+ * Start or stop the retry timer of an opener.
+ *
+ * @param[in] opener See @ref mkfifo_opener.
+ * @param[in] on     Arm the timer if true, disarm it if false.
+ */
+static void
+mkfifo_opener_timer(const struct mkfifo_opener *const opener,
+                    const bool on){
+  struct itimerspec its;
+  int errno_save;
+
+  memset(&its, 0, sizeof(its));
+  if(on){
+    its.it_value.tv_nsec = MKFIFO_OPENER_RETRY_MS * 1000000L;
+    its.it_interval = its.it_value;
+  }
+  errno_save = errno;
+  timerfd_settime(opener->timer_fd, 0, &its, NULL);
+  errno = errno_save;
+}
+
+/**
+ * Remove a pending open, dropping its watch when no other open shares it,
+ * and call its callback.
+ *
+ * @param[in,out] opener See @ref mkfifo_opener.
+ * @param[in]     i      Index into mkfifo_opener::pending.
+ * @param[in]     fd     Opened descriptor, or -1.
+ * @param[in]     err    0, or errno describing the failure.
+ */
+static void
+mkfifo_opener_complete(struct mkfifo_opener *const opener,
+                       const size_t i,
+                       const int fd,
+                       const int err){
+  struct mkfifo_open_pending done;
+
+  done = opener->pending[i];
+  opener->pending[i] = opener->pending[--opener->n];
+  mkfifo_opener_unwatch(opener, done.wd);
+  if(opener->n == 0){
+    mkfifo_opener_timer(opener, false);
+  }
+  free(done.path);
+  done.cb(done.arg, fd, err);
+}
+
+int
+mkfifo_opener_open(struct mkfifo_opener *const opener,
+                   const char *const path,
+                   const int flags,
+                   const mkfifo_open_cb cb,
+                   void *const arg){
+  struct mkfifo_open_pending *pending;
+  size_t cap;
+  int wd;
+  int fd;
+
+  if(opener->n == opener->cap){
+    cap = opener->cap ? opener->cap * 2 : 16;
+    if((pending = realloc(opener->pending, cap * sizeof(*pending))) == NULL){
+      return -1;
+    }
+    opener->pending = pending;
+    opener->cap = cap;
+  }
+  /* Watch before trying, so a reader arriving in between is not missed. */
+  if((wd = inotify_add_watch(opener->inotify_fd,
+                             path,
+                             IN_OPEN | IN_DELETE_SELF)) < 0){
+    return -1;
+  }
+  if((fd = open(path, flags | O_NONBLOCK | O_CLOEXEC)) >= 0 ||
+     errno != ENXIO){
+    mkfifo_opener_unwatch(opener, wd);
+    return fd;
+  }
+  pending = &opener->pending[opener->n];
+  if((pending->path = strdup(path)) == NULL){
+    mkfifo_opener_unwatch(opener, wd);
+    return -1;
+  }
+  pending->flags = flags | O_NONBLOCK | O_CLOEXEC;
+  pending->wd = wd;
+  pending->cb = cb;
+  pending->arg = arg;
+  if(opener->n == 0){
+    mkfifo_opener_timer(opener, true);
+  }
+  opener->n += 1;
+  errno = EINPROGRESS;
+  return -1;
+}
+
+/**
+ * Retry the pending opens on one watch, or on every watch.
+ *
+ * @param[in,out] opener See @ref mkfifo_opener.
+ * @param[in]     wd     Watch whose FIFO was opened, or -1 for all.
+ * @param[in]     gone   The FIFO was removed, so fail instead of retrying.
+ * @return               Number of opens completed.
+ */
+static int
+mkfifo_opener_retry(struct mkfifo_opener *const opener,
+                    const int wd,
+                    const bool gone){
+  struct mkfifo_open_pending *pending;
+  int completed;
+  size_t i;
+  int fd;
+
+  completed = 0;
+  i = 0;
+  while(i < opener->n){
+    pending = &opener->pending[i];
+    if(wd != -1 && pending->wd != wd){
+      i += 1;
+    }
+    else if(gone){
+      mkfifo_opener_complete(opener, i, -1, ENOENT);
+      completed += 1;
+    }
+    else if((fd = open(pending->path, pending->flags)) >= 0){
+      mkfifo_opener_complete(opener, i, fd, 0);
+      completed += 1;
+    }
+    else if(errno != ENXIO){
+      mkfifo_opener_complete(opener, i, -1, errno);
+      completed += 1;
+    }
+    else{
+      i += 1;
+    }
+  }
+  return completed;
+}
+
+int
+mkfifo_opener_dispatch(struct mkfifo_opener *const opener){
+  union{
+    struct inotify_event event;
+    char buf[4096];
+  } events;
+  const struct inotify_event *event;
+  uint64_t ticks;
+  ssize_t nread;
+  ssize_t off;
+  int completed;
+
+  completed = 0;
+  while((nread = read(opener->inotify_fd,
+                      events.buf,
+                      sizeof(events.buf))) > 0){
+    for(off = 0; off < nread; off += (ssize_t)sizeof(*event) + event->len){
+      event = (const struct inotify_event *)&events.buf[off];
+      if(event->mask & IN_Q_OVERFLOW){
+        completed += mkfifo_opener_retry(opener, -1, false);
+      }
+      else if(event->mask & (IN_DELETE_SELF | IN_IGNORED)){
+        completed += mkfifo_opener_retry(opener, event->wd, true);
+      }
+      else if(event->mask & IN_OPEN){
+        completed += mkfifo_opener_retry(opener, event->wd, false);
+      }
+    }
+  }
+  if(nread < 0 && errno != EAGAIN){
+    return -1;
+  }
+  if(read(opener->timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks)){
+    completed += mkfifo_opener_retry(opener, -1, false);
+  }
+  return completed;
+}
+
+void
+mkfifo_opener_destroy(struct mkfifo_opener *const opener){
+  while(opener->n > 0){
+    mkfifo_opener_complete(opener, opener->n - 1, -1, ECANCELED);
+  }
+  close(opener->fd);
+  close(opener->timer_fd);
+  close(opener->inotify_fd);
+  free(opener->pending);
+  free(opener);
+}
+#endif /* __linux__ */
+
+/**
+ * Parse the creation engine given in the (-e engine) argument.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     engine_str One of serial, dirfd, or thread.
+ */
+static void
+mkfifo_parse_engine(struct mkfifo_ctx *const mkfifo_ctx,
+                    const char *const engine_str){
+  if(strcmp(engine_str, "serial") == 0){
+    mkfifo_ctx->engine = MKFIFO_ENGINE_SERIAL;
+  }
+  else if(strcmp(engine_str, "dirfd") == 0){
+    mkfifo_ctx->engine = MKFIFO_ENGINE_DIRFD;
+  }
+  else if(strcmp(engine_str, "thread") == 0){
+    mkfifo_ctx->engine = MKFIFO_ENGINE_THREAD;
+  }
+  else{
+    mkfifo_warn(mkfifo_ctx, false, "invalid engine: %s", engine_str);
+  }
+}
+
+/**
+ * Write an entire buffer, retrying on partial writes and interrupts.
+ *
+ * @param[in]     fd    File descriptor to write to.
+ * @param[in]     buf   Data to write.
+ * @param[in]     len   Number of bytes in @p buf.
+ * @param[in,out] stats Incremented for each write() call.
+ * @retval        0     Wrote all of @p buf.
+ * @retval        -1    Write failed with errno set.
+ */
+static int
+mkfifo_write_all(const int fd,
+                 const char *buf,
+                 size_t len,
+                 struct mkfifo_pump_stats *const stats){
+  ssize_t rc;
+
+  while(len > 0){
+    stats->syscalls += 1;
+    rc = write(fd, buf, len);
+    if(rc < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return -1;
+    }
+    buf += rc;
+    len -= (size_t)rc;
+    stats->bytes += (uint64_t)rc;
+  }
+  return 0;
+}
+
+/**
+ * Copy data from @p in_fd to @p out_fd through a user space buffer.
+ *
+ * @param[in]     in_fd  Input file descriptor.
+ * @param[in]     out_fd FIFO file descriptor.
+ * @param[in,out] stats  See @ref mkfifo_pump_stats.
+ * @retval        0      Copied until end-of-file.
+ * @retval        -1     Read or write failed with errno set.
+ */
+static int
+mkfifo_pump_rw(const int in_fd,
+               const int out_fd,
+               struct mkfifo_pump_stats *const stats){
+  char buf[MKFIFO_PUMP_CHUNK];
+  ssize_t nread;
+
+  while(1){
+    stats->syscalls += 1;
+    nread = read(in_fd, buf, sizeof(buf));
+    if(nread < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return -1;
+    }
+    if(nread == 0){
+      stats->method = "read/write";
+      return 0;
+    }
+    if(mkfifo_write_all(out_fd, buf, (size_t)nread, stats) < 0){
+      return -1;
+    }
+  }
+}
+
+/**
+ * Move data from @p in_fd to @p out_fd with splice(), avoiding the copy
+ * through user space.
+ *
+ * @param[in]     in_fd  Input file descriptor.
+ * @param[in]     out_fd FIFO file descriptor.
+ * @param[in,out] stats  See @ref mkfifo_pump_stats.
+ * @retval        0      Moved until end-of-file.
+ * @retval        1      Splice not supported on the first call, nothing moved.
+ * @retval        -1     Splice failed with errno set.
+ */
+static int
+mkfifo_pump_splice(const int in_fd,
+                   const int out_fd,
+                   struct mkfifo_pump_stats *const stats){
+#ifdef __linux__
+  ssize_t nmoved;
+
+  while(1){
+    stats->syscalls += 1;
+    nmoved = splice(in_fd,
+                    NULL,
+                    out_fd,
+                    NULL,
+                    MKFIFO_PUMP_CHUNK,
+                    SPLICE_F_MOVE | SPLICE_F_MORE);
+    if(nmoved < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      if(!stats->spliced && (errno == EINVAL || errno == ENOSYS)){
+        stats->syscalls -= 1;
+        return 1;
+      }
+      return -1;
+    }
+    if(nmoved == 0){
+      stats->method = "splice";
+      return 0;
+    }
+    stats->spliced = true;
+    stats->bytes += (uint64_t)nmoved;
+  }
+#else /* !(__linux__) */
+  (void)in_fd;
+  (void)out_fd;
+  (void)stats;
+  return 1;
+#endif /* __linux__ */
+}
+
+/**
+ * Map the input file in windows and gift its pages to the FIFO with
+ * vmsplice(), avoiding both the read copy and the write copy.
+ *
+ * Windows start on a page boundary, so an input that is not read from the
+ * start gets mapped from the page containing its current offset. The
+ * pages stay referenced by the pipe until the reader consumes them, so the
+ * input file must not be modified during the transfer.
+ *
+ * @param[in]     in_fd  Input file descriptor.
+ * @param[in]     out_fd FIFO file descriptor.
+ * @param[in,out] stats  See @ref mkfifo_pump_stats.
+ * @retval        0      Moved until end-of-file.
+ * @retval        1      Input is not a regular file, or vmsplice() is not
+ *                       supported.
+ * @retval        -1     Mapping or vmsplice failed with errno set.
+ */
+static int
+mkfifo_pump_vmsplice(const int in_fd,
+                     const int out_fd,
+                     struct mkfifo_pump_stats *const stats){
+#ifdef __linux__
+  struct iovec iov;
+  struct stat sb;
+  void *map;
+  off_t page_size;
+  off_t offset;
+  off_t map_off;
+  size_t map_len;
+  ssize_t nmoved;
+
+  if(fstat(in_fd, &sb) != 0 || !S_ISREG(sb.st_mode)){
+    return 1;
+  }
+  page_size = (off_t)sysconf(_SC_PAGESIZE);
+  if((offset = lseek(in_fd, 0, SEEK_CUR)) < 0){
+    return -1;
+  }
+  while(offset < sb.st_size){
+    map_off = offset - offset % page_size;
+    map_len = (size_t)(sb.st_size - map_off);
+    if(map_len > MKFIFO_VMSPLICE_WINDOW){
+      map_len = MKFIFO_VMSPLICE_WINDOW;
+    }
+    stats->syscalls += 1;
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, in_fd, map_off);
+    if(map == MAP_FAILED){
+      return -1;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+    iov.iov_base = (char *)map + (offset - map_off);
+    iov.iov_len = map_len - (size_t)(offset - map_off);
+    while(iov.iov_len > 0){
+      stats->syscalls += 1;
+      nmoved = vmsplice(out_fd, &iov, 1, SPLICE_F_GIFT);
+      if(nmoved < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        munmap(map, map_len);
+        if(stats->bytes == 0 && (errno == EINVAL || errno == ENOSYS)){
+          return 1;
+        }
+        return -1;
+      }
+      iov.iov_base = (char *)iov.iov_base + nmoved;
+      iov.iov_len -= (size_t)nmoved;
+      offset += nmoved;
+      stats->bytes += (uint64_t)nmoved;
+    }
+    stats->syscalls += 1;
+    munmap(map, map_len);
+  }
+  lseek(in_fd, offset, SEEK_SET);
+  stats->method = "vmsplice";
+  return 0;
+#else /* !(__linux__) */
+  (void)in_fd;
+  (void)out_fd;
+  (void)stats;
+  return 1;
+#endif /* __linux__ */
+}
+
+/**
+ * Get a monotonic timestamp in seconds.
+ *
+ * @return Seconds since an unspecified starting point.
+ */
+static double
+mkfifo_now(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Print the transfer rate and system call cost of a pump run to STDERR.
+ *
+ * @param[in] path    FIFO that received the data.
+ * @param[in] stats   See @ref mkfifo_pump_stats.
+ * @param[in] elapsed Wall clock seconds spent in the transfer.
+ */
+static void
+mkfifo_pump_report(const char *const path,
+                   const struct mkfifo_pump_stats *const stats,
+                   const double elapsed){
+  double mib;
+
+  mib = (double)stats->bytes / (1024.0 * 1024.0);
+  fprintf(stderr,
+          "%s: %s: %llu bytes, %.0f bytes/s, %.1f syscalls/MiB (%s)\n",
+          MKFIFO_PROGNAME,
+          path,
+          (unsigned long long)stats->bytes,
+          elapsed > 0 ? (double)stats->bytes / elapsed : 0.0,
+          mib > 0 ? (double)stats->syscalls / mib : 0.0,
+          stats->method);
+}
+
+/**
+ * Get the payload length from a length-delimited record header.
+ *
+ * @param[in] hdr @ref MKFIFO_FRAME_HDR bytes in network byte order.
+ * @return        Payload length.
+ */
+static size_t
+mkfifo_frame_len(const unsigned char *const hdr){
+  return (size_t)hdr[0] << 24 |
+         (size_t)hdr[1] << 16 |
+         (size_t)hdr[2] << 8 |
+         (size_t)hdr[3];
+}
+
+/**
+ * Make room to read another @ref MKFIFO_PUMP_CHUNK into a record input,
+ * plus one spare byte for terminating a final line.
+ *
+ * @param[in,out] in See @ref mkfifo_record_in.
+ * @retval        0  Buffer has enough room.
+ * @retval        -1 Failed to grow the buffer.
+ */
+static int
+mkfifo_record_reserve(struct mkfifo_record_in *const in){
+  size_t cap;
+  char *buf;
+
+  if(in->cap - in->len < MKFIFO_PUMP_CHUNK + 1){
+    cap = in->cap * 2 + MKFIFO_PUMP_CHUNK + 1;
+    if((buf = realloc(in->buf, cap)) == NULL){
+      return -1;
+    }
+    in->buf = buf;
+    in->cap = cap;
+  }
+  return 0;
+}
+
+/**
+ * Find the length of the complete record at @p off in a record input.
+ *
+ * @param[in]     format See @ref mkfifo_record_format.
+ * @param[in,out] in     See @ref mkfifo_record_in.
+ * @param[in]     off    Offset of the record in the input buffer.
+ * @param[out]    reclen Record length including its newline or header.
+ * @retval        1      Found a complete record.
+ * @retval        0      Record not complete yet.
+ * @retval        -1     Record exceeds @ref MKFIFO_RECORD_MAX.
+ */
+static int
+mkfifo_record_next(const enum mkfifo_record_format format,
+                   struct mkfifo_record_in *const in,
+                   const size_t off,
+                   size_t *const reclen){
+  const char *nl;
+
+  if(in->scan < off){
+    in->scan = off;
+  }
+  if(format == MKFIFO_RECORD_LENGTH){
+    if(in->len - off < MKFIFO_FRAME_HDR){
+      *reclen = 0;
+    }
+    else{
+      *reclen = MKFIFO_FRAME_HDR +
+                mkfifo_frame_len((const unsigned char *)&in->buf[off]);
+      if(*reclen > MKFIFO_RECORD_MAX){
+        return -1;
+      }
+      if(in->len - off < *reclen){
+        *reclen = 0;
+      }
+    }
+  }
+  else{
+    nl = memchr(&in->buf[in->scan], '\n', in->len - in->scan);
+    if(nl == NULL){
+      in->scan = in->len;
+      *reclen = 0;
+    }
+    else{
+      *reclen = (size_t)(nl - &in->buf[off]) + 1;
+    }
+  }
+  if(*reclen == 0){
+    return in->len - off > MKFIFO_RECORD_MAX ? -1 : 0;
+  }
+  in->records += 1;
+  return 1;
+}
+
+/**
+ * Discard the records before @p off from a record input.
+ *
+ * @param[in,out] in  See @ref mkfifo_record_in.
+ * @param[in]     off Number of bytes to discard.
+ */
+static void
+mkfifo_record_consume(struct mkfifo_record_in *const in,
+                      const size_t off){
+  memmove(in->buf, &in->buf[off], in->len - off);
+  in->len -= off;
+  in->scan = in->scan > off ? in->scan - off : 0;
+}
+
+/**
+ * Write the batch of small records with a single atomic write().
+ *
+ * The shared lock keeps the write from landing in the middle of a large
+ * record that another writer is sending under the exclusive lock.
+ *
+ * @param[in,out] out   See @ref mkfifo_record_out.
+ * @param[in,out] stats See @ref mkfifo_pump_stats.
+ * @retval        0     Batch written.
+ * @retval        -1    Lock or write failed with errno set.
+ */
+static int
+mkfifo_record_flush(struct mkfifo_record_out *const out,
+                    struct mkfifo_pump_stats *const stats){
+  int rc;
+
+  rc = 0;
+  if(out->len > 0){
+    stats->syscalls += 2;
+    if(flock(out->fd, LOCK_SH) != 0){
+      return -1;
+    }
+    rc = mkfifo_write_all(out->fd, out->batch, out->len, stats);
+    flock(out->fd, LOCK_UN);
+    out->len = 0;
+  }
+  return rc;
+}
+
+/**
+ * Write one whole record into a FIFO shared with other writers.
+ *
+ * Records up to PIPE_BUF bytes get batched into atomic writes. Larger
+ * records take more than one write(), so they get written while holding an
+ * exclusive flock() on the FIFO to keep other writers out.
+ *
+ * @param[in,out] out   See @ref mkfifo_record_out.
+ * @param[in]     rec   Record including its newline or header.
+ * @param[in]     len   Number of bytes in @p rec.
+ * @param[in,out] stats See @ref mkfifo_pump_stats.
+ * @retval        0     Record written or batched.
+ * @retval        -1    Lock or write failed with errno set.
+ */
+static int
+mkfifo_record_write(struct mkfifo_record_out *const out,
+                    const char *const rec,
+                    const size_t len,
+                    struct mkfifo_pump_stats *const stats){
+  int rc;
+
+  if(len > PIPE_BUF){
+    if(mkfifo_record_flush(out, stats) < 0){
+      return -1;
+    }
+    stats->syscalls += 2;
+    if(flock(out->fd, LOCK_EX) != 0){
+      return -1;
+    }
+    rc = mkfifo_write_all(out->fd, rec, len, stats);
+    flock(out->fd, LOCK_UN);
+    return rc;
+  }
+  if(out->len + len > PIPE_BUF && mkfifo_record_flush(out, stats) < 0){
+    return -1;
+  }
+  memcpy(&out->batch[out->len], rec, len);
+  out->len += len;
+  return 0;
+}
+
+/**
+ * Split the input into records and write each one whole into a FIFO that
+ * other writers may share.
+ *
+ * @param[in]     format See @ref mkfifo_record_format.
+ * @param[in]     in_fd  Input file descriptor.
+ * @param[in]     out_fd FIFO file descriptor.
+ * @param[in,out] stats  See @ref mkfifo_pump_stats.
+ * @retval        0      Copied until end-of-file.
+ * @retval        -1     Failed with errno set.
+ */
+static int
+mkfifo_pump_records(const enum mkfifo_record_format format,
+                    const int in_fd,
+                    const int out_fd,
+                    struct mkfifo_pump_stats *const stats){
+  struct mkfifo_record_out out;
+  struct mkfifo_record_in in;
+  ssize_t nread;
+  size_t reclen;
+  size_t off;
+  int rc;
+
+  memset(&in, 0, sizeof(in));
+  out.fd = out_fd;
+  out.len = 0;
+  rc = 0;
+  while(rc == 0){
+    if(mkfifo_record_reserve(&in) < 0){
+      rc = -1;
+      break;
+    }
+    stats->syscalls += 1;
+    nread = read(in_fd, &in.buf[in.len], MKFIFO_PUMP_CHUNK);
+    if(nread < 0){
+      if(errno != EINTR){
+        rc = -1;
+      }
+      continue;
+    }
+    if(nread == 0){
+      break;
+    }
+    in.len += (size_t)nread;
+    off = 0;
+    while((rc = mkfifo_record_next(format, &in, off, &reclen)) == 1){
+      if(mkfifo_record_write(&out, &in.buf[off], reclen, stats) < 0){
+        break;
+      }
+      off += reclen;
+    }
+    if(rc == 1){
+      rc = -1;
+    }
+    else if(rc < 0){
+      errno = EMSGSIZE;
+    }
+    else{
+      mkfifo_record_consume(&in, off);
+      rc = mkfifo_record_flush(&out, stats);
+    }
+  }
+  if(rc == 0 && in.len > 0){
+    if(format == MKFIFO_RECORD_LENGTH){
+      errno = EMSGSIZE;
+      rc = -1;
+    }
+    else{
+      in.buf[in.len++] = '\n';
+      rc = mkfifo_record_write(&out, in.buf, in.len, stats);
+      if(rc == 0){
+        rc = mkfifo_record_flush(&out, stats);
+      }
+    }
+  }
+  free(in.buf);
+  stats->method = "records";
+  return rc;
+}
+
+/**
+ * Copy raw input into a FIFO with the selected transfer method.
+ *
+ * @param[in]     backend See @ref mkfifo_pump_backend.
+ * @param[in]     in_fd   Input file descriptor.
+ * @param[in]     out_fd  FIFO file descriptor.
+ * @param[in,out] stats   See @ref mkfifo_pump_stats.
+ * @retval        0       Copied until end-of-file.
+ * @retval        1       Backend not supported for the input.
+ * @retval        -1      Transfer failed with errno set.
+ */
+static int
+mkfifo_pump_transfer(const enum mkfifo_pump_backend backend,
+                     const int in_fd,
+                     const int out_fd,
+                     struct mkfifo_pump_stats *const stats){
+  int rc;
+
+  switch(backend){
+    case MKFIFO_BACKEND_RW:
+      rc = mkfifo_pump_rw(in_fd, out_fd, stats);
+      break;
+    case MKFIFO_BACKEND_SPLICE:
+      rc = mkfifo_pump_splice(in_fd, out_fd, stats);
+      break;
+    case MKFIFO_BACKEND_VMSPLICE:
+      rc = mkfifo_pump_vmsplice(in_fd, out_fd, stats);
+      break;
+    default:
+      rc = mkfifo_pump_splice(in_fd, out_fd, stats);
+      if(rc == 1){
+        rc = mkfifo_pump_rw(in_fd, out_fd, stats);
+      }
+      break;
+  }
+  return rc;
+}
+
+/**
+ * Open the (-p input) file, or use STDIN for "-".
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @retval        >=0        Input file descriptor.
+ * @retval        -1         Failed to open the input file.
+ */
+static int
+mkfifo_open_input(struct mkfifo_ctx *const mkfifo_ctx){
+  int in_fd;
+
+  if(strcmp(mkfifo_ctx->pump_input, "-") == 0){
+    in_fd = STDIN_FILENO;
+  }
+  else if((in_fd = open(mkfifo_ctx->pump_input, O_RDONLY | O_CLOEXEC)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "open: %s", mkfifo_ctx->pump_input);
+  }
+  return in_fd;
+}
+
+/**
+ * Open a FIFO for writing and pump the (-p input) data into it.
+ *
+ * By default uses splice() when the kernel supports it for the given input
+ * and falls back to read/write otherwise. The (-b backend) argument selects
+ * one transfer method instead. With (-r format), the input gets split into
+ * records that are written whole, so several pumps can share the FIFO.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     path       FIFO created by @ref mkfifo_path.
+ */
+static void
+mkfifo_pump(struct mkfifo_ctx *const mkfifo_ctx,
+            const char *const path){
+  struct mkfifo_pump_stats stats;
+  double start;
+  int in_fd;
+  int out_fd;
+  int rc;
+
+  memset(&stats, 0, sizeof(stats));
+  if((in_fd = mkfifo_open_input(mkfifo_ctx)) < 0){
+    return;
+  }
+  if((out_fd = open(path, O_WRONLY | O_CLOEXEC)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "open: %s", path);
+  }
+  else{
+    start = mkfifo_now();
+    if(mkfifo_ctx->record_format != MKFIFO_RECORD_NONE){
+      rc = mkfifo_pump_records(mkfifo_ctx->record_format,
+                               in_fd,
+                               out_fd,
+                               &stats);
+    }
+    else{
+      rc = mkfifo_pump_transfer(mkfifo_ctx->pump_backend,
+                                in_fd,
+                                out_fd,
+                                &stats);
+    }
+    if(rc == 1){
+      mkfifo_warn(mkfifo_ctx,
+                  false,
+                  "pump: %s: backend not supported for input",
+                  path);
+    }
+    else if(rc < 0){
+      mkfifo_warn(mkfifo_ctx, true, "pump: %s", path);
+    }
+    else{
+      mkfifo_pump_report(path, &stats, mkfifo_now() - start);
+    }
+    close(out_fd);
+  }
+  if(in_fd != STDIN_FILENO){
+    close(in_fd);
+  }
+}
+
+/**
+ * Stop feeding a fan-out output.
+ *
+ * @param[in,out] out See @ref mkfifo_fanout_out.
+ */
+static void
+mkfifo_fanout_disconnect(struct mkfifo_fanout_out *const out){
+  if(out->fd >= 0){
+    close(out->fd);
+    out->fd = -1;
+  }
+}
+
+/**
+ * Apply the slow consumer policy to data that an output could not accept.
+ *
+ * @param[in]     mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] out        See @ref mkfifo_fanout_out.
+ * @param[in]     len        Number of bytes the output did not accept.
+ */
+static void
+mkfifo_fanout_refuse(const struct mkfifo_ctx *const mkfifo_ctx,
+                     struct mkfifo_fanout_out *const out,
+                     const size_t len){
+  if(mkfifo_ctx->slow_policy == MKFIFO_SLOW_DROP){
+    out->dropped += len;
+  }
+  else{
+    mkfifo_fanout_disconnect(out);
+  }
+}
+
+/**
+ * Count the outputs that have not been disconnected.
+ *
+ * @param[in] outs  Output FIFOs.
+ * @param[in] nouts Number of entries in @p outs.
+ * @return          Number of connected outputs.
+ */
+static size_t
+mkfifo_fanout_active(const struct mkfifo_fanout_out *const outs,
+                     const size_t nouts){
+  size_t active;
+  size_t i;
+
+  active = 0;
+  for(i = 0; i < nouts; i++){
+    if(outs[i].fd >= 0){
+      active += 1;
+    }
+  }
+  return active;
+}
+
+/**
+ * Find the fastest consumer, which is the connected output with the least
+ * amount of unread data in its FIFO.
+ *
+ * With the drop and disconnect policies, the pump waits for this output so
+ * the transfer runs at the pace of the fastest consumer instead of dropping
+ * data for everyone when the input is faster than all of them.
+ *
+ * @param[in] outs  Output FIFOs.
+ * @param[in] nouts Number of entries in @p outs.
+ * @return          Index of the fastest output, or @p nouts if none left.
+ */
+static size_t
+mkfifo_fanout_leader(const struct mkfifo_fanout_out *const outs,
+                     const size_t nouts){
+  size_t leader;
+  size_t i;
+  int queued;
+  int least;
+
+  leader = nouts;
+  least = 0;
+  for(i = 0; i < nouts; i++){
+    if(outs[i].fd < 0){
+      continue;
+    }
+    if(ioctl(outs[i].fd, FIONREAD, &queued) != 0){
+      queued = 0;
+    }
+    if(leader == nouts || queued < least){
+      leader = i;
+      least = queued;
+    }
+  }
+  return leader;
+}
+
+/**
+ * Write a chunk to one output without waiting for the consumer.
+ *
+ * @param[in]     mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] out        See @ref mkfifo_fanout_out.
+ * @param[in]     buf        Data to write.
+ * @param[in]     len        Number of bytes in @p buf.
+ */
+static void
+mkfifo_fanout_write_nowait(const struct mkfifo_ctx *const mkfifo_ctx,
+                           struct mkfifo_fanout_out *const out,
+                           const char *const buf,
+                           const size_t len){
+  ssize_t nwritten;
+
+  do{
+    nwritten = write(out->fd, buf, len);
+  } while(nwritten < 0 && errno == EINTR);
+  if(nwritten < 0){
+    if(errno != EAGAIN){
+      mkfifo_fanout_disconnect(out);
+      return;
+    }
+    nwritten = 0;
+  }
+  out->bytes += (uint64_t)nwritten;
+  if((size_t)nwritten < len){
+    out->stalls += 1;
+    mkfifo_fanout_refuse(mkfifo_ctx, out, len - (size_t)nwritten);
+  }
+}
+
+/**
+ * Write a chunk to one output, waiting for the consumer if needed.
+ *
+ * @param[in,out] out See @ref mkfifo_fanout_out.
+ * @param[in]     buf Data to write.
+ * @param[in]     len Number of bytes in @p buf.
+ */
+static void
+mkfifo_fanout_write_wait(struct mkfifo_fanout_out *const out,
+                         const char *buf,
+                         size_t len){
+  struct pollfd pfd;
+  ssize_t nwritten;
+  bool stalled;
+
+  stalled = false;
+  while(len > 0){
+    nwritten = write(out->fd, buf, len);
+    if(nwritten < 0){
+      if(errno == EAGAIN){
+        if(!stalled){
+          stalled = true;
+          out->stalls += 1;
+        }
+        pfd.fd = out->fd;
+        pfd.events = POLLOUT;
+        poll(&pfd, 1, -1);
+      }
+      else if(errno != EINTR){
+        mkfifo_fanout_disconnect(out);
+        return;
+      }
+      continue;
+    }
+    buf += nwritten;
+    len -= (size_t)nwritten;
+    out->bytes += (uint64_t)nwritten;
+  }
+}
+
+/**
+ * Duplicate the input to every output through a user space buffer.
+ *
+ * Used where tee() is not available for the input.
+ *
+ * @param[in]     mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     in_fd      Input file descriptor.
+ * @param[in,out] outs       Output FIFOs.
+ * @param[in]     nouts      Number of entries in @p outs.
+ * @retval        0          Copied until end-of-file.
+ * @retval        -1         Failed to read the input.
+ */
+static int
+mkfifo_fanout_rw(const struct mkfifo_ctx *const mkfifo_ctx,
+                 const int in_fd,
+                 struct mkfifo_fanout_out *const outs,
+                 const size_t nouts){
+  char buf[MKFIFO_PUMP_CHUNK];
+  ssize_t nread;
+  size_t leader;
+  size_t i;
+
+  for(i = 0; i < nouts; i++){
+    if(outs[i].fd >= 0){
+      fcntl(outs[i].fd, F_SETFL, fcntl(outs[i].fd, F_GETFL) | O_NONBLOCK);
+    }
+  }
+  while(mkfifo_fanout_active(outs, nouts) > 0){
+    nread = read(in_fd, buf, sizeof(buf));
+    if(nread < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return -1;
+    }
+    if(nread == 0){
+      break;
+    }
+    leader = mkfifo_fanout_leader(outs, nouts);
+    for(i = 0; i < nouts; i++){
+      if(outs[i].fd < 0){
+        continue;
+      }
+      if(mkfifo_ctx->slow_policy == MKFIFO_SLOW_BLOCK || i == leader){
+        mkfifo_fanout_write_wait(&outs[i], buf, (size_t)nread);
+      }
+      else{
+        mkfifo_fanout_write_nowait(mkfifo_ctx, &outs[i], buf, (size_t)nread);
+      }
+    }
+  }
+  return 0;
+}
+
+#ifdef __linux__
+/**
+ * Move up to @p len bytes out of a pipe with splice().
+ *
+ * @param[in] in_fd  Pipe to read from.
+ * @param[in] out_fd Destination file descriptor.
+ * @param[in] len    Number of bytes to move.
+ * @param[in] flags  splice() flags.
+ * @return           Number of bytes moved, which is less than @p len if the
+ *                   destination would block or failed.
+ */
+static size_t
+mkfifo_splice_exact(const int in_fd,
+                    const int out_fd,
+                    const size_t len,
+                    const unsigned int flags){
+  size_t total;
+  ssize_t nmoved;
+
+  total = 0;
+  while(total < len){
+    nmoved = splice(in_fd, NULL, out_fd, NULL, len - total, flags);
+    if(nmoved < 0 && errno == EINTR){
+      continue;
+    }
+    if(nmoved <= 0){
+      break;
+    }
+    total += (size_t)nmoved;
+  }
+  return total;
+}
+
+/**
+ * Duplicate the chunk at the head of @p src into one output with tee().
+ *
+ * The chunk stays in @p src. If the output only takes part of it, the rest
+ * gets duplicated into @p scratch and spliced from there, because tee()
+ * always starts at the head of the pipe.
+ *
+ * @param[in]     mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] out        See @ref mkfifo_fanout_out.
+ * @param[in]     wait       Wait for the consumer instead of applying the
+ *                           slow consumer policy.
+ * @param[in]     src        Pipe holding the current chunk.
+ * @param[in]     len        Number of bytes in the current chunk.
+ * @param[in]     scratch    Empty pipe used for partial deliveries.
+ * @param[in]     null_fd    Open /dev/null used to discard pipe data.
+ */
+static void
+mkfifo_fanout_tee_one(const struct mkfifo_ctx *const mkfifo_ctx,
+                      struct mkfifo_fanout_out *const out,
+                      const bool wait,
+                      const int src,
+                      const size_t len,
+                      const int scratch[2],
+                      const int null_fd){
+  unsigned int flags;
+  ssize_t nteed;
+  size_t done;
+  size_t moved;
+  int queued;
+  int capacity;
+  bool stalled;
+
+  stalled = false;
+  capacity = fcntl(out->fd, F_GETPIPE_SZ);
+  if(capacity > 0 &&
+     ioctl(out->fd, FIONREAD, &queued) == 0 &&
+     (size_t)(capacity - queued) < len){
+    stalled = true;
+    out->stalls += 1;
+    if(!wait){
+      mkfifo_fanout_refuse(mkfifo_ctx, out, len);
+      return;
+    }
+  }
+  flags = wait ? 0 : SPLICE_F_NONBLOCK;
+  do{
+    nteed = tee(src, out->fd, len, flags);
+  } while(nteed < 0 && errno == EINTR);
+  if(nteed < 0){
+    if(errno != EAGAIN){
+      mkfifo_fanout_disconnect(out);
+      return;
+    }
+    nteed = 0;
+  }
+  done = (size_t)nteed;
+  out->bytes += done;
+  if(done < len){
+    if(!stalled){
+      out->stalls += 1;
+    }
+    do{
+      nteed = tee(src, scratch[1], len, 0);
+    } while(nteed < 0 && errno == EINTR);
+    mkfifo_splice_exact(scratch[0], null_fd, done, 0);
+    moved = mkfifo_splice_exact(scratch[0], out->fd, len - done, flags);
+    out->bytes += moved;
+    if(done + moved < len){
+      mkfifo_splice_exact(scratch[0], null_fd, len - done - moved, 0);
+      if(wait){
+        mkfifo_fanout_disconnect(out);
+      }
+      else{
+        mkfifo_fanout_refuse(mkfifo_ctx, out, len - done - moved);
+      }
+    }
+  }
+}
+
+/**
+ * Duplicate the input to every output with tee(), without copying the data
+ * into user space.
+ *
+ * Each chunk of input gets spliced into a staging pipe, duplicated to all
+ * outputs with tee(), and then discarded from the staging pipe.
+ *
+ * @param[in]     mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     in_fd      Input file descriptor.
+ * @param[in,out] outs       Output FIFOs.
+ * @param[in]     nouts      Number of entries in @p outs.
+ * @retval        0          Moved until end-of-file.
+ * @retval        1          Splice not supported for the input.
+ * @retval        -1         Failed to read the input.
+ */
+static int
+mkfifo_fanout_tee(const struct mkfifo_ctx *const mkfifo_ctx,
+                  const int in_fd,
+                  struct mkfifo_fanout_out *const outs,
+                  const size_t nouts){
+  int stage[2];
+  int scratch[2];
+  int null_fd;
+  ssize_t nstaged;
+  size_t leader;
+  size_t i;
+  bool first;
+  int rc;
+
+  if(pipe2(stage, O_CLOEXEC) != 0){
+    return -1;
+  }
+  if(pipe2(scratch, O_CLOEXEC) != 0){
+    close(stage[0]);
+    close(stage[1]);
+    return -1;
+  }
+  rc = 0;
+  first = true;
+  if((null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0){
+    rc = -1;
+  }
+  while(rc == 0 && mkfifo_fanout_active(outs, nouts) > 0){
+    nstaged = splice(in_fd,
+                     NULL,
+                     stage[1],
+                     NULL,
+                     MKFIFO_PUMP_CHUNK,
+                     SPLICE_F_MOVE | SPLICE_F_MORE);
+    if(nstaged < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      rc = -1;
+      if(first && (errno == EINVAL || errno == ENOSYS)){
+        rc = 1;
+      }
+      break;
+    }
+    if(nstaged == 0){
+      break;
+    }
+    first = false;
+    leader = mkfifo_fanout_leader(outs, nouts);
+    for(i = 0; i < nouts; i++){
+      if(outs[i].fd >= 0){
+        mkfifo_fanout_tee_one(mkfifo_ctx,
+                              &outs[i],
+                              mkfifo_ctx->slow_policy == MKFIFO_SLOW_BLOCK ||
+                              i == leader,
+                              stage[0],
+                              (size_t)nstaged,
+                              scratch,
+                              null_fd);
+      }
+    }
+    mkfifo_splice_exact(stage[0], null_fd, (size_t)nstaged, 0);
+  }
+  if(null_fd >= 0){
+    close(null_fd);
+  }
+  close(stage[0]);
+  close(stage[1]);
+  close(scratch[0]);
+  close(scratch[1]);
+  return rc;
+}
+#endif /* __linux__ */
+
+/**
+ * Block SIGPIPE in the calling thread, so a reader going away fails the
+ * write with EPIPE without changing the disposition for the whole process.
+ *
+ * @param[out] saved Signal mask to restore with @ref mkfifo_sigpipe_restore.
+ * @return           true if SIGPIPE was pending already.
+ */
+static bool
+mkfifo_sigpipe_block(sigset_t *const saved){
+  sigset_t pending;
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, saved);
+  return sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1;
+}
+
+/**
+ * Discard the SIGPIPE raised while @ref mkfifo_sigpipe_block was in effect
+ * and restore the signal mask.
+ *
+ * @param[in] saved       Signal mask from @ref mkfifo_sigpipe_block.
+ * @param[in] was_pending Result of @ref mkfifo_sigpipe_block.
+ */
+static void
+mkfifo_sigpipe_restore(const sigset_t *const saved,
+                       const bool was_pending){
+  sigset_t pending;
+  sigset_t set;
+  int sig;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  if(!was_pending &&
+     sigpending(&pending) == 0 &&
+     sigismember(&pending, SIGPIPE) == 1){
+    sigwait(&set, &sig);
+  }
+  pthread_sigmask(SIG_SETMASK, saved, NULL);
+}
+
+/**
+ * Open every FIFO for writing and duplicate the (-p input) data into all of
+ * them.
+ *
+ * Uses tee() on Linux so the data never gets copied into user space, and
+ * read/write otherwise. Slow consumers get handled according to the (-s)
+ * policy. The bytes delivered, stalls, and dropped bytes for each output get
+ * reported to STDERR.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     nouts      Number of FIFOs in @p paths.
+ * @param[in]     paths      FIFOs created by @ref mkfifo_path.
+ */
+static void
+mkfifo_fanout(struct mkfifo_ctx *const mkfifo_ctx,
+              const size_t nouts,
+              char *const paths[]){
+  struct mkfifo_fanout_out *outs;
+  sigset_t saved;
+  bool was_pending;
+  size_t i;
+  int in_fd;
+  int rc;
+
+  outs = calloc(nouts, sizeof(*outs));
+  if(outs == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "calloc");
+    return;
+  }
+  if((in_fd = mkfifo_open_input(mkfifo_ctx)) < 0){
+    free(outs);
+    return;
+  }
+  was_pending = mkfifo_sigpipe_block(&saved);
+  for(i = 0; i < nouts; i++){
+    outs[i].path = paths[i];
+    if((outs[i].fd = open(paths[i], O_WRONLY | O_CLOEXEC)) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "open: %s", paths[i]);
+    }
+  }
+  rc = 1;
+#ifdef __linux__
+  rc = mkfifo_fanout_tee(mkfifo_ctx, in_fd, outs, nouts);
+#endif /* __linux__ */
+  if(rc == 1){
+    rc = mkfifo_fanout_rw(mkfifo_ctx, in_fd, outs, nouts);
+  }
+  if(rc < 0){
+    mkfifo_warn(mkfifo_ctx, true, "fan-out: %s", mkfifo_ctx->pump_input);
+  }
+  for(i = 0; i < nouts; i++){
+    fprintf(stderr,
+            "%s: %s: %llu bytes, %llu stalls, %llu dropped%s\n",
+            MKFIFO_PROGNAME,
+            outs[i].path,
+            (unsigned long long)outs[i].bytes,
+            (unsigned long long)outs[i].stalls,
+            (unsigned long long)outs[i].dropped,
+            outs[i].fd < 0 ? ", disconnected" : "");
+    mkfifo_fanout_disconnect(&outs[i]);
+  }
+  mkfifo_sigpipe_restore(&saved, was_pending);
+  if(in_fd != STDIN_FILENO){
+    close(in_fd);
+  }
+  free(outs);
+}
+
+/**
+ * Parse the pump transfer method given in the (-b backend) argument.
+ *
+ * @param[in,out] mkfifo_ctx  See @ref mkfifo_ctx.
+ * @param[in]     backend_str One of rw, splice, or vmsplice.
+ */
+static void
+mkfifo_parse_backend(struct mkfifo_ctx *const mkfifo_ctx,
+                     const char *const backend_str){
+  if(strcmp(backend_str, "rw") == 0){
+    mkfifo_ctx->pump_backend = MKFIFO_BACKEND_RW;
+  }
+  else if(strcmp(backend_str, "splice") == 0){
+    mkfifo_ctx->pump_backend = MKFIFO_BACKEND_SPLICE;
+  }
+  else if(strcmp(backend_str, "vmsplice") == 0){
+    mkfifo_ctx->pump_backend = MKFIFO_BACKEND_VMSPLICE;
+  }
+  else{
+    mkfifo_warn(mkfifo_ctx, false, "invalid backend: %s", backend_str);
+  }
+}
+
+/**
+ * Parse the slow consumer policy given in the (-s policy) argument.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     policy_str One of block, drop, or disconnect.
+ */
+static void
+mkfifo_parse_slow_policy(struct mkfifo_ctx *const mkfifo_ctx,
+                         const char *const policy_str){
+  if(strcmp(policy_str, "block") == 0){
+    mkfifo_ctx->slow_policy = MKFIFO_SLOW_BLOCK;
+  }
+  else if(strcmp(policy_str, "drop") == 0){
+    mkfifo_ctx->slow_policy = MKFIFO_SLOW_DROP;
+  }
+  else if(strcmp(policy_str, "disconnect") == 0){
+    mkfifo_ctx->slow_policy = MKFIFO_SLOW_DISCONNECT;
+  }
+  else{
+    mkfifo_warn(mkfifo_ctx, false, "invalid policy: %s", policy_str);
+  }
+}
+
+/**
+ * Write out all merged records collected so far.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] merge      See @ref mkfifo_merge.
+ */
+static void
+mkfifo_merge_flush(struct mkfifo_ctx *const mkfifo_ctx,
+                   struct mkfifo_merge *const merge){
+  if(merge->out_len > 0){
+    if(mkfifo_write_all(merge->out_fd,
+                        merge->out,
+                        merge->out_len,
+                        &merge->stats) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "write: %s", mkfifo_ctx->merge_output);
+    }
+    merge->out_len = 0;
+  }
+}
+
+/**
+ * Append one complete record to the output batch.
+ *
+ * Records that do not fit in the batch get written directly, so a record
+ * always reaches the output in one piece and never interleaves with others.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] merge      See @ref mkfifo_merge.
+ * @param[in]     rec        Record including its newline or length header.
+ * @param[in]     len        Number of bytes in @p rec.
+ */
+static void
+mkfifo_merge_emit(struct mkfifo_ctx *const mkfifo_ctx,
+                  struct mkfifo_merge *const merge,
+                  const char *const rec,
+                  const size_t len){
+  merge->records += 1;
+  if(merge->out_len + len > MKFIFO_MERGE_BATCH){
+    mkfifo_merge_flush(mkfifo_ctx, merge);
+  }
+  if(len > MKFIFO_MERGE_BATCH){
+    if(mkfifo_write_all(merge->out_fd, rec, len, &merge->stats) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "write: %s", mkfifo_ctx->merge_output);
+    }
+  }
+  else{
+    memcpy(&merge->out[merge->out_len], rec, len);
+    merge->out_len += len;
+  }
+}
+
+/**
+ * Move every complete record buffered for an input to the output batch.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] merge      See @ref mkfifo_merge.
+ * @param[in,out] in         See @ref mkfifo_record_in.
+ * @retval        0          Extracted all complete records.
+ * @retval        -1         Record exceeds @ref MKFIFO_RECORD_MAX.
+ */
+static int
+mkfifo_merge_extract(struct mkfifo_ctx *const mkfifo_ctx,
+                     struct mkfifo_merge *const merge,
+                     struct mkfifo_record_in *const in){
+  size_t off;
+  size_t reclen;
+  int rc;
+
+  off = 0;
+  while((rc = mkfifo_record_next(mkfifo_ctx->record_format,
+                                 in,
+                                 off,
+                                 &reclen)) == 1){
+    mkfifo_merge_emit(mkfifo_ctx, merge, &in->buf[off], reclen);
+    off += reclen;
+  }
+  mkfifo_record_consume(in, off);
+  return rc;
+}
+
+/**
+ * Close an input once its writers are gone, flushing a final line that
+ * lacks a newline.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] merge      See @ref mkfifo_merge.
+ * @param[in,out] in         See @ref mkfifo_record_in.
+ */
+static void
+mkfifo_merge_close(struct mkfifo_ctx *const mkfifo_ctx,
+                   struct mkfifo_merge *const merge,
+                   struct mkfifo_record_in *const in){
+  if(in->len > 0){
+    if(mkfifo_ctx->record_format != MKFIFO_RECORD_LENGTH){
+      in->buf[in->len++] = '\n';
+      mkfifo_merge_emit(mkfifo_ctx, merge, in->buf, in->len);
+      in->records += 1;
+    }
+    else{
+      mkfifo_warn(mkfifo_ctx, false, "truncated record: %s", in->path);
+    }
+    in->len = 0;
+  }
+  close(in->fd);
+  in->fd = -1;
+  merge->open_inputs -= 1;
+}
+
+/**
+ * Read whatever an input has available and extract complete records.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] merge      See @ref mkfifo_merge.
+ * @param[in,out] in         See @ref mkfifo_record_in.
+ */
+static void
+mkfifo_merge_read(struct mkfifo_ctx *const mkfifo_ctx,
+                  struct mkfifo_merge *const merge,
+                  struct mkfifo_record_in *const in){
+  ssize_t nread;
+
+  while(in->fd >= 0){
+    if(mkfifo_record_reserve(in) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "realloc");
+      mkfifo_merge_close(mkfifo_ctx, merge, in);
+      return;
+    }
+    nread = read(in->fd, &in->buf[in->len], MKFIFO_PUMP_CHUNK);
+    if(nread < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      if(errno != EAGAIN){
+        mkfifo_warn(mkfifo_ctx, true, "read: %s", in->path);
+        mkfifo_merge_close(mkfifo_ctx, merge, in);
+      }
+      return;
+    }
+    if(nread == 0){
+      mkfifo_merge_close(mkfifo_ctx, merge, in);
+      return;
+    }
+    in->len += (size_t)nread;
+    if(mkfifo_merge_extract(mkfifo_ctx, merge, in) < 0){
+      mkfifo_warn(mkfifo_ctx, false, "record too large: %s", in->path);
+      in->len = 0;
+      mkfifo_merge_close(mkfifo_ctx, merge, in);
+      return;
+    }
+  }
+}
+
+/**
+ * Wait until at least one input has data or has been closed by its writers,
+ * then read from every such input.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] merge      See @ref mkfifo_merge.
+ * @retval        0          Serviced the ready inputs.
+ * @retval        -1         Failed to wait for the inputs.
+ */
+static int
+mkfifo_merge_wait(struct mkfifo_ctx *const mkfifo_ctx,
+                  struct mkfifo_merge *const merge){
+#ifdef __linux__
+  struct epoll_event events[MKFIFO_MERGE_EVENTS];
+  int nready;
+  int i;
+
+  nready = epoll_wait(merge->epoll_fd, events, MKFIFO_MERGE_EVENTS, -1);
+  if(nready < 0){
+    return errno == EINTR ? 0 : -1;
+  }
+  for(i = 0; i < nready; i++){
+    mkfifo_merge_read(mkfifo_ctx, merge, &merge->inputs[events[i].data.u64]);
+  }
+#else /* !(__linux__) */
+  struct pollfd *pfds;
+  size_t i;
+  int nready;
+
+  pfds = calloc(merge->ninputs, sizeof(*pfds));
+  if(pfds == NULL){
+    return -1;
+  }
+  for(i = 0; i < merge->ninputs; i++){
+    pfds[i].fd = merge->inputs[i].fd;
+    pfds[i].events = POLLIN;
+  }
+  nready = poll(pfds, (nfds_t)merge->ninputs, -1);
+  for(i = 0; nready > 0 && i < merge->ninputs; i++){
+    if(pfds[i].revents != 0){
+      mkfifo_merge_read(mkfifo_ctx, merge, &merge->inputs[i]);
+    }
+  }
+  free(pfds);
+  if(nready < 0){
+    return errno == EINTR ? 0 : -1;
+  }
+#endif /* __linux__ */
+  return 0;
+}
+
+/**
+ * Open every FIFO for reading and merge whole records from all of them into
+ * the (-M output) file.
+ *
+ * A single thread waits on all inputs, reassembles complete records for
+ * each input separately, and writes them to the output in large batches.
+ * Records never interleave, regardless of their size.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     ninputs    Number of FIFOs in @p paths.
+ * @param[in]     paths      FIFOs created by @ref mkfifo_path.
+ */
+static void
+mkfifo_merge(struct mkfifo_ctx *const mkfifo_ctx,
+             const size_t ninputs,
+             char *const paths[]){
+  struct mkfifo_merge merge;
+  size_t i;
+#ifdef __linux__
+  struct epoll_event ev;
+#endif /* __linux__ */
+
+  memset(&merge, 0, sizeof(merge));
+  merge.ninputs = ninputs;
+  merge.inputs = calloc(ninputs, sizeof(*merge.inputs));
+  merge.out = malloc(MKFIFO_MERGE_BATCH);
+  if(merge.inputs == NULL || merge.out == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+    free(merge.inputs);
+    free(merge.out);
+    return;
+  }
+  if(strcmp(mkfifo_ctx->merge_output, "-") == 0){
+    merge.out_fd = STDOUT_FILENO;
+  }
+  else if((merge.out_fd = open(mkfifo_ctx->merge_output,
+                               O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                               0666)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "open: %s", mkfifo_ctx->merge_output);
+  }
+#ifdef __linux__
+  if(merge.out_fd >= 0 &&
+     (merge.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "epoll_create1");
+  }
+#endif /* __linux__ */
+  for(i = 0; mkfifo_ctx->status_code == 0 && i < ninputs; i++){
+    merge.inputs[i].path = paths[i];
+    merge.inputs[i].fd = open(paths[i], O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(merge.inputs[i].fd < 0){
+      mkfifo_warn(mkfifo_ctx, true, "open: %s", paths[i]);
+      break;
+    }
+    merge.open_inputs += 1;
+#ifdef __linux__
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    if(epoll_ctl(merge.epoll_fd, EPOLL_CTL_ADD, merge.inputs[i].fd, &ev) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "epoll_ctl: %s", paths[i]);
+    }
+#endif /* __linux__ */
+  }
+  while(mkfifo_ctx->status_code == 0 && merge.open_inputs > 0){
+    if(mkfifo_merge_wait(mkfifo_ctx, &merge) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "wait");
+    }
+    mkfifo_merge_flush(mkfifo_ctx, &merge);
+  }
+  mkfifo_merge_flush(mkfifo_ctx, &merge);
+  fprintf(stderr,
+          "%s: %s: %llu records, %llu bytes, %llu writes\n",
+          MKFIFO_PROGNAME,
+          mkfifo_ctx->merge_output,
+          (unsigned long long)merge.records,
+          (unsigned long long)merge.stats.bytes,
+          (unsigned long long)merge.stats.syscalls);
+  for(i = 0; i < ninputs; i++){
+    if(merge.inputs[i].fd >= 0){
+      close(merge.inputs[i].fd);
+    }
+    free(merge.inputs[i].buf);
+  }
+#ifdef __linux__
+  if(merge.epoll_fd > 0){
+    close(merge.epoll_fd);
+  }
+#endif /* __linux__ */
+  if(merge.out_fd > STDOUT_FILENO){
+    close(merge.out_fd);
+  }
+  free(merge.inputs);
+  free(merge.out);
+}
+
+/**
+ * Parse the record format given in the (-r format) argument.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     format_str Either line or length.
+ */
+static void
+mkfifo_parse_record_format(struct mkfifo_ctx *const mkfifo_ctx,
+                           const char *const format_str){
+  if(strcmp(format_str, "line") == 0){
+    mkfifo_ctx->record_format = MKFIFO_RECORD_LINE;
+  }
+  else if(strcmp(format_str, "length") == 0){
+    mkfifo_ctx->record_format = MKFIFO_RECORD_LENGTH;
+  }
+  else{
+    mkfifo_warn(mkfifo_ctx, false, "invalid record format: %s", format_str);
+  }
+}
+
+/**
+ * Environment passed to the --exec command.
+ */
+extern char **environ;
+
+/**
+ * Parse the comma-separated names given to --exec.
+ *
+ * @param[in,out] names  Copy of the argument, split in place.
+ * @param[out]    fifos  Parsed FIFOs to free.
+ * @param[out]    nfifos Number of entries in @p fifos.
+ * @retval        0      Parsed every name.
+ * @retval        -1     Invalid name, or out of memory with errno set.
+ */
+static int
+mkfifo_exec_parse(char *const names,
+                  struct mkfifo_exec_fifo **const fifos,
+                  size_t *const nfifos){
+  struct mkfifo_exec_fifo *fifo;
+  char *name;
+  char *next;
+  size_t len;
+  size_t n;
+  int target;
+
+  n = 1;
+  for(name = names; (name = strchr(name, ',')); name++){
+    n += 1;
+  }
+  if((*fifos = calloc(n, sizeof(**fifos))) == NULL){
+    return -1;
+  }
+  *nfifos = n;
+  target = STDERR_FILENO + 1;
+  for(name = names, fifo = *fifos; name; name = next, fifo++){
+    if((next = strchr(name, ','))){
+      *next++ = '\0';
+    }
+    fifo->fd = -1;
+    fifo->open_flags = -1;
+    len = strlen(name);
+    if(len > 2 && name[len - 2] == ':'){
+      if(name[len - 1] == 'r'){
+        fifo->open_flags = O_RDONLY;
+      }
+      else if(name[len - 1] == 'w'){
+        fifo->open_flags = O_RDWR;
+      }
+      if(fifo->open_flags != -1){
+        name[len - 2] = '\0';
+        fifo->target = target++;
+      }
+    }
+    fifo->name = name;
+    if(name[0] == '\0' ||
+       strchr(name, '/') ||
+       strcmp(name, ".") == 0 ||
+       strcmp(name, "..") == 0){
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Append a substituted value, single-quoted for sh -c if requested.
+ *
+ * @param[out] out   Buffer to append to, or NULL to only count.
+ * @param[in]  len   Number of bytes in @p out so far.
+ * @param[in]  value Value to append.
+ * @param[in]  quote Put @p value in single quotes, with each ' written
+ *                   as '\''.
+ * @return           Number of bytes in @p out afterwards.
+ */
+static size_t
+mkfifo_exec_append(char *const out,
+                   size_t len,
+                   const char *const value,
+                   const bool quote){
+  const char *p;
+
+  if(quote){
+    if(out){
+      out[len] = '\'';
+    }
+    len += 1;
+  }
+  for(p = value; *p; p++){
+    if(quote && *p == '\''){
+      if(out){
+        memcpy(&out[len], "'\\''", 4);
+      }
+      len += 4;
+    }
+    else{
+      if(out){
+        out[len] = *p;
+      }
+      len += 1;
+    }
+  }
+  if(quote){
+    if(out){
+      out[len] = '\'';
+    }
+    len += 1;
+  }
+  return len;
+}
+
+/**
+ * Replace every {name} in a command argument with the path of that FIFO,
+ * and every {name.fd} with the descriptor the command inherits it as.
+ * Other braces are kept.
+ *
+ * @param[in] arg    Command argument.
+ * @param[in] fifos  See @ref mkfifo_exec_fifo.
+ * @param[in] nfifos Number of entries in @p fifos.
+ * @param[in] quote  Single-quote the paths, for a command run by sh -c.
+ * @return           New argument to free, or NULL if out of memory.
+ */
+static char *
+mkfifo_exec_subst(const char *const arg,
+                  const struct mkfifo_exec_fifo *const fifos,
+                  const size_t nfifos,
+                  const bool quote){
+  const struct mkfifo_exec_fifo *match;
+  const char *value;
+  const char *end;
+  const char *p;
+  char number[16];
+  bool quoted;
+  size_t key;
+  size_t len;
+  size_t i;
+  char *out;
+  int pass;
+
+  out = NULL;
+  for(pass = 0; pass < 2; pass++){
+    len = 0;
+    for(p = arg; *p; p++){
+      value = NULL;
+      quoted = false;
+      end = *p == '{' ? strchr(p, '}') : NULL;
+      match = NULL;
+      for(i = 0; end && i < nfifos && match == NULL; i++){
+        key = strlen(fifos[i].name);
+        if(strncmp(p + 1, fifos[i].name, key) != 0){
+          continue;
+        }
+        if(p + 1 + key == end){
+          match = &fifos[i];
+          value = match->path;
+          quoted = quote;
+        }
+        else if(fifos[i].open_flags != -1 &&
+                end - (p + 1 + key) == 3 &&
+                memcmp(p + 1 + key, ".fd", 3) == 0){
+          match = &fifos[i];
+          snprintf(number, sizeof(number), "%d", match->target);
+          value = number;
+        }
+      }
+      if(value){
+        len = mkfifo_exec_append(out, len, value, quoted);
+        p = end;
+      }
+      else{
+        if(out){
+          out[len] = *p;
+        }
+        len += 1;
+      }
+    }
+    if(out == NULL && (out = malloc(len + 1)) == NULL){
+      return NULL;
+    }
+  }
+  out[len] = '\0';
+  return out;
+}
+
+/**
+ * Remove everything left in the private directory of --exec, then the
+ * directory itself. Subdirectories the command made are removed only when
+ * empty.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     dir        Private directory.
+ * @param[in]     dir_fd     Descriptor of @p dir, closed here.
+ */
+static void
+mkfifo_exec_cleanup(struct mkfifo_ctx *const mkfifo_ctx,
+                    const char *const dir,
+                    const int dir_fd){
+  struct dirent *ent;
+  DIR *dp;
+  int fd;
+
+  if((fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0)) >= 0 && (dp = fdopendir(fd))){
+    while((ent = readdir(dp))){
+      if(strcmp(ent->d_name, ".") != 0 &&
+         strcmp(ent->d_name, "..") != 0 &&
+         unlinkat(dir_fd, ent->d_name, 0) != 0){
+        unlinkat(dir_fd, ent->d_name, AT_REMOVEDIR);
+      }
+    }
+    closedir(dp);
+  }
+  else if(fd >= 0){
+    close(fd);
+  }
+  close(dir_fd);
+  if(rmdir(dir) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "rmdir: %s", dir);
+  }
+}
+
+/**
+ * Create a directory only this user can reach, with mkdtemp() under $TMPDIR
+ * or /tmp.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[out]    dir        Path of the directory to free, or NULL.
+ * @return                   Descriptor of @p dir, or -1 after a warning.
+ */
+static int
+mkfifo_private_dir(struct mkfifo_ctx *const mkfifo_ctx,
+                   char **const dir){
+  const char *tmp;
+  size_t len;
+  int dir_fd;
+
+  if((tmp = getenv("TMPDIR")) == NULL || tmp[0] == '\0'){
+    tmp = "/tmp";
+  }
+  len = strlen(tmp) + sizeof("/mkfifo.XXXXXX");
+  if((*dir = malloc(len)) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+    return -1;
+  }
+  snprintf(*dir, len, "%s/mkfifo.XXXXXX", tmp);
+  if(mkdtemp(*dir) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "mkdtemp: %s", *dir);
+    return -1;
+  }
+  if((dir_fd = open(*dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "open: %s", *dir);
+    rmdir(*dir);
+  }
+  return dir_fd;
+}
+
+/**
+ * Start a command with the opened FIFOs moved to their descriptor numbers,
+ * with SIGINT, SIGQUIT, and SIGPIPE back to their defaults, and with the
+ * signal mask from before @ref mkfifo_block_interrupts. SIGPIPE may be
+ * ignored here, as in the bash builtin, and writers in a pipeline need it
+ * to stop once their reader is gone.
+ *
+ * @param[in]  fifos  See @ref mkfifo_exec_fifo, passing those with fd set.
+ * @param[in]  nfifos Number of entries in @p fifos.
+ * @param[in]  argv   Command and arguments, searched in PATH.
+ * @param[in]  mask   Signal mask for the command.
+ * @param[out] pid    Process started.
+ * @retval     0      Started the command.
+ * @retval     >0     errno from posix_spawnp().
+ */
+static int
+mkfifo_spawn(const struct mkfifo_exec_fifo *const fifos,
+             const size_t nfifos,
+             char *const argv[],
+             const sigset_t *const mask,
+             pid_t *const pid){
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t defaults;
+  size_t i;
+  int err;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+  for(i = 0; i < nfifos; i++){
+    if(fifos[i].fd >= 0){
+      posix_spawn_file_actions_adddup2(&actions, fifos[i].fd, fifos[i].target);
+    }
+  }
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGINT);
+  sigaddset(&defaults, SIGQUIT);
+  sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setsigmask(&attr, mask);
+  posix_spawnattr_setflags(&attr,
+                           POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+  err = posix_spawnp(pid, argv[0], &actions, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return err;
+}
+
+/**
+ * Block SIGINT and SIGQUIT in the calling thread while commands run around
+ * a private directory, so an interrupt from the terminal stops the commands
+ * but reaches this process only after the cleanup. Unlike ignoring them as
+ * system() does, this leaves the process-wide dispositions alone.
+ *
+ * @param[out] saved Signal mask to restore with
+ *                   @ref mkfifo_unblock_interrupts.
+ */
+static void
+mkfifo_block_interrupts(sigset_t *const saved){
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGQUIT);
+  pthread_sigmask(SIG_BLOCK, &set, saved);
+}
+
+/**
+ * Restore the signal mask, delivering an interrupt that arrived while
+ * @ref mkfifo_block_interrupts was in effect.
+ *
+ * @param[in] saved Signal mask from @ref mkfifo_block_interrupts.
+ */
+static void
+mkfifo_unblock_interrupts(const sigset_t *const saved){
+  pthread_sigmask(SIG_SETMASK, saved, NULL);
+}
+
+/**
+ * Convert a waitpid() status to a shell-style exit status.
+ *
+ * @param[in] status Status from waitpid().
+ * @return           Exit status, or 128 plus the terminating signal.
+ */
+static int
+mkfifo_exit_status(const int status){
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * Start the command and wait for it.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] fifos      See @ref mkfifo_exec_fifo, closed here.
+ * @param[in]     nfifos     Number of entries in @p fifos.
+ * @param[in]     argv       Command with the paths substituted.
+ * @param[in]     mask       Signal mask for the command.
+ */
+static void
+mkfifo_exec_run(struct mkfifo_ctx *const mkfifo_ctx,
+                struct mkfifo_exec_fifo *const fifos,
+                const size_t nfifos,
+                char *const argv[],
+                const sigset_t *const mask){
+  size_t i;
+  pid_t pid;
+  int status;
+  int err;
+
+  err = mkfifo_spawn(fifos, nfifos, argv, mask, &pid);
+  for(i = 0; i < nfifos; i++){
+    if(fifos[i].fd >= 0){
+      close(fifos[i].fd);
+      fifos[i].fd = -1;
+    }
+  }
+  if(err != 0){
+    errno = err;
+    mkfifo_warn(mkfifo_ctx, true, "%s", argv[0]);
+    mkfifo_ctx->status_code = err == ENOENT ? 127 : 126;
+  }
+  else{
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR){
+    }
+    mkfifo_ctx->status_code = mkfifo_exit_status(status);
+  }
+}
+
+/**
+ * Create FIFOs in a private temporary directory, run a command with their
+ * paths, and remove the directory when the command exits (--exec names).
+ *
+ * Replaces mktemp -d, one mkfifo per name, and rm -r around a job with a
+ * single process. The directory comes from mkdtemp() under $TMPDIR or
+ * /tmp, so only this user can reach the FIFOs, and every FIFO is created
+ * with mkfifoat() relative to it. A name ending in :r or :w is also opened
+ * for the command, for reading or for reading and writing, since a write
+ * end cannot be opened before a reader exists. The command inherits these
+ * descriptors from 3 upwards in the order given.
+ *
+ * The exit status is the one of the command, 128 plus the signal that
+ * killed it, 127 if it was not found, or 126 if it could not run.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     names      Comma-separated FIFO names.
+ * @param[in]     argc       Number of arguments in @p argv.
+ * @param[in]     argv       Command and arguments.
+ */
+static void
+mkfifo_exec(struct mkfifo_ctx *const mkfifo_ctx,
+            const char *const names,
+            const int argc,
+            char *const argv[]){
+  struct mkfifo_exec_fifo *fifos;
+  sigset_t saved;
+  char **cmd;
+  char *copy;
+  char *dir;
+  size_t nfifos;
+  size_t len;
+  size_t i;
+  int dir_fd;
+  int fd;
+
+  fifos = NULL;
+  nfifos = 0;
+  cmd = NULL;
+  dir = NULL;
+  if((copy = strdup(names)) == NULL ||
+     (cmd = calloc((size_t)argc + 1, sizeof(*cmd))) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+  }
+  else if(mkfifo_exec_parse(copy, &fifos, &nfifos) != 0){
+    mkfifo_warn(mkfifo_ctx, false, "invalid --exec names: %s", names);
+  }
+  else if((dir_fd = mkfifo_private_dir(mkfifo_ctx, &dir)) >= 0){
+    mkfifo_block_interrupts(&saved);
+    len = strlen(dir) + 1;
+    for(i = 0; i < nfifos && mkfifo_ctx->status_code == 0; i++){
+      if((fifos[i].path = malloc(len + strlen(fifos[i].name) + 1)) == NULL){
+        mkfifo_warn(mkfifo_ctx, true, "malloc");
+        break;
+      }
+      sprintf(fifos[i].path, "%s/%s", dir, fifos[i].name);
+      if(mkfifoat(dir_fd, fifos[i].name, mkfifo_ctx->mode) != 0 ||
+         (mkfifo_ctx->mode_set &&
+          (errno = mkfifo_chmod(dir_fd,
+                                fifos[i].name,
+                                mkfifo_ctx->mode)) != 0)){
+        mkfifo_warn(mkfifo_ctx, true, "cannot create fifo: %s",
+                    fifos[i].path);
+        break;
+      }
+      if(fifos[i].open_flags == -1){
+        continue;
+      }
+      fd = openat(dir_fd,
+                  fifos[i].name,
+                  fifos[i].open_flags | O_NONBLOCK | O_CLOEXEC);
+      if(fd < 0 ||
+         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) != 0 ||
+         (fifos[i].fd = fcntl(fd,
+                              F_DUPFD_CLOEXEC,
+                              STDERR_FILENO + 1 + (int)nfifos)) < 0){
+        mkfifo_warn(mkfifo_ctx, true, "open: %s", fifos[i].path);
+      }
+      if(fd >= 0){
+        close(fd);
+      }
+    }
+    for(i = 0; i < (size_t)argc && mkfifo_ctx->status_code == 0; i++){
+      if((cmd[i] = mkfifo_exec_subst(argv[i], fifos, nfifos, false)) == NULL){
+        mkfifo_warn(mkfifo_ctx, true, "malloc");
+      }
+    }
+    if(mkfifo_ctx->status_code == 0){
+      mkfifo_exec_run(mkfifo_ctx, fifos, nfifos, cmd, &saved);
+    }
+    for(i = 0; i < nfifos; i++){
+      if(fifos[i].fd >= 0){
+        close(fifos[i].fd);
+      }
+    }
+    mkfifo_exec_cleanup(mkfifo_ctx, dir, dir_fd);
+    mkfifo_unblock_interrupts(&saved);
+  }
+  for(i = 0; cmd && i < (size_t)argc; i++){
+    free(cmd[i]);
+  }
+  for(i = 0; i < nfifos; i++){
+    free(fifos[i].path);
+  }
+  free(fifos);
+  free(cmd);
+  free(dir);
+  free(copy);
+}
+
+/**
+ * Check a --pipeline stage or edge name. Only letters, digits, '_', and
+ * '-' are allowed, so names are safe in paths, {name.fd}, and the report.
+ *
+ * @param[in] name Name, or NULL if missing.
+ * @retval    true  Valid name.
+ * @retval    false Missing or invalid name.
+ */
+static bool
+mkfifo_pipeline_name_ok(const char *const name){
+  static const char allowed[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "0123456789_-";
+
+  return name && name[0] != '\0' && name[strspn(name, allowed)] == '\0';
+}
+
+/**
+ * Split the next blank-separated token off a spec line.
+ *
+ * @param[in,out] line Rest of the line, advanced past the token.
+ * @return             Token, or NULL at the end of the line.
+ */
+static char *
+mkfifo_pipeline_token(char **const line){
+  char *tok;
+  char *p;
+
+  p = *line + strspn(*line, " \t\r");
+  if(*p == '\0'){
+    *line = p;
+    return NULL;
+  }
+  tok = p;
+  p += strcspn(p, " \t\r");
+  if(*p != '\0'){
+    *p++ = '\0';
+  }
+  *line = p;
+  return tok;
+}
+
+/**
+ * Read the whole --pipeline spec into @ref mkfifo_pipeline::text.
+ *
+ * @param[in,out] pl   See @ref mkfifo_pipeline.
+ * @param[in]     spec Spec file, or "-" for STDIN.
+ * @retval        0    Read the spec.
+ * @retval        -1   Failed with errno set.
+ */
+static int
+mkfifo_pipeline_read(struct mkfifo_pipeline *const pl,
+                     const char *const spec){
+  FILE *fp;
+  char *text;
+  size_t len;
+  size_t cap;
+  size_t n;
+  int rc;
+
+  if(strcmp(spec, "-") == 0){
+    fp = stdin;
+  }
+  else if((fp = fopen(spec, "re")) == NULL){
+    return -1;
+  }
+  len = 0;
+  cap = 0;
+  rc = 0;
+  do{
+    if(len + 1 >= cap){
+      cap = cap * 2 + 4096;
+      if((text = realloc(pl->text, cap)) == NULL){
+        rc = -1;
+        break;
+      }
+      pl->text = text;
+    }
+    n = fread(&pl->text[len], 1, cap - len - 1, fp);
+    len += n;
+  } while(n > 0);
+  if(rc == 0 && ferror(fp)){
+    rc = -1;
+  }
+  if(rc == 0){
+    pl->text[len] = '\0';
+  }
+  if(fp != stdin){
+    fclose(fp);
+  }
+  return rc;
+}
+
+/**
+ * Parse a --pipeline spec.
+ *
+ * Each line is blank, a comment starting with '#', or one of:
+ *   - stage NAME COMMAND...
+ *   - edge NAME FROM TO [SIZE]
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[out]    pl         See @ref mkfifo_pipeline.
+ * @param[in]     spec       Spec file, or "-" for STDIN.
+ * @retval        0          Parsed every line.
+ * @retval        -1         Failed after a warning.
+ */
+static int
+mkfifo_pipeline_parse(struct mkfifo_ctx *const mkfifo_ctx,
+                      struct mkfifo_pipeline *const pl,
+                      const char *const spec){
+  struct mkfifo_pipeline_stage *stage;
+  struct mkfifo_pipeline_edge *edge;
+  const char *size;
+  unsigned lineno;
+  char *line;
+  char *next;
+  char *kind;
+  char *end;
+  size_t nlines;
+  long value;
+  bool ok;
+
+  if(mkfifo_pipeline_read(pl, spec) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "%s", spec);
+    return -1;
+  }
+  nlines = 1;
+  for(line = pl->text; (line = strchr(line, '\n')); line++){
+    nlines += 1;
+  }
+  if((pl->stages = calloc(nlines, sizeof(*pl->stages))) == NULL ||
+     (pl->edges = calloc(nlines, sizeof(*pl->edges))) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "calloc");
+    return -1;
+  }
+  for(line = pl->text, lineno = 1; line; line = next, lineno++){
+    if((next = strchr(line, '\n'))){
+      *next++ = '\0';
+    }
+    if((kind = mkfifo_pipeline_token(&line)) == NULL || kind[0] == '#'){
+      continue;
+    }
+    if(strcmp(kind, "stage") == 0){
+      stage = &pl->stages[pl->nstages++];
+      stage->name = mkfifo_pipeline_token(&line);
+      stage->command = line + strspn(line, " \t");
+      stage->pid = -1;
+      stage->status = -1;
+      ok = mkfifo_pipeline_name_ok(stage->name) && stage->command[0] != '\0';
+    }
+    else if(strcmp(kind, "edge") == 0){
+      edge = &pl->edges[pl->nedges++];
+      edge->name = mkfifo_pipeline_token(&line);
+      edge->from_name = mkfifo_pipeline_token(&line);
+      edge->to_name = mkfifo_pipeline_token(&line);
+      edge->rfd = -1;
+      edge->wfd = -1;
+      ok = mkfifo_pipeline_name_ok(edge->name) &&
+           edge->to_name != NULL;
+      if(ok && (size = mkfifo_pipeline_token(&line))){
+        errno = 0;
+        value = strtol(size, &end, 10);
+        ok = errno == 0 && *end == '\0' && value > 0 && value <= INT_MAX &&
+             mkfifo_pipeline_token(&line) == NULL;
+        edge->size = ok ? (int)value : 0;
+      }
+    }
+    else{
+      ok = false;
+    }
+    if(!ok){
+      mkfifo_warn(mkfifo_ctx, false, "%s:%u: invalid line", spec, lineno);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Find a stage by name.
+ *
+ * @param[in] pl   See @ref mkfifo_pipeline.
+ * @param[in] name Stage name.
+ * @return         Index of the stage, or @ref mkfifo_pipeline::nstages.
+ */
+static size_t
+mkfifo_pipeline_find(const struct mkfifo_pipeline *const pl,
+                     const char *const name){
+  size_t i;
+
+  for(i = 0; i < pl->nstages; i++){
+    if(strcmp(pl->stages[i].name, name) == 0){
+      break;
+    }
+  }
+  return i;
+}
+
+/**
+ * Resolve the edges of a parsed spec and check that the names are unique
+ * and the stages form a DAG.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] pl         See @ref mkfifo_pipeline.
+ * @retval        0          Valid spec.
+ * @retval        -1         Failed after a warning.
+ */
+static int
+mkfifo_pipeline_check(struct mkfifo_ctx *const mkfifo_ctx,
+                      struct mkfifo_pipeline *const pl){
+  struct mkfifo_pipeline_edge *edge;
+  size_t *indegree;
+  size_t *order;
+  size_t n;
+  size_t i;
+  size_t j;
+
+  if(pl->nstages == 0){
+    mkfifo_warn(mkfifo_ctx, false, "pipeline has no stages");
+    return -1;
+  }
+  for(i = 0; i < pl->nstages; i++){
+    if(mkfifo_pipeline_find(pl, pl->stages[i].name) != i){
+      mkfifo_warn(mkfifo_ctx, false, "duplicate stage: %s",
+                  pl->stages[i].name);
+      return -1;
+    }
+  }
+  for(i = 0; i < pl->nedges; i++){
+    edge = &pl->edges[i];
+    for(j = 0; j < i; j++){
+      if(strcmp(pl->edges[j].name, edge->name) == 0){
+        mkfifo_warn(mkfifo_ctx, false, "duplicate edge: %s", edge->name);
+        return -1;
+      }
+    }
+    edge->from = mkfifo_pipeline_find(pl, edge->from_name);
+    edge->to = mkfifo_pipeline_find(pl, edge->to_name);
+    if(edge->from == pl->nstages || edge->to == pl->nstages){
+      mkfifo_warn(mkfifo_ctx, false, "edge %s: unknown stage: %s",
+                  edge->name,
+                  edge->from == pl->nstages ? edge->from_name :
+                                              edge->to_name);
+      return -1;
+    }
+    if(edge->from == edge->to){
+      mkfifo_warn(mkfifo_ctx, false, "edge %s: stage %s feeds itself",
+                  edge->name,
+                  edge->from_name);
+      return -1;
+    }
+  }
+  if((indegree = calloc(pl->nstages, sizeof(*indegree))) == NULL ||
+     (order = calloc(pl->nstages, sizeof(*order))) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "calloc");
+    free(indegree);
+    return -1;
+  }
+  for(i = 0; i < pl->nedges; i++){
+    indegree[pl->edges[i].to] += 1;
+  }
+  n = 0;
+  for(i = 0; i < pl->nstages; i++){
+    if(indegree[i] == 0){
+      order[n++] = i;
+    }
+  }
+  for(i = 0; i < n; i++){
+    for(j = 0; j < pl->nedges; j++){
+      if(pl->edges[j].from == order[i] && --indegree[pl->edges[j].to] == 0){
+        order[n++] = pl->edges[j].to;
+      }
+    }
+  }
+  free(indegree);
+  free(order);
+  if(n < pl->nstages){
+    mkfifo_warn(mkfifo_ctx, false, "pipeline has a cycle");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Clear O_NONBLOCK on a descriptor and move it above the descriptors the
+ * stages inherit.
+ *
+ * @param[in] fd  Descriptor, closed here.
+ * @param[in] min Lowest descriptor number allowed.
+ * @return        New descriptor, or -1 with errno set.
+ */
+static int
+mkfifo_pipeline_move(const int fd,
+                     const int min){
+  int moved;
+  int flags;
+
+  moved = -1;
+  if((flags = fcntl(fd, F_GETFL)) != -1 &&
+     fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == 0){
+    moved = fcntl(fd, F_DUPFD_CLOEXEC, min);
+  }
+  close(fd);
+  return moved;
+}
+
+/**
+ * Create every edge in one batch, then open both ends of each and size the
+ * pipe.
+ *
+ * The read end is opened first and kept, so opening the write end never
+ * waits and the occupancy can be sampled. A size the kernel refuses falls
+ * back to the current one, unless the spec asked for it.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] pl         See @ref mkfifo_pipeline.
+ * @param[in]     dir        Private directory.
+ * @param[in]     dir_fd     Descriptor of @p dir.
+ * @retval        0          Opened every edge.
+ * @retval        -1         Failed after a warning.
+ */
+static int
+mkfifo_pipeline_open(struct mkfifo_ctx *const mkfifo_ctx,
+                     struct mkfifo_pipeline *const pl,
+                     const char *const dir,
+                     const int dir_fd){
+  struct mkfifo_pipeline_edge *edge;
+  const char **paths;
+  int *errs;
+  size_t i;
+  int min;
+
+  paths = calloc(pl->nedges + 1, sizeof(*paths));
+  errs = calloc(pl->nedges + 1, sizeof(*errs));
+  for(i = 0; paths && errs && i < pl->nedges; i++){
+    edge = &pl->edges[i];
+    if((edge->path = malloc(strlen(dir) + strlen(edge->name) + 2)) == NULL){
+      break;
+    }
+    sprintf(edge->path, "%s/%s", dir, edge->name);
+    paths[i] = edge->path;
+  }
+  if(i < pl->nedges ||
+     errs == NULL ||
+     mkfifo_create_batch(mkfifo_ctx, pl->nedges, paths, errs) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+  }
+  else{
+    for(i = 0; i < pl->nedges; i++){
+      mkfifo_path_report(mkfifo_ctx, paths[i], errs[i]);
+    }
+  }
+  free(paths);
+  free(errs);
+  min = STDERR_FILENO + 1 + (int)pl->nedges;
+  for(i = 0; i < pl->nedges && mkfifo_ctx->status_code == 0; i++){
+    edge = &pl->edges[i];
+    if((edge->rfd = openat(dir_fd,
+                           edge->name,
+                           O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0 ||
+       (edge->wfd = openat(dir_fd,
+                           edge->name,
+                           O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "open: %s", edge->path);
+      break;
+    }
+#ifdef F_SETPIPE_SZ
+    if(fcntl(edge->wfd,
+             F_SETPIPE_SZ,
+             edge->size ? edge->size : MKFIFO_PIPELINE_PIPE_SIZE) < 0 &&
+       edge->size){
+      mkfifo_warn(mkfifo_ctx, true, "pipe size %d: %s",
+                  edge->size,
+                  edge->path);
+      break;
+    }
+    edge->size = fcntl(edge->wfd, F_GETPIPE_SZ);
+    if(edge->size < 0){
+      edge->size = 0;
+    }
+#endif /* F_SETPIPE_SZ */
+    if((edge->rfd = mkfifo_pipeline_move(edge->rfd, min)) < 0 ||
+       (edge->wfd = mkfifo_pipeline_move(edge->wfd, min)) < 0){
+      mkfifo_warn(mkfifo_ctx, true, "fcntl: %s", edge->path);
+    }
+  }
+  return mkfifo_ctx->status_code == 0 ? 0 : -1;
+}
+
+/**
+ * Close the read ends kept for the edges a stage reads once it is gone, so
+ * a writer still running gets EPIPE instead of waiting forever.
+ *
+ * @param[in,out] pl    See @ref mkfifo_pipeline.
+ * @param[in]     stage Index of the stage.
+ */
+static void
+mkfifo_pipeline_reaped(struct mkfifo_pipeline *const pl,
+                       const size_t stage){
+  size_t i;
+
+  for(i = 0; i < pl->nedges; i++){
+    if(pl->edges[i].to == stage && pl->edges[i].rfd >= 0){
+      close(pl->edges[i].rfd);
+      pl->edges[i].rfd = -1;
+    }
+  }
+}
+
+/**
+ * Start every stage with its edges, then close the write ends kept here so
+ * each reader sees end-of-file once its writer exits.
+ *
+ * A stage inherits the edges it writes or reads from descriptor 3 upwards
+ * in spec order, and gets {edge} and {edge.fd} substituted in its command,
+ * with the paths single-quoted for the shell. A stage that cannot start
+ * gets the status 127 or 126 like in --exec.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in,out] pl         See @ref mkfifo_pipeline.
+ * @param[out]    views      Scratch space for one entry per edge.
+ * @param[in]     mask       Signal mask for the stages.
+ */
+static void
+mkfifo_pipeline_start(struct mkfifo_ctx *const mkfifo_ctx,
+                      struct mkfifo_pipeline *const pl,
+                      struct mkfifo_exec_fifo *const views,
+                      const sigset_t *const mask){
+  struct mkfifo_pipeline_stage *stage;
+  struct mkfifo_pipeline_edge *edge;
+  char shell[] = "/bin/sh";
+  char flag[] = "-c";
+  char *argv[4];
+  size_t i;
+  size_t j;
+  int target;
+  int err;
+
+  for(i = 0; i < pl->nstages; i++){
+    stage = &pl->stages[i];
+    target = STDERR_FILENO + 1;
+    for(j = 0; j < pl->nedges; j++){
+      edge = &pl->edges[j];
+      views[j].name = edge->name;
+      views[j].path = edge->path;
+      views[j].open_flags = -1;
+      views[j].fd = -1;
+      if(edge->from == i || edge->to == i){
+        views[j].open_flags = edge->from == i ? O_WRONLY : O_RDONLY;
+        views[j].fd = edge->from == i ? edge->wfd : edge->rfd;
+        views[j].target = target++;
+      }
+    }
+    argv[0] = shell;
+    argv[1] = flag;
+    argv[3] = NULL;
+    stage->start_ns = mkfifo_clock_ns();
+    if((argv[2] = mkfifo_exec_subst(stage->command,
+                                    views,
+                                    pl->nedges,
+                                    true)) == NULL){
+      err = errno;
+    }
+    else{
+      err = mkfifo_spawn(views, pl->nedges, argv, mask, &stage->pid);
+      free(argv[2]);
+    }
+    if(err != 0){
+      errno = err;
+      mkfifo_warn(mkfifo_ctx, true, "stage %s", stage->name);
+      stage->pid = -1;
+      stage->status = err == ENOENT ? 127 : 126;
+      mkfifo_pipeline_reaped(pl, i);
+    }
+  }
+  for(i = 0; i < pl->nedges; i++){
+    close(pl->edges[i].wfd);
+    pl->edges[i].wfd = -1;
+  }
+}
+
+/**
+ * Sample the occupancy of every edge still read and charge the tick to the
+ * stages it blocks.
+ *
+ * An edge too full for another atomic write blocks its writer on its
+ * reader, and an empty edge blocks its reader on its writer.
+ *
+ * @param[in,out] pl See @ref mkfifo_pipeline.
+ * @param[in]     ns Length of the tick.
+ */
+static void
+mkfifo_pipeline_sample(struct mkfifo_pipeline *const pl,
+                       const uint64_t ns){
+  struct mkfifo_pipeline_stage *from;
+  struct mkfifo_pipeline_stage *to;
+  struct mkfifo_pipeline_edge *edge;
+  size_t i;
+  int queued;
+
+  for(i = 0; i < pl->nstages; i++){
+    pl->stages[i].blocked = false;
+    pl->stages[i].blocking = false;
+  }
+  for(i = 0; i < pl->nedges; i++){
+    edge = &pl->edges[i];
+    if(edge->rfd < 0 || ioctl(edge->rfd, FIONREAD, &queued) != 0){
+      continue;
+    }
+    from = &pl->stages[edge->from];
+    to = &pl->stages[edge->to];
+    edge->samples += 1;
+    edge->bytes_sum += (uint64_t)queued;
+    if((uint64_t)queued > edge->bytes_max){
+      edge->bytes_max = (uint64_t)queued;
+    }
+    if(edge->size > 0 && queued + PIPE_BUF > edge->size){
+      edge->full_ns += ns;
+      from->blocked = true;
+      to->blocking = true;
+    }
+    else if(queued == 0 && from->pid > 0){
+      edge->empty_ns += ns;
+      to->blocked = true;
+      from->blocking = true;
+    }
+  }
+  for(i = 0; i < pl->nstages; i++){
+    if(pl->stages[i].blocked){
+      pl->stages[i].blocked_ns += ns;
+    }
+    if(pl->stages[i].blocking){
+      pl->stages[i].blocking_ns += ns;
+    }
+  }
+}
+
+/**
+ * Reap the stages as they exit, sampling the edges every
+ * @ref MKFIFO_PIPELINE_TICK_MS until all stages are done.
+ *
+ * @param[in,out] pl See @ref mkfifo_pipeline.
+ */
+static void
+mkfifo_pipeline_wait(struct mkfifo_pipeline *const pl){
+  struct mkfifo_pipeline_stage *stage;
+  uint64_t last;
+  uint64_t now;
+  size_t running;
+  size_t i;
+  pid_t pid;
+  int status;
+
+  last = mkfifo_clock_ns();
+  for(;;){
+    running = 0;
+    for(i = 0; i < pl->nstages; i++){
+      stage = &pl->stages[i];
+      if(stage->pid < 0){
+        continue;
+      }
+      while((pid = waitpid(stage->pid, &status, WNOHANG)) < 0 &&
+            errno == EINTR){
+      }
+      if(pid == 0){
+        running += 1;
+        continue;
+      }
+      stage->status = pid > 0 ? mkfifo_exit_status(status) : EXIT_FAILURE;
+      stage->wall_ns = mkfifo_clock_ns() - stage->start_ns;
+      stage->pid = -1;
+      mkfifo_pipeline_reaped(pl, i);
+    }
+    if(running == 0){
+      break;
+    }
+    poll(NULL, 0, MKFIFO_PIPELINE_TICK_MS);
+    now = mkfifo_clock_ns();
+    mkfifo_pipeline_sample(pl, now - last);
+    last = now;
+  }
+}
+
+/**
+ * Print the stages, the edges, and the bottleneck as JSON to STDERR.
+ *
+ * The bottleneck is the stage the others were blocked on the longest,
+ * since the stage blocked the longest is the one waiting for it. It is
+ * null if no stage ever blocked another.
+ *
+ * @param[in] pl See @ref mkfifo_pipeline.
+ */
+static void
+mkfifo_pipeline_report(const struct mkfifo_pipeline *const pl){
+  const struct mkfifo_pipeline_stage *bottleneck;
+  const struct mkfifo_pipeline_stage *stage;
+  const struct mkfifo_pipeline_edge *edge;
+  size_t i;
+
+  bottleneck = NULL;
+  fputs("{\"pipeline\":{\"stages\":[", stderr);
+  for(i = 0; i < pl->nstages; i++){
+    stage = &pl->stages[i];
+    fprintf(stderr,
+            "%s{\"name\":\"%s\",\"status\":%d,\"wall_ns\":%llu,"
+            "\"blocked_ns\":%llu,\"blocking_ns\":%llu}",
+            i ? "," : "",
+            stage->name,
+            stage->status,
+            (unsigned long long)stage->wall_ns,
+            (unsigned long long)stage->blocked_ns,
+            (unsigned long long)stage->blocking_ns);
+    if(stage->blocking_ns > 0 &&
+       (bottleneck == NULL || stage->blocking_ns > bottleneck->blocking_ns)){
+      bottleneck = stage;
+    }
+  }
+  fputs("],\"edges\":[", stderr);
+  for(i = 0; i < pl->nedges; i++){
+    edge = &pl->edges[i];
+    fprintf(stderr,
+            "%s{\"name\":\"%s\",\"from\":\"%s\",\"to\":\"%s\","
+            "\"pipe_size\":%d,\"samples\":%llu,\"avg_bytes\":%llu,"
+            "\"max_bytes\":%llu,\"full_ns\":%llu,\"empty_ns\":%llu}",
+            i ? "," : "",
+            edge->name,
+            edge->from_name,
+            edge->to_name,
+            edge->size,
+            (unsigned long long)edge->samples,
+            (unsigned long long)(edge->samples ?
+                                 edge->bytes_sum / edge->samples : 0),
+            (unsigned long long)edge->bytes_max,
+            (unsigned long long)edge->full_ns,
+            (unsigned long long)edge->empty_ns);
+  }
+  if(bottleneck){
+    fprintf(stderr, "],\"bottleneck\":\"%s\"}}\n", bottleneck->name);
+  }
+  else{
+    fputs("],\"bottleneck\":null}}\n", stderr);
+  }
+}
+
+/**
+ * Run a DAG of commands connected by FIFOs (--pipeline spec).
+ *
+ * Replaces the shell glue around multi-stage FIFO pipelines. The spec,
+ * see @ref mkfifo_pipeline_parse, names the stages and the edges between
+ * them. Every edge becomes a FIFO in a private directory like in --exec,
+ * all created in one batch with the selected (-e engine) and sized to the
+ * SIZE given or @ref MKFIFO_PIPELINE_PIPE_SIZE. The stages then run
+ * concurrently while the edges are sampled, and when the last one exits
+ * the directory is removed and a report is printed, see
+ * @ref mkfifo_pipeline_report.
+ *
+ * The exit status is the one of the last stage in the spec that failed,
+ * like with set -o pipefail, or EXIT_FAILURE for an invalid spec.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     spec       Spec file, or "-" for STDIN.
+ */
+static void
+mkfifo_pipeline(struct mkfifo_ctx *const mkfifo_ctx,
+                const char *const spec){
+  struct mkfifo_exec_fifo *views;
+  struct mkfifo_pipeline pl;
+  sigset_t saved;
+  char *dir;
+  size_t i;
+  int dir_fd;
+  int status;
+
+  memset(&pl, 0, sizeof(pl));
+  dir = NULL;
+  status = 0;
+  if(mkfifo_pipeline_parse(mkfifo_ctx, &pl, spec) == 0 &&
+     mkfifo_pipeline_check(mkfifo_ctx, &pl) == 0 &&
+     (dir_fd = mkfifo_private_dir(mkfifo_ctx, &dir)) >= 0){
+    mkfifo_block_interrupts(&saved);
+    if((views = calloc(pl.nedges + 1, sizeof(*views))) == NULL){
+      mkfifo_warn(mkfifo_ctx, true, "calloc");
+    }
+    else if(mkfifo_pipeline_open(mkfifo_ctx, &pl, dir, dir_fd) == 0){
+      mkfifo_pipeline_start(mkfifo_ctx, &pl, views, &saved);
+      mkfifo_pipeline_wait(&pl);
+      mkfifo_pipeline_report(&pl);
+      for(i = 0; i < pl.nstages; i++){
+        if(pl.stages[i].status != 0){
+          status = pl.stages[i].status;
+        }
+      }
+    }
+    for(i = 0; i < pl.nedges; i++){
+      if(pl.edges[i].rfd >= 0){
+        close(pl.edges[i].rfd);
+      }
+      if(pl.edges[i].wfd >= 0){
+        close(pl.edges[i].wfd);
+      }
+    }
+    free(views);
+    mkfifo_exec_cleanup(mkfifo_ctx, dir, dir_fd);
+    mkfifo_unblock_interrupts(&saved);
+  }
+  if(status != 0){
+    mkfifo_ctx->status_code = status;
+  }
+  for(i = 0; i < pl.nedges; i++){
+    free(pl.edges[i].path);
+  }
+  free(pl.stages);
+  free(pl.edges);
+  free(pl.text);
+  free(dir);
+}
+
+/**
+ * Set up leases for the FIFOs about to be created (--lease ttl).
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[out]    lease      Lease state, pointed to by the context.
+ * @param[in]     ttl_str    Lease duration in seconds.
+ * @param[in]     index      Lease index file (--lease-index file), or NULL.
+ * @param[in]     owner      Process that owns the leases.
+ */
+static void
+mkfifo_parse_lease(struct mkfifo_ctx *const mkfifo_ctx,
+                   struct mkfifo_lease *const lease,
+                   const char *const ttl_str,
+                   const char *const index,
+                   const pid_t owner){
+  long long ttl;
+  char *end;
+
+  memset(lease, 0, sizeof(*lease));
+  errno = 0;
+  ttl = strtoll(ttl_str, &end, 10);
+  if(end == ttl_str || *end != '\0' || errno || ttl < 0){
+    mkfifo_warn(mkfifo_ctx, false, "invalid lease: %s", ttl_str);
+  }
+  else if(index == NULL){
+    mkfifo_warn(mkfifo_ctx, false, "--lease needs --lease-index");
+  }
+  else if((lease->cwd = getcwd(NULL, 0)) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "getcwd");
+  }
+  else{
+    lease->index = index;
+    lease->expiry = (long long)time(NULL) + ttl;
+    lease->owner = (long)owner;
+    mkfifo_ctx->lease = lease;
+  }
+}
+
+/**
+ * Parse an absolute octal mode such as 600 or 0644.
+ *
+ * @param[in]  mode_str Mode string given in the (-m mode) argument.
+ * @param[out] mode     Parsed permission bits.
+ * @retval     true     @p mode_str was one to four octal digits.
+ * @retval     false    Symbolic or invalid mode.
+ */
+static bool
+mkfifo_parse_octal_mode(const char *const mode_str,
+                        mode_t *const mode){
+  mode_t octal;
+  size_t i;
+
+  octal = 0;
+  for(i = 0; mode_str[i] != '\0'; i++){
+    if(i == 4 || mode_str[i] < '0' || mode_str[i] > '7'){
+      return false;
+    }
+    octal = (mode_t)(octal * 8 + (mode_t)(mode_str[i] - '0'));
+  }
+  if(i == 0){
+    return false;
+  }
+  *mode = octal;
+  return true;
+}
+
+/**
+ * Parse a symbolic mode as chmod(1) does, starting from a=rw (0666) with a
+ * zero umask, so "=rw" gives 0666 whatever the process umask is. Parsed here
+ * rather than with setmode(3), which briefly sets the process umask to 0 to
+ * read it and so races other threads.
+ *
+ * @param[in]  mode_str Comma-separated clauses of [ugoa]* followed by one or
+ *                      more actions, each [+-=] and then [rwxXst]* or one
+ *                      of [ugo].
+ * @param[out] mode     Resulting permission bits.
+ * @retval     true     @p mode_str was a valid symbolic mode.
+ * @retval     false    Invalid mode, @p mode is left alone.
+ */
+static bool
+mkfifo_parse_symbolic_mode(const char *const mode_str,
+                           mode_t *const mode){
+  const char *p;
+  mode_t result;
+  mode_t who;
+  mode_t perm;
+  char op;
+
+  result = 0666;
+  p = mode_str;
+  for(;;){
+    who = 0;
+    for(; *p == 'u' || *p == 'g' || *p == 'o' || *p == 'a'; p++){
+      switch(*p){
+      case 'u':
+        who |= S_ISUID | S_IRWXU;
+        break;
+      case 'g':
+        who |= S_ISGID | S_IRWXG;
+        break;
+      case 'o':
+        who |= S_IRWXO;
+        break;
+      default:
+        who |= 07777;
+        break;
+      }
+    }
+    if(who == 0){
+      who = 07777;
+    }
+    if(*p != '+' && *p != '-' && *p != '='){
+      return false;
+    }
+    while(*p == '+' || *p == '-' || *p == '='){
+      op = *p++;
+      perm = 0;
+      if(*p == 'u' || *p == 'g' || *p == 'o'){
+        /* Copy the current bits of one class to every class. */
+        perm = (mode_t)((result >> (*p == 'u' ? 6 : *p == 'g' ? 3 : 0) &
+                         07) * 0111);
+        p++;
+      }
+      for(; *p != '\0' && strchr("rwxXst", *p) != NULL; p++){
+        switch(*p){
+        case 'r':
+          perm |= 0444;
+          break;
+        case 'w':
+          perm |= 0222;
+          break;
+        case 'x':
+          perm |= 0111;
+          break;
+        case 'X':
+          /* Search only if some class can already search. */
+          if((result & 0111) != 0){
+            perm |= 0111;
+          }
+          break;
+        case 's':
+          perm |= S_ISUID | S_ISGID;
+          break;
+        default:
+          perm |= S_ISVTX;
+          break;
+        }
+      }
+      perm &= who;
+      if(op == '+'){
+        result |= perm;
+      }
+      else if(op == '-'){
+        result &= (mode_t)~perm;
+      }
+      else{
+        result = (mode_t)((result & ~who) | perm);
+      }
+    }
+    if(*p == '\0'){
+      break;
+    }
+    if(*p++ != ','){
+      return false;
+    }
+  }
+  *mode = result;
+  return true;
+}
+
+/**
+ * Parse mode string given in the (-m mode) argument.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
+ * @param[in]     mode_str   Same as chmod utility.
+ */
+static void
+mkfifo_parse_mode(struct mkfifo_ctx *const mkfifo_ctx,
+                  const char *const mode_str){
+  int err;
+
+  MKFIFO_PROBE1(parse_mode_entry, mode_str);
+  mkfifo_ctx->mode_set = true;
+  err = 0;
+  if(!mkfifo_parse_octal_mode(mode_str, &mkfifo_ctx->mode) &&
+     !mkfifo_parse_symbolic_mode(mode_str, &mkfifo_ctx->mode)){
+    err = EINVAL;
+    mkfifo_warn(mkfifo_ctx, false, "invalid file mode: %s", mode_str);
+  }
+  MKFIFO_PROBE3(parse_mode_return, mode_str, mkfifo_ctx->mode, err);
+}
+
+/**
+ * Credentials of a client of @ref mkfifo_daemon, taken when it connected.
+ */
+struct mkfifo_daemon_peer{
+  /**
+   * Effective user ID of the client.
+   */
+  uid_t uid;
+
+  /**
+   * Effective group ID of the client.
+   */
+  gid_t gid;
+};
+
+/**
+ * State of @ref mkfifo_daemon.
+ */
+struct mkfifo_daemon{
+  /**
+   * See @ref mkfifo_ctx. The mode changes with every request entry.
+   */
+  struct mkfifo_ctx *mkfifo_ctx;
+
+  /**
+   * Directories kept open across requests.
+   */
+  struct mkfifo_dircache cache;
+
+  /**
+   * Listening socket first, then one entry per client.
+   */
+  struct pollfd *pfds;
+
+  /**
+   * Credentials of each client, indexed like @ref pfds.
+   */
+  struct mkfifo_daemon_peer *peers;
+
+  /**
+   * Client of the current request.
+   */
+  struct mkfifo_daemon_peer peer;
+
+  /**
+   * Effective user ID of the daemon.
+   */
+  uid_t euid;
+
+  /**
+   * Number of entries in @ref pfds.
+   */
+  size_t npfds;
+
+  /**
+   * Allocated entries in @ref pfds.
+   */
+  size_t cap;
+
+  /**
+   * Current request, NUL-terminated.
+   */
+  char *msg;
+
+  /**
+   * Reply to the current request.
+   */
+  char *reply;
+
+  /**
+   * Descriptors passed back with the reply.
+   */
+  int fds[MKFIFO_DAEMON_FDS_MAX];
+
+  /**
+   * Number of entries in @ref fds.
+   */
+  size_t nfds;
+
+  /**
+   * Mode used for entries with mode "-".
+   */
+  mode_t mode;
+
+  /**
+   * Apply @ref mode exactly, set when started with (-m mode).
+   */
+  bool mode_set;
+
+  /**
+   * Set by a (q) entry to stop after replying.
+   */
+  bool stop;
+};
+
+/**
+ * Parse the mode and owner fields of a request entry.
+ *
+ * @param[in]  field Fields starting at the mode, modified in place.
+ * @param[out] mode  Octal mode, or (mode_t)-1 for "-".
+ * @param[out] uid   Owner, or (uid_t)-1 for "-".
+ * @param[out] gid   Group, or (gid_t)-1 for "-".
+ * @return           Path following the fields, or NULL if malformed.
+ */
+static char *
+mkfifo_daemon_fields(char *field,
+                     mode_t *const mode,
+                     uid_t *const uid,
+                     gid_t *const gid){
+  unsigned long id;
+  char *end;
+
+  if((end = strchr(field, ' ')) == NULL){
+    return NULL;
+  }
+  *end = '\0';
+  *mode = (mode_t)-1;
+  if(strcmp(field, "-") != 0 && !mkfifo_parse_octal_mode(field, mode)){
+    return NULL;
+  }
+  field = end + 1;
+  *uid = (uid_t)-1;
+  *gid = (gid_t)-1;
+  if(field[0] == '-' && field[1] == ' '){
+    field += 2;
+  }
+  else{
+    errno = 0;
+    id = strtoul(field, &end, 10);
+    if(end == field || *end != ':' || errno || id >= (uid_t)-1){
+      return NULL;
+    }
+    *uid = (uid_t)id;
+    field = end + 1;
+    id = strtoul(field, &end, 10);
+    if(end == field || *end != ' ' || errno || id >= (gid_t)-1){
+      return NULL;
+    }
+    *gid = (gid_t)id;
+    field = end + 1;
+  }
+  return *field == '\0' ? NULL : field;
+}
+
+/**
+ * Directory descriptor and relative name for a request path.
+ *
+ * @param[in,out] daemon See @ref mkfifo_daemon.
+ * @param[in]     path   Path from the request.
+ * @param[out]    base   Part of @p path relative to the result.
+ * @return               Cached directory descriptor, or AT_FDCWD with
+ *                       @p base set to @p path if it cannot be cached.
+ */
+static int
+mkfifo_daemon_at(struct mkfifo_daemon *const daemon,
+                 const char *const path,
+                 const char **const base){
+  int dir_fd;
+
+  if((dir_fd = mkfifo_dircache_get(&daemon->cache, path, base)) == -1){
+    *base = path;
+    return AT_FDCWD;
+  }
+  return dir_fd;
+}
+
+/**
+ * Create a FIFO for a (c) or (o) entry, then change its owner and open its
+ * read end as requested. A FIFO created here gets removed again if a later
+ * step fails, so the entry either fully succeeds or leaves nothing behind.
+ *
+ * @param[in,out] daemon See @ref mkfifo_daemon.
+ * @param[in]     path   Path to new FIFO file.
+ * @param[in]     mode   See @ref mkfifo_daemon_fields.
+ * @param[in]     uid    See @ref mkfifo_daemon_fields.
+ * @param[in]     gid    See @ref mkfifo_daemon_fields.
+ * @param[in]     want_fd Pass back a descriptor for reading.
+ * @retval        0      Created the FIFO.
+ * @retval        >0     errno describing the failure.
+ */
+static int
+mkfifo_daemon_create(struct mkfifo_daemon *const daemon,
+                     const char *const path,
+                     const mode_t mode,
+                     const uid_t uid,
+                     const gid_t gid,
+                     const bool want_fd){
+  struct mkfifo_ctx *const mkfifo_ctx = daemon->mkfifo_ctx;
+  const char *base;
+  int dir_fd;
+  int err;
+  int fd;
+
+  if(want_fd && daemon->nfds == MKFIFO_DAEMON_FDS_MAX){
+    return EMFILE;
+  }
+  if(mode == (mode_t)-1){
+    mkfifo_ctx->mode = daemon->mode;
+    mkfifo_ctx->mode_set = daemon->mode_set;
+  }
+  else{
+    mkfifo_ctx->mode = mode;
+    mkfifo_ctx->mode_set = true;
+  }
+  if((err = mkfifo_path(mkfifo_ctx,
+                        &daemon->cache,
+                        path,
+                        &daemon->cache.syscalls)) != 0 ||
+     (uid == (uid_t)-1 && !want_fd)){
+    return err;
+  }
+  dir_fd = mkfifo_daemon_at(daemon, path, &base);
+  if(uid != (uid_t)-1){
+    daemon->cache.syscalls += 1;
+    if(fchownat(dir_fd, base, uid, gid, AT_SYMLINK_NOFOLLOW) != 0){
+      err = errno;
+    }
+  }
+  if(err == 0 && want_fd){
+    daemon->cache.syscalls += 1;
+    fd = openat(dir_fd, base, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0){
+      err = errno;
+    }
+    else{
+      daemon->fds[daemon->nfds++] = fd;
+    }
+  }
+  if(err != 0){
+    daemon->cache.syscalls += 1;
+    unlinkat(dir_fd, base, 0);
+  }
+  return err;
+}
+
+/**
+ * Remove a FIFO for a (u) entry. Anything other than a FIFO is left alone.
+ *
+ * @param[in,out] daemon See @ref mkfifo_daemon.
+ * @param[in]     path   FIFO to remove.
+ * @retval        0      Removed the FIFO.
+ * @retval        >0     errno describing the failure, EINVAL if @p path is
+ *                       not a FIFO.
+ */
+static int
+mkfifo_daemon_remove(struct mkfifo_daemon *const daemon,
+                     const char *const path){
+  const char *base;
+  struct stat sb;
+  int dir_fd;
+
+  dir_fd = mkfifo_daemon_at(daemon, path, &base);
+  daemon->cache.syscalls += 2;
+  if(fstatat(dir_fd, base, &sb, AT_SYMLINK_NOFOLLOW) != 0){
+    return errno;
+  }
+  if(!S_ISFIFO(sb.st_mode)){
+    return EINVAL;
+  }
+  return unlinkat(dir_fd, base, 0) == 0 ? 0 : errno;
+}
+
+/**
+ * Carry out one request entry.
+ *
+ * @param[in,out] daemon See @ref mkfifo_daemon.
+ * @param[in,out] line   NUL-terminated entry, modified in place.
+ * @retval        0      Entry succeeded.
+ * @retval        >0     errno describing the failure.
+ */
+static int
+mkfifo_daemon_entry(struct mkfifo_daemon *const daemon,
+                    char *const line){
+  char *path;
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  int err;
+
+  if(line[0] == 'q' && line[1] == '\0'){
+    daemon->stop = true;
+    return 0;
+  }
+  if(line[1] != ' ' ||
+     (path = mkfifo_daemon_fields(&line[2], &mode, &uid, &gid)) == NULL){
+    return EINVAL;
+  }
+  if(uid != (uid_t)-1 &&
+     daemon->peer.uid != 0 &&
+     (uid != daemon->peer.uid || gid != daemon->peer.gid)){
+    return EPERM;
+  }
+  switch(line[0]){
+    case 'c':
+    case 'o':
+      err = mkfifo_daemon_create(daemon, path, mode, uid, gid, line[0] == 'o');
+      if(daemon->mkfifo_ctx->stats){
+        mkfifo_stats_count(daemon->mkfifo_ctx->stats, err);
+      }
+      return err;
+    case 'u':
+      return mkfifo_daemon_remove(daemon, path);
+    default:
+      return EINVAL;
+  }
+}
+
+/**
+ * Carry out every entry of a request and send the reply. A client running
+ * as another user than the daemon, other than root, gets EPERM for every
+ * entry, so a client never acts with more than its own credentials.
+ *
+ * @param[in,out] daemon See @ref mkfifo_daemon.
+ * @param[in]     fd     Client socket.
+ * @param[in]     len    Length of the request in @ref mkfifo_daemon.msg.
+ * @retval        0      Replied.
+ * @retval        -1     Failed to send the reply, including when the
+ *                       client's socket cannot take it right away.
+ */
+static int
+mkfifo_daemon_request(struct mkfifo_daemon *const daemon,
+                      const int fd,
+                      const size_t len){
+  union{
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * MKFIFO_DAEMON_FDS_MAX)];
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  char *line;
+  char *next;
+  size_t reply_len;
+  size_t i;
+  int denied;
+  int rc;
+
+  daemon->msg[len] = '\0';
+  daemon->nfds = 0;
+  reply_len = 0;
+  denied = 0;
+  if(daemon->peer.uid != 0 && daemon->peer.uid != daemon->euid){
+    denied = EPERM;
+  }
+  for(line = daemon->msg; line < daemon->msg + len; line = next){
+    if((next = memchr(line, '\n', len - (size_t)(line - daemon->msg)))){
+      *next++ = '\0';
+    }
+    else{
+      next = daemon->msg + len;
+    }
+    if(line[0] == '\0' && line + 1 >= next){
+      continue;
+    }
+    reply_len += (size_t)sprintf(&daemon->reply[reply_len],
+                                 "%d\n",
+                                 strlen(line) + 1 < (size_t)(next - line) ?
+                                 EINVAL :
+                                 denied ?
+                                 denied : mkfifo_daemon_entry(daemon, line));
+  }
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = daemon->reply;
+  iov.iov_len = reply_len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if(daemon->nfds > 0){
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * daemon->nfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * daemon->nfds);
+    memcpy(CMSG_DATA(cmsg), daemon->fds, sizeof(int) * daemon->nfds);
+  }
+  /* A client that stopped reading must not stall the others. */
+  rc = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0 ? -1 : 0;
+  for(i = 0; i < daemon->nfds; i++){
+    close(daemon->fds[i]);
+  }
+  return rc;
+}
+
+/**
+ * Remove a socket file left behind by a daemon that is no longer running.
+ *
+ * @param[in] addr Socket address that bind() reported as in use.
+ * @retval    0    Removed the stale socket.
+ * @retval    -1   Something is listening, or the path is not a socket,
+ *                 with errno set to EADDRINUSE.
+ */
+static int
+mkfifo_daemon_unlink_stale(const struct sockaddr_un *const addr){
+  int probe;
+  int rc;
+
+  rc = -1;
+  if((probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) >= 0){
+    if(connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) != 0 &&
+       errno == ECONNREFUSED){
+      rc = unlink(addr->sun_path);
+    }
+    close(probe);
+  }
+  errno = EADDRINUSE;
+  return rc;
+}
+
+/**
+ * Bind and listen on the daemon socket.
+ *
+ * @param[in] path Socket path.
+ * @retval    >=0  Listening socket.
+ * @retval    -1   Failed with errno set.
+ */
+static int
+mkfifo_daemon_listen(const char *const path){
+  struct sockaddr_un addr;
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path)){
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0){
+    return -1;
+  }
+  if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 &&
+      (errno != EADDRINUSE ||
+       mkfifo_daemon_unlink_stale(&addr) != 0 ||
+       bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) ||
+     listen(fd, SOMAXCONN) != 0){
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Get the credentials of a connected client.
+ *
+ * @param[in]  fd   Client socket.
+ * @param[out] peer Credentials the client connected with.
+ * @retval     0    Got the credentials.
+ * @retval     -1   Failed with errno set.
+ */
+static int
+mkfifo_daemon_getpeer(const int fd,
+                      struct mkfifo_daemon_peer *const peer){
+#ifdef __linux__
+  struct ucred cred;
+  socklen_t len;
+
+  len = sizeof(cred);
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0){
+    return -1;
+  }
+  peer->uid = cred.uid;
+  peer->gid = cred.gid;
+  return 0;
+#else /* !(__linux__) */
+  return getpeereid(fd, &peer->uid, &peer->gid);
+#endif /* __linux__ */
+}
+
+/**
+ * Accept a client and add it to the poll set along with its credentials.
+ *
+ * @param[in,out] daemon See @ref mkfifo_daemon.
+ */
+static void
+mkfifo_daemon_accept(struct mkfifo_daemon *const daemon){
+  struct mkfifo_daemon_peer *peers;
+  struct pollfd *pfds;
+  int fd;
+
+  if((fd = accept4(daemon->pfds[0].fd, NULL, NULL, SOCK_CLOEXEC)) < 0){
+    return;
+  }
+  if(daemon->npfds == daemon->cap){
+    pfds = realloc(daemon->pfds, daemon->cap * 2 * sizeof(*pfds));
+    if(pfds != NULL){
+      daemon->pfds = pfds;
+    }
+    peers = realloc(daemon->peers, daemon->cap * 2 * sizeof(*peers));
+    if(peers != NULL){
+      daemon->peers = peers;
+    }
+    if(pfds == NULL || peers == NULL){
+      close(fd);
+      return;
+    }
+    daemon->cap *= 2;
+  }
+  if(mkfifo_daemon_getpeer(fd, &daemon->peers[daemon->npfds]) != 0){
+    close(fd);
+    return;
+  }
+  daemon->pfds[daemon->npfds].fd = fd;
+  daemon->pfds[daemon->npfds].events = POLLIN;
+  daemon->pfds[daemon->npfds].revents = 0;
+  daemon->npfds += 1;
+}
+
 /**
- * Declare some functions with extern linkage, allowing the test suite to call
- * those functions.
+ * Serve FIFO creation and removal requests on a Unix socket until a (q)
+ * entry arrives (--daemon socket).
+ *
+ * Each request is one SOCK_SEQPACKET message of newline-separated entries:
+ *   c MODE OWNER PATH  create a FIFO
+ *   o MODE OWNER PATH  create a FIFO and pass back a read descriptor
+ *   u MODE OWNER PATH  remove a FIFO
+ *   q                  stop after replying
+ * MODE is an octal mode applied exactly, or "-" for the (-m mode) the
+ * daemon was started with, else 0666 under the umask.
+ * OWNER is UID:GID, or "-" to keep the daemon's. Paths run to the end of
+ * the line.
+ * Only clients running as the daemon's user or as root get served, going
+ * by SO_PEERCRED, and only root may give an OWNER other than its own. Any
+ * other entry fails with EPERM.
+ * The reply is one message with a decimal errno, 0 on success, per
+ * non-empty entry, carrying the descriptors of successful (o) entries in
+ * order as SCM_RIGHTS. A client whose socket cannot take the reply right
+ * away gets disconnected.
+ *
+ * The directory cache stays warm across requests, so a scheduler creating
+ * and removing FIFOs in the same job directories pays one mkfifoat() or
+ * unlinkat() per FIFO and no process creation.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
  */
-# define LINKAGE extern
-# include "../test/test.h"
-#else /* !(TEST) */
+static void
+mkfifo_daemon(struct mkfifo_ctx *const mkfifo_ctx){
+  struct mkfifo_daemon *daemon;
+  ssize_t len;
+  size_t i;
+  int fd;
+
+  if((daemon = calloc(1, sizeof(*daemon))) == NULL ||
+     (daemon->msg = malloc(MKFIFO_DAEMON_MSG_MAX + 1)) == NULL ||
+     (daemon->reply = malloc(MKFIFO_DAEMON_MSG_MAX * 2 + 2)) == NULL ||
+     (daemon->pfds = malloc(8 * sizeof(*daemon->pfds))) == NULL ||
+     (daemon->peers = malloc(8 * sizeof(*daemon->peers))) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+  }
+  else if((fd = mkfifo_daemon_listen(mkfifo_ctx->daemon_socket)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "listen: %s", mkfifo_ctx->daemon_socket);
+  }
+  else{
+    daemon->mkfifo_ctx = mkfifo_ctx;
+    daemon->cache.revalidate = true;
+    daemon->mode = mkfifo_ctx->mode;
+    daemon->mode_set = mkfifo_ctx->mode_set;
+    daemon->euid = geteuid();
+    daemon->cap = 8;
+    daemon->pfds[0].fd = fd;
+    daemon->pfds[0].events = POLLIN;
+    daemon->npfds = 1;
+    while(!daemon->stop){
+      if(poll(daemon->pfds, (nfds_t)daemon->npfds, -1) < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        mkfifo_warn(mkfifo_ctx, true, "poll");
+        break;
+      }
+      for(i = daemon->npfds - 1; i > 0 && !daemon->stop; i--){
+        if(daemon->pfds[i].revents == 0){
+          continue;
+        }
+        fd = daemon->pfds[i].fd;
+        daemon->peer = daemon->peers[i];
+        len = recv(fd, daemon->msg, MKFIFO_DAEMON_MSG_MAX + 1, 0);
+        if(len > 0 && len <= MKFIFO_DAEMON_MSG_MAX &&
+           mkfifo_daemon_request(daemon, fd, (size_t)len) == 0){
+          continue;
+        }
+        close(fd);
+        daemon->npfds -= 1;
+        daemon->pfds[i] = daemon->pfds[daemon->npfds];
+        daemon->peers[i] = daemon->peers[daemon->npfds];
+      }
+      if(daemon->pfds[0].revents & POLLIN && !daemon->stop){
+        mkfifo_daemon_accept(daemon);
+      }
+    }
+    for(i = 0; i < daemon->npfds; i++){
+      close(daemon->pfds[i].fd);
+    }
+    unlink(mkfifo_ctx->daemon_socket);
+    mkfifo_dircache_free(&daemon->cache);
+    mkfifo_ctx->create_syscalls += daemon->cache.syscalls;
+    if(mkfifo_ctx->stats){
+      mkfifo_ctx->stats->dir_ns += daemon->cache.dir_ns;
+    }
+  }
+  if(daemon){
+    free(daemon->peers);
+    free(daemon->pfds);
+    free(daemon->reply);
+    free(daemon->msg);
+    free(daemon);
+  }
+}
+
 /**
- * Define all functions as static when not testing.
+ * Append the collected lease lines to the lease index.
+ *
+ * Writers hold a shared flock() so they can append concurrently, while
+ * @ref mkfifo_gc takes it exclusively to rewrite the index in place.
+ *
+ * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
  */
-# define LINKAGE static
-#endif /* TEST */
+static void
+mkfifo_lease_flush(struct mkfifo_ctx *const mkfifo_ctx){
+  struct mkfifo_lease *const lease = mkfifo_ctx->lease;
+  struct mkfifo_pump_stats stats;
+  int fd;
+
+  if(lease->len == 0){
+    return;
+  }
+  fd = open(lease->index, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if(fd < 0){
+    mkfifo_warn(mkfifo_ctx, true, "open: %s", lease->index);
+    return;
+  }
+  memset(&stats, 0, sizeof(stats));
+  if(flock(fd, LOCK_SH) != 0 ||
+     mkfifo_write_all(fd, lease->buf, lease->len, &stats) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "write: %s", lease->index);
+  }
+  close(fd);
+  lease->len = 0;
+}
 
 /**
- * mkfifo utility context.
+ * qsort() and bsearch() comparison for @ref mkfifo_gc_inode.
+ *
+ * @param[in] a First inode.
+ * @param[in] b Second inode.
+ * @return      Negative, zero, or positive like strcmp().
  */
-struct mkfifo_ctx{
-  /**
-   * Exit status set to one of the following values.
-   *   - EXIT_SUCCESS
-   *   - EXIT_FAILURE
-   */
-  int status_code;
+static int
+mkfifo_gc_inode_cmp(const void *const a,
+                    const void *const b){
+  const struct mkfifo_gc_inode *const x = a;
+  const struct mkfifo_gc_inode *const y = b;
 
-  /**
-   * File permissions used in mkfifo().
-   */
-  mode_t mode;
-};
+  if(x->dev != y->dev){
+    return x->dev < y->dev ? -1 : 1;
+  }
+  return (x->ino > y->ino) - (x->ino < y->ino);
+}
 
 /**
- * Print an error message to STDERR and set an error status code.
+ * Collect every FIFO held open by any process visible in /proc.
+ *
+ * Processes whose descriptors cannot be read, usually those of other users,
+ * are skipped, so the collector should run as the user owning the jobs.
+ *
+ * @param[out] inodes Sorted array to free, or NULL if none are open.
+ * @param[out] n      Number of entries in @p inodes.
+ * @retval     0      Collected the open FIFOs.
+ * @retval     -1     /proc is not available or out of memory, errno set.
+ */
+static int
+mkfifo_gc_open_fifos(struct mkfifo_gc_inode **const inodes,
+                     size_t *const n){
+  struct mkfifo_gc_inode *grown;
+  struct dirent *pid_ent;
+  struct dirent *fd_ent;
+  DIR *proc_dp;
+  DIR *fd_dp;
+  struct stat sb;
+  char fd_dir[PATH_MAX];
+  size_t cap;
+
+  *inodes = NULL;
+  *n = 0;
+  cap = 0;
+  if((proc_dp = opendir("/proc")) == NULL){
+    return -1;
+  }
+  while((pid_ent = readdir(proc_dp))){
+    if(pid_ent->d_name[0] < '1' || pid_ent->d_name[0] > '9'){
+      continue;
+    }
+    snprintf(fd_dir, sizeof(fd_dir), "/proc/%s/fd", pid_ent->d_name);
+    if((fd_dp = opendir(fd_dir)) == NULL){
+      continue;
+    }
+    while((fd_ent = readdir(fd_dp))){
+      if(fd_ent->d_name[0] == '.' ||
+         fstatat(dirfd(fd_dp), fd_ent->d_name, &sb, 0) != 0 ||
+         !S_ISFIFO(sb.st_mode)){
+        continue;
+      }
+      if(*n == cap){
+        cap = cap ? cap * 2 : 64;
+        if((grown = realloc(*inodes, cap * sizeof(*grown))) == NULL){
+          closedir(fd_dp);
+          closedir(proc_dp);
+          free(*inodes);
+          *inodes = NULL;
+          return -1;
+        }
+        *inodes = grown;
+      }
+      (*inodes)[*n].dev = sb.st_dev;
+      (*inodes)[*n].ino = sb.st_ino;
+      *n += 1;
+    }
+    closedir(fd_dp);
+  }
+  closedir(proc_dp);
+  if(*n > 0){
+    qsort(*inodes, *n, sizeof(**inodes), mkfifo_gc_inode_cmp);
+  }
+  return 0;
+}
+
+/**
+ * Open the directory holding a leased FIFO, without following a symlink
+ * that took the place of the directory.
+ *
+ * @param[in]  path Path from a lease line.
+ * @param[out] base Last component of @p path, relative to the result.
+ * @retval     >=0  Directory descriptor.
+ * @retval     -1   Failed with errno set.
+ */
+static int
+mkfifo_gc_parent(const char *const path,
+                 const char **const base){
+  char dir[PATH_MAX];
+  const char *slash;
+  size_t len;
+
+  if((slash = strrchr(path, '/')) == NULL){
+    *base = path;
+    return open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  *base = slash + 1;
+  len = slash == path ? 1 : (size_t)(slash - path);
+  if(len >= sizeof(dir)){
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(dir, path, len);
+  dir[len] = '\0';
+  return open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+/**
+ * Check whether the owner of a lease is still running, which renews the
+ * lease. A PID of 1 or less means the creator had no owner left.
+ *
+ * @param[in] owner PID from a lease line.
+ * @return          true if @p owner exists.
+ */
+static bool
+mkfifo_gc_owner_alive(const long owner){
+  if(owner <= 1 || owner != (long)(pid_t)owner){
+    return false;
+  }
+  return kill((pid_t)owner, 0) == 0 || errno == EPERM;
+}
+
+/**
+ * Decide what to do with one lease line.
+ *
+ * The FIFO gets checked and removed relative to one descriptor for its
+ * directory, so a directory swapped for a symlink in between cannot
+ * redirect the unlink to another FIFO.
+ *
+ * @param[in]     line    NUL-terminated lease line without the newline.
+ * @param[in]     now     Current wall clock time in seconds.
+ * @param[in,out] inodes  Open FIFOs, collected on first use.
+ * @param[in,out] ninodes Number of entries in @p inodes, or SIZE_MAX until
+ *                        collected.
+ * @retval        0       Keep the lease: not expired, its owner is still
+ *                        running, or the FIFO is open.
+ * @retval        1       Removed the expired FIFO.
+ * @retval        2       Drop the lease: the FIFO is gone or was replaced.
+ * @retval        -1      Removing the FIFO failed or /proc is not
+ *                        available, keep the lease with errno set.
+ */
+static int
+mkfifo_gc_line(const char *const line,
+               const long long now,
+               struct mkfifo_gc_inode **const inodes,
+               size_t *const ninodes){
+  struct mkfifo_gc_inode key;
+  unsigned long long dev;
+  unsigned long long ino;
+  const char *base;
+  long long expiry;
+  struct stat sb;
+  int errno_save;
+  long owner;
+  int path_at;
+  int dir_fd;
+  int rc;
+
+  if(sscanf(line, "%lld %ld %llu %llu %n",
+            &expiry, &owner, &dev, &ino, &path_at) != 4){
+    return 2;
+  }
+  if(expiry > now){
+    return 0;
+  }
+  if((dir_fd = mkfifo_gc_parent(&line[path_at], &base)) < 0){
+    return errno == ENOENT || errno == ENOTDIR || errno == ELOOP ? 2 : -1;
+  }
+  if(fstatat(dir_fd, base, &sb, AT_SYMLINK_NOFOLLOW) != 0 ||
+     !S_ISFIFO(sb.st_mode) ||
+     (unsigned long long)sb.st_dev != dev ||
+     (unsigned long long)sb.st_ino != ino){
+    rc = 2;
+  }
+  else if(mkfifo_gc_owner_alive(owner)){
+    rc = 0;
+  }
+  else if(*ninodes == SIZE_MAX && mkfifo_gc_open_fifos(inodes, ninodes) != 0){
+    *ninodes = SIZE_MAX;
+    rc = -1;
+  }
+  else{
+    key.dev = sb.st_dev;
+    key.ino = sb.st_ino;
+    if(*ninodes > 0 &&
+       bsearch(&key, *inodes, *ninodes, sizeof(key), mkfifo_gc_inode_cmp)){
+      rc = 0;
+    }
+    else{
+      rc = unlinkat(dir_fd, base, 0) == 0 ? 1 : -1;
+    }
+  }
+  errno_save = errno;
+  close(dir_fd);
+  errno = errno_save;
+  return rc;
+}
+
+/**
+ * Remove the FIFOs whose lease expired, whose owner exited, and that no
+ * process has open (--gc), then rewrite the lease index without the
+ * leases that are done.
+ *
+ * Only the index gets read, never the directories holding the FIFOs, and
+ * /proc only gets scanned once an expired lease is found. The index is
+ * rewritten in place under an exclusive flock(), so writers appending
+ * under a shared lock never lose a lease.
  *
  * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
- * @param[in]     errno_msg  Include a standard message describing errno.
- * @param[in]     fmt        Format string used by vwarn.
+ * @param[in]     index      Lease index file.
  */
 static void
-mkfifo_warn(struct mkfifo_ctx *const mkfifo_ctx,
-            const bool errno_msg,
-            const char *const fmt, ...){
-  va_list ap;
+mkfifo_gc(struct mkfifo_ctx *const mkfifo_ctx,
+          const char *const index){
+  struct mkfifo_gc_inode *inodes;
+  struct mkfifo_pump_stats stats;
+  size_t ninodes;
+  size_t removed;
+  size_t kept;
+  struct stat sb;
+  long long now;
+  char *line;
+  char *next;
+  char *buf;
+  char *out;
+  int rc;
+  int fd;
 
-  mkfifo_ctx->status_code = EXIT_FAILURE;
-  va_start(ap, fmt);
-  if(errno_msg){
-    vwarn(fmt, ap);
+  if((fd = open(index, O_RDWR | O_CLOEXEC)) < 0){
+    mkfifo_warn(mkfifo_ctx, true, "open: %s", index);
+    return;
+  }
+  buf = NULL;
+  if(flock(fd, LOCK_EX) != 0 || fstat(fd, &sb) != 0){
+    mkfifo_warn(mkfifo_ctx, true, "lock: %s", index);
+  }
+  else if((buf = malloc((size_t)sb.st_size + 1)) == NULL){
+    mkfifo_warn(mkfifo_ctx, true, "malloc");
+  }
+  else if(pread(fd, buf, (size_t)sb.st_size, 0) != sb.st_size){
+    mkfifo_warn(mkfifo_ctx, true, "read: %s", index);
   }
   else{
-    vwarnx(fmt, ap);
+    buf[sb.st_size] = '\0';
+    now = (long long)time(NULL);
+    inodes = NULL;
+    ninodes = SIZE_MAX;
+    removed = 0;
+    kept = 0;
+    out = buf;
+    for(line = buf; *line; line = next){
+      if((next = strchr(line, '\n')) == NULL){
+        break;
+      }
+      *next++ = '\0';
+      rc = mkfifo_gc_line(line, now, &inodes, &ninodes);
+      if(rc < 0){
+        mkfifo_warn(mkfifo_ctx, true, "cannot collect: %s", line);
+      }
+      if(rc <= 0){
+        memmove(out, line, (size_t)(next - line));
+        out += next - line;
+        out[-1] = '\n';
+        kept += 1;
+      }
+      removed += rc == 1;
+    }
+    memset(&stats, 0, sizeof(stats));
+    if(lseek(fd, 0, SEEK_SET) != 0 ||
+       mkfifo_write_all(fd, buf, (size_t)(out - buf), &stats) != 0 ||
+       ftruncate(fd, out - buf) != 0){
+      mkfifo_warn(mkfifo_ctx, true, "write: %s", index);
+    }
+    fprintf(stderr,
+            "%s: %s: %zu removed, %zu kept\n",
+            MKFIFO_PROGNAME,
+            index,
+            removed,
+            kept);
+    free(inodes);
   }
-  va_end(ap);
+  free(buf);
+  close(fd);
 }
 
+#ifdef __linux__
 /**
- * Create a new FIFO using mkfifo().
+ * Open one perf_event counter for this process, disabled.
  *
- * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
- * @param[in]     path       Path to new FIFO file to create.
+ * Retries counting user space only, which is all an unprivileged process
+ * gets under perf_event_paranoid 2.
+ *
+ * @param[in] type   PERF_TYPE_HARDWARE or PERF_TYPE_SOFTWARE.
+ * @param[in] config Event within @p type.
+ * @return           Counter descriptor, or -1 if unavailable.
+ */
+static int
+mkfifo_perf_open(const uint32_t type,
+                 const uint64_t config){
+  struct perf_event_attr attr;
+  long fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_hv = 1;
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  if(fd < 0 && (errno == EACCES || errno == EPERM)){
+    attr.exclude_kernel = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+  return fd < 0 ? -1 : (int)fd;
+}
+#endif /* __linux__ */
+
+/**
+ * Open and start the --perf counters.
+ *
+ * @param[out] perf See @ref mkfifo_perf.
  */
 static void
-mkfifo_path(struct mkfifo_ctx *const mkfifo_ctx,
-            const char *const path){
-  if(mkfifo(path, mkfifo_ctx->mode) != 0){
-    mkfifo_warn(mkfifo_ctx, true, "cannot create fifo: %s", path);
+mkfifo_perf_start(struct mkfifo_perf *const perf){
+  size_t i;
+
+  memset(perf, 0, sizeof(*perf));
+  for(i = 0; i < MKFIFO_PERF_COUNTERS; i++){
+    perf->fd[i] = -1;
+  }
+#ifdef __linux__
+  perf->fd[0] = mkfifo_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  perf->fd[1] = mkfifo_perf_open(PERF_TYPE_HARDWARE,
+                                 PERF_COUNT_HW_INSTRUCTIONS);
+  perf->fd[2] = mkfifo_perf_open(PERF_TYPE_SOFTWARE,
+                                 PERF_COUNT_SW_CONTEXT_SWITCHES);
+  perf->fd[3] = mkfifo_perf_open(PERF_TYPE_SOFTWARE,
+                                 PERF_COUNT_SW_PAGE_FAULTS);
+#endif /* __linux__ */
+  if(perf->fd[0] != -1 || perf->fd[1] != -1){
+    perf->source = "hardware";
   }
+  else if(perf->fd[2] != -1 || perf->fd[3] != -1){
+    perf->source = "software";
+  }
+  else{
+    perf->source = "rusage";
+    getrusage(RUSAGE_SELF, &perf->start);
+  }
+#ifdef __linux__
+  for(i = 0; i < MKFIFO_PERF_COUNTERS; i++){
+    if(perf->fd[i] != -1){
+      ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif /* __linux__ */
 }
 
 /**
- * Parse mode string given in the (-m mode) argument.
+ * Stop the --perf counters and read their values.
+ *
+ * @param[in,out] perf See @ref mkfifo_perf.
+ */
+static void
+mkfifo_perf_stop(struct mkfifo_perf *const perf){
+  struct rusage end;
+  size_t i;
+
+  for(i = 0; i < MKFIFO_PERF_COUNTERS; i++){
+    if(perf->fd[i] != -1){
+#ifdef __linux__
+      ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif /* __linux__ */
+      perf->valid[i] = read(perf->fd[i],
+                            &perf->value[i],
+                            sizeof(perf->value[i])) ==
+                       (ssize_t)sizeof(perf->value[i]);
+      close(perf->fd[i]);
+      perf->fd[i] = -1;
+    }
+  }
+  if(strcmp(perf->source, "rusage") == 0){
+    getrusage(RUSAGE_SELF, &end);
+    perf->value[2] = (uint64_t)((end.ru_nvcsw + end.ru_nivcsw) -
+                                (perf->start.ru_nvcsw +
+                                 perf->start.ru_nivcsw));
+    perf->value[3] = (uint64_t)((end.ru_minflt + end.ru_majflt) -
+                                (perf->start.ru_minflt +
+                                 perf->start.ru_majflt));
+    perf->valid[2] = true;
+    perf->valid[3] = true;
+  }
+}
+
+/**
+ * Print the --perf counters to STDERR as a JSON object, with null for
+ * counters that could not be measured.
+ *
+ * @param[in] perf See @ref mkfifo_perf.
+ */
+static void
+mkfifo_perf_print(const struct mkfifo_perf *const perf){
+  size_t i;
+
+  fprintf(stderr, "{\"source\":\"%s\"", perf->source);
+  for(i = 0; i < MKFIFO_PERF_COUNTERS; i++){
+    if(perf->valid[i]){
+      fprintf(stderr,
+              ",\"%s\":%llu",
+              mkfifo_perf_names[i],
+              (unsigned long long)perf->value[i]);
+    }
+    else{
+      fprintf(stderr, ",\"%s\":null", mkfifo_perf_names[i]);
+    }
+  }
+  fputc('}', stderr);
+}
+
+/**
+ * qsort() comparison for latencies in nanoseconds.
+ *
+ * @param[in] a First latency.
+ * @param[in] b Second latency.
+ * @return      Negative, zero, or positive like strcmp().
+ */
+static int
+mkfifo_stats_cmp_ns(const void *const a,
+                    const void *const b){
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Print the --stats summary to STDERR as one JSON object, including the
+ * --perf counters when enabled.
+ *
+ * Sorts the latencies in place.
  *
  * @param[in,out] mkfifo_ctx See @ref mkfifo_ctx.
- * @param[in]     mode_str   Same as chmod utility.
+ * @param[in]     npaths     Number of latencies in mkfifo_ctx->latency_ns.
  */
 static void
-mkfifo_parse_mode(struct mkfifo_ctx *const mkfifo_ctx,
-                  const char *const mode_str){
-  void *compiled_mode;
+mkfifo_stats_print(struct mkfifo_ctx *const mkfifo_ctx,
+                   const size_t npaths){
+  const struct mkfifo_stats *const stats = mkfifo_ctx->stats;
+  uint64_t *const lat = mkfifo_ctx->latency_ns;
+  uint64_t create_ns;
+  const char *sep;
+  size_t n;
+  int i;
 
-  umask(0);
-  compiled_mode = setmode(mode_str);
-  if(compiled_mode == NULL){
-    mkfifo_warn(mkfifo_ctx, true, "setmode: %s", mode_str);
+  create_ns = 0;
+  n = lat ? npaths : 0;
+  for(i = 0; (size_t)i < n; i++){
+    create_ns += lat[i];
   }
-  else{
-    /* Initial mode of a=rw -> 0666 */
-    mkfifo_ctx->mode = getmode(compiled_mode, 0666);
-    free(compiled_mode);
+  if(n > 0){
+    qsort(lat, n, sizeof(*lat), mkfifo_stats_cmp_ns);
+  }
+  fprintf(stderr,
+          "{\"processed\":%zu,\"created\":%zu,\"existing\":%zu,"
+          "\"failed\":%zu,\"failed_by_errno\":{",
+          stats->processed,
+          stats->created,
+          stats->existing,
+          stats->failed);
+  sep = "";
+  for(i = 0; i < MKFIFO_STATS_ERRNO_MAX; i++){
+    if(stats->failed_errno[i] > 0){
+      fprintf(stderr, "%s\"%d\":%zu", sep, i, stats->failed_errno[i]);
+      sep = ",";
+    }
+  }
+  fprintf(stderr,
+          "},\"parse_mode_ns\":%llu,\"create_ns\":%llu,"
+          "\"dir_resolve_ns\":%llu,\"create_syscalls\":%llu,"
+          "\"latency_ns\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+          "\"max\":%llu}",
+          (unsigned long long)stats->parse_ns,
+          (unsigned long long)create_ns,
+          (unsigned long long)stats->dir_ns,
+          (unsigned long long)mkfifo_ctx->create_syscalls,
+          (unsigned long long)(n ? lat[n / 2] : 0),
+          (unsigned long long)(n ? lat[n * 90 / 100] : 0),
+          (unsigned long long)(n ? lat[n * 99 / 100] : 0),
+          (unsigned long long)(n ? lat[n - 1] : 0));
+  if(mkfifo_ctx->perf){
+    fputs(",\"perf\":", stderr);
+    mkfifo_perf_print(mkfifo_ctx->perf);
   }
+  fputs("}\n", stderr);
 }
 
 /**
  * Main entry point for mkfifo utility.
  *
  * Usage:
- * mkfifo [-m mode] file...
+ * mkfifo [--perf] [--stats] [-e engine] [-m mode] [-t | --claim pool]
+ *        [--lease ttl --lease-index file]
+ *        [-p input [-b backend] [-s policy]] [-M output [-r format]] file...
+ * mkfifo [--stats] [-m mode] --daemon socket
+ * mkfifo --gc --lease-index file
+ * mkfifo [-m mode] --exec name[:r|:w][,...] -- command [argument...]
+ * mkfifo [-e engine] [-m mode] --pipeline spec
+ * mkfifo [-e engine] [-m mode] --pool dir --pool-size n
+ *
+ * -t treats each file as a template ending in XXXXXX and prints the names
+ * created, see @ref mkfifo_create_templates.
+ * --claim pool takes each file from a pool kept full by --pool dir
+ * --pool-size n, see @ref mkfifo_pool.
+ * --stats prints a JSON summary of the creation phase to STDERR on exit.
+ * --perf adds CPU and scheduler counters for the creation phase to it.
+ * --daemon serves creation requests on a Unix socket, see @ref mkfifo_daemon.
+ * --lease ttl --lease-index file records a lease for each created FIFO,
+ * which --gc collects once expired, see @ref mkfifo_gc.
+ * --exec runs a command around private FIFOs, see @ref mkfifo_exec.
+ * --pipeline runs a DAG of commands joined by FIFOs, see @ref mkfifo_pipeline.
+ *
+ * Reentrant: keeps no state between calls, does not exit, and leaves the
+ * umask and signal dispositions alone, so tests and other callers can run
+ * it on several threads.
  *
  * @param[in]     argc         Number of arguments in @p argv.
  * @param[in,out] argv         Argument list.
+ * @param[in]     owner        Process that owns the --lease leases: the
+ *                             parent when running as a process of its own,
+ *                             or the calling process when run in-process,
+ *                             as in the bash builtin.
  * @retval        EXIT_SUCCESS All FIFO files successfully created.
  * @retval        EXIT_FAILURE Failed to create at least one FIFO file.
+ * @retval        other        Status of the --exec command or of the last
+ *                             failing --pipeline stage, 126 or 127 if it
+ *                             could not run, or 128 plus the signal that
+ *                             killed it.
  */
 LINKAGE int
-mkfifo_main(int argc,
-            char *argv[]){
+mkfifo_run(int argc,
+           char *argv[],
+           const pid_t owner){
+  static const struct option long_options[] = {
+    {"claim", required_argument, NULL, 'C'},
+    {"daemon", required_argument, NULL, 'D'},
+    {"exec", required_argument, NULL, 'X'},
+    {"gc", no_argument, NULL, 'G'},
+    {"lease", required_argument, NULL, 'L'},
+    {"lease-index", required_argument, NULL, 'I'},
+    {"perf", no_argument, NULL, 'P'},
+    {"pipeline", required_argument, NULL, 'R'},
+    {"pool", required_argument, NULL, 'F'},
+    {"pool-size", required_argument, NULL, 'N'},
+    {"stats", no_argument, NULL, 'S'},
+    {NULL, 0, NULL, 0}
+  };
   int c;
-  int i;
+  const char *mode_str;
+  const char *lease_ttl;
+  const char *lease_index;
+  const char *exec_names;
+  const char *pipeline_spec;
+  const char *pool_dir;
+  const char *pool_size;
+  const char *claim_pool;
+  uint64_t start;
+  struct mkfifo_stats stats;
+  struct mkfifo_perf perf;
+  struct mkfifo_lease lease;
   struct mkfifo_ctx mkfifo_ctx;
+  bool want_stats;
+  bool want_perf;
+  bool want_gc;
+  bool want_template;
+  char **names;
 
   memset(&mkfifo_ctx, 0, sizeof(mkfifo_ctx));
+  mode_str = NULL;
+  lease_ttl = NULL;
+  lease_index = NULL;
+  exec_names = NULL;
+  pipeline_spec = NULL;
+  pool_dir = NULL;
+  pool_size = NULL;
+  claim_pool = NULL;
+  want_stats = false;
+  want_perf = false;
+  want_gc = false;
+  want_template = false;
+  names = NULL;
   mkfifo_ctx.mode = S_IRUSR | S_IWUSR |
                     S_IRGRP | S_IWGRP |
                     S_IROTH | S_IWOTH;
-  while((c = getopt(argc, argv, "m:")) != -1){
+  pthread_mutex_lock(&mkfifo_getopt_lock);
+#ifdef __GLIBC__
+  optind = 0;
+#else /* !(__GLIBC__) */
+  optind = 1;
+#endif /* __GLIBC__ */
+  while((c = getopt_long(argc,
+                         argv,
+                         "M:b:e:m:p:r:s:t",
+                         long_options,
+                         NULL)) != -1){
     switch(c){
+      case 'C':
+        claim_pool = optarg;
+        break;
+      case 'D':
+        mkfifo_ctx.daemon_socket = optarg;
+        break;
+      case 'F':
+        pool_dir = optarg;
+        break;
+      case 'G':
+        want_gc = true;
+        break;
+      case 'I':
+        lease_index = optarg;
+        break;
+      case 'L':
+        lease_ttl = optarg;
+        break;
+      case 'M':
+        mkfifo_ctx.merge_output = optarg;
+        break;
+      case 'N':
+        pool_size = optarg;
+        break;
+      case 'b':
+        mkfifo_parse_backend(&mkfifo_ctx, optarg);
+        break;
+      case 'e':
+        mkfifo_parse_engine(&mkfifo_ctx, optarg);
+        break;
+      case 'P':
+        want_perf = true;
+        break;
+      case 'R':
+        pipeline_spec = optarg;
+        break;
+      case 'S':
+        want_stats = true;
+        break;
+      case 'X':
+        exec_names = optarg;
+        break;
       case 'm':
-        mkfifo_parse_mode(&mkfifo_ctx, optarg);
+        mode_str = optarg;
+        break;
+      case 'p':
+        mkfifo_ctx.pump_input = optarg;
+        break;
+      case 'r':
+        mkfifo_parse_record_format(&mkfifo_ctx, optarg);
+        break;
+      case 's':
+        mkfifo_parse_slow_policy(&mkfifo_ctx, optarg);
+        break;
+      case 't':
+        want_template = true;
         break;
       default:
         mkfifo_ctx.status_code = EXIT_FAILURE;
@@ -140,20 +6628,188 @@ mkfifo_main(int argc,
   }
   argc -= optind;
   argv += optind;
+  pthread_mutex_unlock(&mkfifo_getopt_lock);
+  if(want_stats){
+    memset(&stats, 0, sizeof(stats));
+    mkfifo_ctx.stats = &stats;
+    mkfifo_ctx.latency_ns = calloc(argc > 0 ? (size_t)argc : 1,
+                                   sizeof(*mkfifo_ctx.latency_ns));
+    if(mkfifo_ctx.latency_ns == NULL){
+      mkfifo_warn(&mkfifo_ctx, true, "calloc");
+    }
+  }
+  if(mode_str && mkfifo_ctx.status_code == 0){
+    if(mkfifo_ctx.stats){
+      start = mkfifo_clock_ns();
+      mkfifo_parse_mode(&mkfifo_ctx, mode_str);
+      stats.parse_ns = mkfifo_clock_ns() - start;
+    }
+    else{
+      mkfifo_parse_mode(&mkfifo_ctx, mode_str);
+    }
+  }
+  if(lease_ttl && mkfifo_ctx.status_code == 0){
+    mkfifo_parse_lease(&mkfifo_ctx, &lease, lease_ttl, lease_index, owner);
+  }
   if(mkfifo_ctx.status_code == 0){
-    if(argc < 1){
+    if(want_gc){
+      if(argc > 0 || lease_index == NULL || lease_ttl){
+        mkfifo_warn(&mkfifo_ctx, false, "--gc takes only --lease-index");
+      }
+      else{
+        mkfifo_gc(&mkfifo_ctx, lease_index);
+      }
+    }
+    else if(exec_names){
+      if(argc < 1){
+        mkfifo_warn(&mkfifo_ctx, false, "--exec needs a command");
+      }
+      else if(mkfifo_ctx.pump_input ||
+              mkfifo_ctx.merge_output ||
+              mkfifo_ctx.daemon_socket ||
+              mkfifo_ctx.lease){
+        mkfifo_warn(&mkfifo_ctx,
+                    false,
+                    "--exec takes no -p, -M, --daemon, or --lease");
+      }
+      else{
+        mkfifo_exec(&mkfifo_ctx, exec_names, argc, argv);
+      }
+    }
+    else if(pipeline_spec){
+      if(argc > 0 ||
+         mkfifo_ctx.pump_input ||
+         mkfifo_ctx.merge_output ||
+         mkfifo_ctx.daemon_socket ||
+         mkfifo_ctx.lease){
+        mkfifo_warn(&mkfifo_ctx,
+                    false,
+                    "--pipeline takes no file, -p, -M, --daemon, or --lease");
+      }
+      else{
+        free(mkfifo_ctx.latency_ns);
+        mkfifo_ctx.latency_ns = NULL;
+        mkfifo_pipeline(&mkfifo_ctx, pipeline_spec);
+      }
+    }
+    else if(pool_dir){
+      if(pool_size == NULL){
+        mkfifo_warn(&mkfifo_ctx, false, "--pool needs --pool-size");
+      }
+      else if(argc > 0 ||
+              mkfifo_ctx.pump_input ||
+              mkfifo_ctx.merge_output ||
+              mkfifo_ctx.daemon_socket ||
+              mkfifo_ctx.lease ||
+              claim_pool){
+        mkfifo_warn(&mkfifo_ctx,
+                    false,
+                    "--pool takes no file, -p, -M, --daemon, --lease, "
+                    "or --claim");
+      }
+      else{
+        free(mkfifo_ctx.latency_ns);
+        mkfifo_ctx.latency_ns = NULL;
+        mkfifo_pool(&mkfifo_ctx, pool_dir, pool_size);
+      }
+    }
+    else if(mkfifo_ctx.daemon_socket){
+      if(argc > 0 ||
+         mkfifo_ctx.pump_input ||
+         mkfifo_ctx.merge_output ||
+         mkfifo_ctx.lease){
+        mkfifo_warn(&mkfifo_ctx,
+                    false,
+                    "--daemon takes no file, -p, -M, or --lease");
+      }
+      else{
+        free(mkfifo_ctx.latency_ns);
+        mkfifo_ctx.latency_ns = NULL;
+        mkfifo_daemon(&mkfifo_ctx);
+      }
+    }
+    else if(argc < 1){
       mkfifo_warn(&mkfifo_ctx, false, "missing file...");
     }
+    else if(mkfifo_ctx.pump_input && mkfifo_ctx.merge_output){
+      mkfifo_warn(&mkfifo_ctx, false, "-p and -M are mutually exclusive");
+    }
+    else if(want_template && claim_pool){
+      mkfifo_warn(&mkfifo_ctx, false, "-t and --claim are mutually exclusive");
+    }
+    else if(want_template &&
+            (names = calloc((size_t)argc, sizeof(*names))) == NULL){
+      mkfifo_warn(&mkfifo_ctx, true, "calloc");
+    }
     else{
-      for(i = 0; i < argc; i++){
-        mkfifo_path(&mkfifo_ctx, argv[i]);
+      if(want_perf){
+        mkfifo_ctx.perf = &perf;
+        mkfifo_perf_start(&perf);
+      }
+      if(names){
+        mkfifo_create_templates(&mkfifo_ctx, (size_t)argc, argv, names);
+        argv = names;
+      }
+      else if(claim_pool){
+        mkfifo_pool_claim_all(&mkfifo_ctx, claim_pool, (size_t)argc, argv);
+      }
+      else{
+        mkfifo_create_all(&mkfifo_ctx, (size_t)argc, argv);
+      }
+      if(want_perf){
+        mkfifo_perf_stop(&perf);
+      }
+      if(mkfifo_ctx.lease){
+        mkfifo_lease_flush(&mkfifo_ctx);
+      }
+      if(mkfifo_ctx.pump_input && mkfifo_ctx.status_code == 0){
+        if(argc == 1){
+          mkfifo_pump(&mkfifo_ctx, argv[0]);
+        }
+        else{
+          mkfifo_fanout(&mkfifo_ctx, (size_t)argc, argv);
+        }
+      }
+      if(mkfifo_ctx.merge_output && mkfifo_ctx.status_code == 0){
+        mkfifo_merge(&mkfifo_ctx, (size_t)argc, argv);
       }
     }
   }
+  if(mkfifo_ctx.stats){
+    mkfifo_stats_print(&mkfifo_ctx, stats.processed);
+    free(mkfifo_ctx.latency_ns);
+  }
+  else if(mkfifo_ctx.perf){
+    fputs("{\"perf\":", stderr);
+    mkfifo_perf_print(&perf);
+    fputs("}\n", stderr);
+  }
+  if(mkfifo_ctx.lease){
+    free(lease.cwd);
+    free(lease.buf);
+  }
+  for(c = 0; names && c < argc; c++){
+    free(names[c]);
+  }
+  free(names);
   return mkfifo_ctx.status_code;
 }
 
-#ifndef TEST
+/**
+ * Run @ref mkfifo_run as the mkfifo process, with the parent process as
+ * the lease owner.
+ *
+ * @param[in]     argc See @ref mkfifo_run.
+ * @param[in,out] argv See @ref mkfifo_run.
+ * @return             See @ref mkfifo_run.
+ */
+LINKAGE int
+mkfifo_main(int argc,
+            char *argv[]){
+  return mkfifo_run(argc, argv, getppid());
+}
+
+#if !defined(TEST) && !defined(MKFIFO_LIBRARY)
 /**
  * Main program entry point.
  *
@@ -166,5 +6822,5 @@ main(int argc,
      char *argv[]){
   return mkfifo_main(argc, argv);
 }
-#endif /* TEST */
+#endif /* !(TEST) && !(MKFIFO_LIBRARY) */
 
@@ -0,0 +1,199 @@
+/**
+ * @file
+ * @brief mkfifo library interface
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Creates FIFOs in-process with the same engines as the mkfifo utility,
+ * without global state, option parsing, output, or umask changes.
+ *
+ * Build the library from the top-level directory:
+ * cc -O2 -fPIC -shared -DMKFIFO_LIBRARY -o build/libmkfifo.so src/mkfifo.c \
+ *    -lpthread
+ */
+#ifndef MKFIFO_H
+#define MKFIFO_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * How FIFOs get created (-e engine).
+ */
+enum mkfifo_engine{
+  /**
+   * Call mkfifo() on each path in order.
+   */
+  MKFIFO_ENGINE_SERIAL,
+
+  /**
+   * Call mkfifoat() relative to cached directory file descriptors.
+   */
+  MKFIFO_ENGINE_DIRFD,
+
+  /**
+   * Split the paths across threads that each use a directory cache.
+   */
+  MKFIFO_ENGINE_THREAD
+};
+
+/**
+ * Options for @ref mkfifo_batch, owned by the caller.
+ */
+struct mkfifo_batch_ctx{
+  /**
+   * File permissions of the new FIFOs.
+   */
+  mode_t mode;
+
+  /**
+   * Apply @ref mode exactly after creation, like (-m mode). The change
+   * does not follow symlinks, so a FIFO replaced by a symlink before then
+   * fails with ELOOP or EEXIST instead of changing the link target.
+   * Otherwise the process umask applies, as with mkfifo().
+   */
+  bool exact_mode;
+
+  /**
+   * How the FIFOs get created.
+   */
+  enum mkfifo_engine engine;
+};
+
+/**
+ * Create a batch of FIFOs.
+ *
+ * Safe to call from several threads at once. Every path is attempted even
+ * if some fail.
+ *
+ * @param[in]  batch_ctx See @ref mkfifo_batch_ctx.
+ * @param[in]  paths     Paths to new FIFO files to create.
+ * @param[in]  npaths    Number of paths in @p paths and @p results.
+ * @param[out] results   0 or the errno describing the failure, per path.
+ * @retval     >=0       Number of paths that failed.
+ * @retval     -1        Out of memory before trying any path, errno set.
+ */
+int
+mkfifo_batch(const struct mkfifo_batch_ctx *const batch_ctx,
+             const char *const paths[],
+             const size_t npaths,
+             int results[]);
+
+/**
+ * Claim a ready FIFO from a pool kept full by (mkfifo --pool dir) by
+ * moving it to @p path with one renameat2(RENAME_NOREPLACE).
+ *
+ * Safe to call from several processes at once: each pool FIFO goes to
+ * exactly one caller. The FIFO keeps the mode and owner it got in the
+ * pool.
+ *
+ * @param[in] pool Pool directory, on the same filesystem as @p path.
+ * @param[in] path New path of the FIFO, which must not exist.
+ * @retval    0    Claimed a FIFO.
+ * @retval    -1   errno is EAGAIN if the pool is empty, EEXIST if @p path
+ *                 exists, EXDEV across filesystems, ENOSYS or EINVAL if
+ *                 renaming without replacing is unsupported, or describes
+ *                 the failure. The caller can fall back to
+ *                 @ref mkfifo_batch.
+ */
+int
+mkfifo_pool_claim(const char *const pool,
+                  const char *const path);
+
+#ifdef __linux__
+/**
+ * Completion callback of @ref mkfifo_opener_open.
+ *
+ * @param[in] arg Argument given to @ref mkfifo_opener_open.
+ * @param[in] fd  Opened non-blocking descriptor, owned by the callee, or -1.
+ * @param[in] err 0, or the errno describing the failure. ENOENT if the FIFO
+ *                was removed and ECANCELED if the opener was destroyed.
+ */
+typedef void (*mkfifo_open_cb)(void *arg, int fd, int err);
+
+/**
+ * Set of FIFO opens waiting for the other side, driven by inotify and a
+ * retry timer so that any number of them wait on one descriptor without
+ * threads.
+ */
+struct mkfifo_opener;
+
+/**
+ * Create an opener.
+ *
+ * @return Opener, or NULL with errno set.
+ */
+struct mkfifo_opener *
+mkfifo_opener_create(void);
+
+/**
+ * Descriptor to add to epoll or poll for reading. When readable, call
+ * @ref mkfifo_opener_dispatch.
+ *
+ * @param[in] opener See @ref mkfifo_opener.
+ * @return           epoll descriptor owned by the opener.
+ */
+int
+mkfifo_opener_fd(const struct mkfifo_opener *const opener);
+
+/**
+ * Open a FIFO without blocking for the other side.
+ *
+ * Opening for reading never has to wait, since O_NONBLOCK lets a reader
+ * open before any writer. Opening for writing fails with ENXIO until a
+ * reader exists, so the open gets retried whenever inotify reports that
+ * the FIFO was opened. A reader blocked in open() without O_NONBLOCK, like
+ * cat(1), is not reported until a writer arrives, so waiting writers also
+ * get retried every few milliseconds.
+ *
+ * @param[in] opener See @ref mkfifo_opener.
+ * @param[in] path   Existing FIFO, for example from @ref mkfifo_batch.
+ * @param[in] flags  O_RDONLY or O_WRONLY, plus any other open() flags.
+ *                   O_NONBLOCK and O_CLOEXEC are always added.
+ * @param[in] cb     Called once from @ref mkfifo_opener_dispatch when a
+ *                   waiting open completes.
+ * @param[in] arg    Passed to @p cb.
+ * @retval    >=0    Opened right away, @p cb will not be called.
+ * @retval    -1     errno is EINPROGRESS if waiting for a reader, which
+ *                   may itself be blocked in open(), or describes the
+ *                   failure.
+ */
+int
+mkfifo_opener_open(struct mkfifo_opener *const opener,
+                   const char *const path,
+                   const int flags,
+                   const mkfifo_open_cb cb,
+                   void *const arg);
+
+/**
+ * Retry the opens whose FIFO was opened by someone else since the last
+ * call, or all of them when the retry timer expired, calling the callback
+ * of each one that completes.
+ *
+ * @param[in] opener See @ref mkfifo_opener.
+ * @retval    >=0    Number of callbacks called.
+ * @retval    -1     Reading the inotify descriptor failed, errno set.
+ */
+int
+mkfifo_opener_dispatch(struct mkfifo_opener *const opener);
+
+/**
+ * Fail every waiting open with ECANCELED and free the opener.
+ *
+ * @param[in] opener See @ref mkfifo_opener.
+ */
+void
+mkfifo_opener_destroy(struct mkfifo_opener *const opener);
+#endif /* __linux__ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MKFIFO_H */
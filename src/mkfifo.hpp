@@ -0,0 +1,680 @@
+/**
+ * @file
+ * @brief C++ RAII wrappers for the mkfifo library
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Header-only, C++17. A @ref libmkfifo::Fifo or @ref libmkfifo::FifoSet
+ * unlinks the FIFOs it created when it goes out of scope, including during
+ * exception unwinding, unless they were released first.
+ *
+ * On Linux, @ref libmkfifo::Opener waits for the other side of a FIFO
+ * without blocking, and under C++20 its opens can be awaited by a
+ * coroutine.
+ *
+ * Link against the library built from src/mkfifo.c with -DMKFIFO_LIBRARY.
+ */
+#ifndef MKFIFO_HPP
+#define MKFIFO_HPP
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#if __cplusplus >= 202002L && __has_include(<span>)
+# include <span>
+#endif
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+# include <coroutine>
+# define MKFIFO_HPP_COROUTINE
+#endif
+
+#include "mkfifo.h"
+
+/**
+ * C++ interface to the mkfifo library.
+ */
+namespace libmkfifo{
+
+/**
+ * Move-only owner of one FIFO, which gets unlinked on destruction unless
+ * released.
+ *
+ * Holds the caller's path pointer rather than a copy, so the path must
+ * outlive the handle.
+ */
+class Fifo{
+public:
+  /**
+   * Empty handle that owns nothing.
+   */
+  Fifo() noexcept = default;
+
+  /**
+   * Create a FIFO.
+   *
+   * @param[in] path       NUL-terminated path, kept by reference.
+   * @param[in] mode       File permissions.
+   * @param[in] exact_mode Apply @p mode exactly instead of under the umask.
+   * @throws std::system_error Creation failed.
+   */
+  explicit Fifo(const char *const path,
+                const mode_t mode = 0666,
+                const bool exact_mode = false){
+    const mkfifo_batch_ctx batch_ctx = {mode,
+                                        exact_mode,
+                                        MKFIFO_ENGINE_SERIAL};
+    int result;
+
+    if(mkfifo_batch(&batch_ctx, &path, 1, &result) != 0){
+      throw std::system_error(result ? result : errno,
+                              std::generic_category(),
+                              path);
+    }
+    path_ = path;
+  }
+
+  /**
+   * Take ownership of a FIFO that already exists.
+   *
+   * @param[in] path NUL-terminated path, kept by reference.
+   * @return         Handle that unlinks @p path on destruction.
+   */
+  static Fifo
+  adopt(const char *const path) noexcept{
+    Fifo fifo;
+
+    fifo.path_ = path;
+    return fifo;
+  }
+
+  /**
+   * Claim a ready FIFO from a pool with @ref mkfifo_pool_claim.
+   *
+   * @param[in] pool Pool directory kept full by (mkfifo --pool dir).
+   * @param[in] path NUL-terminated new path, kept by reference.
+   * @return         Handle that unlinks @p path on destruction.
+   * @throws std::system_error Claim failed, with EAGAIN if the pool is
+   *                           empty.
+   */
+  static Fifo
+  claim(const char *const pool,
+        const char *const path){
+    if(mkfifo_pool_claim(pool, path) != 0){
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    return adopt(path);
+  }
+
+  Fifo(const Fifo &) = delete;
+  Fifo &operator=(const Fifo &) = delete;
+
+  /**
+   * Take over the FIFO owned by @p other, leaving it empty.
+   *
+   * @param[in,out] other Handle to move from.
+   */
+  Fifo(Fifo &&other) noexcept
+    : path_(std::exchange(other.path_, nullptr)){
+  }
+
+  /**
+   * Unlink the FIFO owned by this handle and take over the one owned by
+   * @p other.
+   *
+   * @param[in,out] other Handle to move from.
+   * @return              This handle.
+   */
+  Fifo &
+  operator=(Fifo &&other) noexcept{
+    if(this != &other){
+      reset();
+      path_ = std::exchange(other.path_, nullptr);
+    }
+    return *this;
+  }
+
+  /**
+   * Unlink the FIFO, if still owned.
+   */
+  ~Fifo(){
+    reset();
+  }
+
+  /**
+   * Path of the owned FIFO.
+   *
+   * @return Path, or nullptr when empty.
+   */
+  const char *
+  path() const noexcept{
+    return path_;
+  }
+
+  /**
+   * Check whether this handle owns a FIFO.
+   *
+   * @return true if it does.
+   */
+  explicit operator bool() const noexcept{
+    return path_ != nullptr;
+  }
+
+  /**
+   * Keep the FIFO on disk and stop owning it.
+   *
+   * @return Path of the FIFO, or nullptr when empty.
+   */
+  const char *
+  release() noexcept{
+    return std::exchange(path_, nullptr);
+  }
+
+  /**
+   * Unlink the FIFO now, if owned.
+   */
+  void
+  reset() noexcept{
+    if(path_){
+      unlink(path_);
+      path_ = nullptr;
+    }
+  }
+
+private:
+  /**
+   * Owned FIFO, or nullptr.
+   */
+  const char *path_ = nullptr;
+};
+
+/**
+ * Move-only owner of a batch of FIFOs created with one call to
+ * @ref mkfifo_batch.
+ *
+ * The C interface needs NUL-terminated paths, so the set keeps one block
+ * holding the path pointers, results, ownership flags, and a terminated
+ * copy of every path. That is its only allocation.
+ */
+class FifoSet{
+public:
+  /**
+   * Empty set.
+   */
+  FifoSet() noexcept = default;
+
+  /**
+   * Create one FIFO per path. Paths that fail are reported by
+   * @ref error rather than thrown, so one bad path does not undo the rest.
+   *
+   * @param[in] paths      Paths to create.
+   * @param[in] npaths     Number of entries in @p paths.
+   * @param[in] mode       File permissions.
+   * @param[in] exact_mode Apply @p mode exactly instead of under the umask.
+   * @param[in] engine     How the FIFOs get created.
+   * @throws std::bad_alloc Out of memory.
+   */
+  FifoSet(const std::string_view *const paths,
+          const std::size_t npaths,
+          const mode_t mode = 0666,
+          const bool exact_mode = false,
+          const mkfifo_engine engine = MKFIFO_ENGINE_DIRFD){
+    const mkfifo_batch_ctx batch_ctx = {mode, exact_mode, engine};
+    std::size_t bytes;
+    char *names;
+    std::size_t i;
+
+    bytes = 0;
+    for(i = 0; i < npaths; i++){
+      bytes += paths[i].size() + 1;
+    }
+    storage_.reset(new char[npaths * (sizeof(char *) + sizeof(int) + 1) +
+                            bytes]);
+    n_ = npaths;
+    names = &owned()[n_];
+    for(i = 0; i < n_; i++){
+      std::memcpy(names, paths[i].data(), paths[i].size());
+      names[paths[i].size()] = '\0';
+      ptrs()[i] = names;
+      names += paths[i].size() + 1;
+    }
+    if(mkfifo_batch(&batch_ctx, ptrs(), n_, results()) < 0){
+      storage_.reset();
+      n_ = 0;
+      throw std::bad_alloc();
+    }
+    for(i = 0; i < n_; i++){
+      owned()[i] = results()[i] == 0;
+    }
+  }
+
+#ifdef __cpp_lib_span
+  /**
+   * Create one FIFO per path, see the pointer and count constructor.
+   *
+   * @param[in] paths      Paths to create.
+   * @param[in] mode       File permissions.
+   * @param[in] exact_mode Apply @p mode exactly instead of under the umask.
+   * @param[in] engine     How the FIFOs get created.
+   */
+  explicit FifoSet(const std::span<const std::string_view> paths,
+                   const mode_t mode = 0666,
+                   const bool exact_mode = false,
+                   const mkfifo_engine engine = MKFIFO_ENGINE_DIRFD)
+    : FifoSet(paths.data(), paths.size(), mode, exact_mode, engine){
+  }
+#endif /* __cpp_lib_span */
+
+  FifoSet(const FifoSet &) = delete;
+  FifoSet &operator=(const FifoSet &) = delete;
+
+  /**
+   * Take over the FIFOs owned by @p other, leaving it empty.
+   *
+   * @param[in,out] other Set to move from.
+   */
+  FifoSet(FifoSet &&other) noexcept
+    : storage_(std::move(other.storage_)),
+      n_(std::exchange(other.n_, 0)){
+  }
+
+  /**
+   * Unlink the FIFOs owned by this set and take over those of @p other.
+   *
+   * @param[in,out] other Set to move from.
+   * @return              This set.
+   */
+  FifoSet &
+  operator=(FifoSet &&other) noexcept{
+    if(this != &other){
+      reset();
+      storage_ = std::move(other.storage_);
+      n_ = std::exchange(other.n_, 0);
+    }
+    return *this;
+  }
+
+  /**
+   * Unlink every FIFO still owned.
+   */
+  ~FifoSet(){
+    reset();
+  }
+
+  /**
+   * Number of paths in the set.
+   *
+   * @return Number of paths, created or not.
+   */
+  std::size_t
+  size() const noexcept{
+    return n_;
+  }
+
+  /**
+   * NUL-terminated path of entry @p i.
+   *
+   * @param[in] i Index below @ref size.
+   * @return      Path held by the set.
+   */
+  const char *
+  path(const std::size_t i) const noexcept{
+    return ptrs()[i];
+  }
+
+  /**
+   * Result of creating entry @p i.
+   *
+   * @param[in] i Index below @ref size.
+   * @return      Empty on success, otherwise why creation failed.
+   */
+  std::error_code
+  error(const std::size_t i) const noexcept{
+    return std::error_code(results()[i], std::generic_category());
+  }
+
+  /**
+   * Number of paths that could not be created.
+   *
+   * @return Number of failures.
+   */
+  std::size_t
+  failed() const noexcept{
+    std::size_t count;
+    std::size_t i;
+
+    count = 0;
+    for(i = 0; i < n_; i++){
+      count += results()[i] != 0;
+    }
+    return count;
+  }
+
+  /**
+   * Keep entry @p i on disk and stop owning it.
+   *
+   * @param[in] i Index below @ref size.
+   * @return      Path of the FIFO, valid while the set lives.
+   */
+  const char *
+  release(const std::size_t i) noexcept{
+    owned()[i] = false;
+    return ptrs()[i];
+  }
+
+  /**
+   * Keep every FIFO on disk and stop owning them.
+   */
+  void
+  release() noexcept{
+    std::size_t i;
+
+    for(i = 0; i < n_; i++){
+      owned()[i] = false;
+    }
+  }
+
+  /**
+   * Unlink every FIFO still owned now.
+   */
+  void
+  reset() noexcept{
+    std::size_t i;
+
+    for(i = 0; i < n_; i++){
+      if(owned()[i]){
+        unlink(ptrs()[i]);
+        owned()[i] = false;
+      }
+    }
+  }
+
+private:
+  /**
+   * Path pointers at the start of @ref storage_.
+   *
+   * @return Array of @ref n_ paths.
+   */
+  const char **
+  ptrs() const noexcept{
+    return reinterpret_cast<const char **>(storage_.get());
+  }
+
+  /**
+   * Results from @ref mkfifo_batch, after the path pointers.
+   *
+   * @return Array of @ref n_ results.
+   */
+  int *
+  results() const noexcept{
+    return reinterpret_cast<int *>(&storage_[n_ * sizeof(char *)]);
+  }
+
+  /**
+   * Ownership flags, after the results.
+   *
+   * @return Array of @ref n_ flags.
+   */
+  char *
+  owned() const noexcept{
+    return &storage_[n_ * (sizeof(char *) + sizeof(int))];
+  }
+
+  /**
+   * Path pointers, results, ownership flags, and terminated paths.
+   */
+  std::unique_ptr<char[]> storage_;
+
+  /**
+   * Number of paths.
+   */
+  std::size_t n_ = 0;
+};
+
+#ifdef __linux__
+/**
+ * Move-only owner of a @ref mkfifo_opener.
+ *
+ * Add @ref fd to the event loop and call @ref dispatch when it is readable.
+ * Destroying the opener fails the opens still waiting with ECANCELED.
+ */
+class Opener{
+public:
+  /**
+   * Create the inotify instance and retry timer.
+   *
+   * @throws std::system_error Creation failed.
+   */
+  Opener()
+    : opener_(mkfifo_opener_create()){
+    if(opener_ == nullptr){
+      throw std::system_error(errno,
+                              std::generic_category(),
+                              "mkfifo_opener_create");
+    }
+  }
+
+  Opener(const Opener &) = delete;
+  Opener &operator=(const Opener &) = delete;
+
+  /**
+   * Take over the opener of @p other, leaving it empty.
+   *
+   * @param[in,out] other Opener to move from.
+   */
+  Opener(Opener &&other) noexcept
+    : opener_(std::exchange(other.opener_, nullptr)){
+  }
+
+  /**
+   * Destroy this opener and take over the one of @p other.
+   *
+   * @param[in,out] other Opener to move from.
+   * @return              This opener.
+   */
+  Opener &
+  operator=(Opener &&other) noexcept{
+    if(this != &other){
+      if(opener_){
+        mkfifo_opener_destroy(opener_);
+      }
+      opener_ = std::exchange(other.opener_, nullptr);
+    }
+    return *this;
+  }
+
+  /**
+   * Cancel the waiting opens and close the opener descriptors.
+   */
+  ~Opener(){
+    if(opener_){
+      mkfifo_opener_destroy(opener_);
+    }
+  }
+
+  /**
+   * Descriptor to wait on for reading.
+   *
+   * @return epoll descriptor owned by the opener.
+   */
+  int
+  fd() const noexcept{
+    return mkfifo_opener_fd(opener_);
+  }
+
+  /**
+   * Complete the opens that became possible.
+   *
+   * @return Number of completions.
+   * @throws std::system_error Reading the inotify descriptor failed.
+   */
+  int
+  dispatch(){
+    int n;
+
+    if((n = mkfifo_opener_dispatch(opener_)) < 0){
+      throw std::system_error(errno,
+                              std::generic_category(),
+                              "mkfifo_opener_dispatch");
+    }
+    return n;
+  }
+
+  /**
+   * Underlying C opener, for @ref mkfifo_opener_open with a callback.
+   *
+   * @return Opener owned by this object.
+   */
+  mkfifo_opener *
+  get() const noexcept{
+    return opener_;
+  }
+
+#ifdef MKFIFO_HPP_COROUTINE
+  /**
+   * Result of @ref open, resumed from @ref dispatch once the FIFO opens.
+   */
+  class Awaitable{
+  public:
+    /**
+     * Prepare an open of @p path.
+     *
+     * @param[in] opener C opener.
+     * @param[in] path   FIFO path, must outlive the await.
+     * @param[in] flags  open() flags.
+     */
+    Awaitable(mkfifo_opener *const opener,
+              const char *const path,
+              const int flags) noexcept
+      : opener_(opener),
+        path_(path),
+        flags_(flags){
+    }
+
+    /**
+     * Always try the open in @ref await_suspend.
+     *
+     * @return false
+     */
+    bool
+    await_ready() const noexcept{
+      return false;
+    }
+
+    /**
+     * Start the open, staying suspended only if it has to wait.
+     *
+     * @param[in] handle Coroutine resumed from @ref Opener::dispatch.
+     * @return           true if suspended.
+     */
+    bool
+    await_suspend(const std::coroutine_handle<> handle) noexcept{
+      handle_ = handle;
+      fd_ = mkfifo_opener_open(opener_, path_, flags_, complete, this);
+      if(fd_ >= 0){
+        return false;
+      }
+      if(errno != EINPROGRESS){
+        err_ = errno;
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * Result of the open.
+     *
+     * @return Non-blocking descriptor owned by the caller.
+     * @throws std::system_error The open failed or was canceled.
+     */
+    int
+    await_resume() const{
+      if(err_){
+        throw std::system_error(err_, std::generic_category(), path_);
+      }
+      return fd_;
+    }
+
+  private:
+    /**
+     * @ref mkfifo_open_cb that stores the result and resumes the awaiter.
+     *
+     * @param[in] arg This awaitable.
+     * @param[in] fd  Opened descriptor, or -1.
+     * @param[in] err 0, or why the open failed.
+     */
+    static void
+    complete(void *const arg,
+             const int fd,
+             const int err){
+      Awaitable *const self = static_cast<Awaitable *>(arg);
+
+      self->fd_ = fd;
+      self->err_ = err;
+      self->handle_.resume();
+    }
+
+    /**
+     * C opener.
+     */
+    mkfifo_opener *opener_;
+
+    /**
+     * FIFO path.
+     */
+    const char *path_;
+
+    /**
+     * open() flags.
+     */
+    int flags_;
+
+    /**
+     * Opened descriptor, or -1.
+     */
+    int fd_ = -1;
+
+    /**
+     * errno of a failed open, or 0.
+     */
+    int err_ = 0;
+
+    /**
+     * Suspended coroutine.
+     */
+    std::coroutine_handle<> handle_;
+  };
+
+  /**
+   * Open a FIFO from a coroutine:
+   * int fd = co_await opener.open(path, O_WRONLY);
+   *
+   * @param[in] path  FIFO path, must outlive the await.
+   * @param[in] flags open() flags.
+   * @return          Awaitable giving the descriptor.
+   */
+  Awaitable
+  open(const char *const path,
+       const int flags) const noexcept{
+    return Awaitable(opener_, path, flags);
+  }
+#endif /* MKFIFO_HPP_COROUTINE */
+
+private:
+  /**
+   * Owned opener, or nullptr.
+   */
+  mkfifo_opener *opener_;
+};
+#endif /* __linux__ */
+
+} /* namespace libmkfifo */
+
+#endif /* MKFIFO_HPP */
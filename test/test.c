@@ -6,20 +6,134 @@
  * This software has been placed into the public domain using CC0.
  */
 
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../src/mkfifo.h"
 #include "test.h"
 
 /**
- * Call @ref mkfifo_main with the given arguments.
+ * Largest record payload written by @ref test_fifo_writer_start.
+ */
+#define TEST_RECORD_MAX 20000
+
+/**
+ * Maximum number of arguments passed by @ref test_mkfifo_main.
+ */
+#define TEST_MAX_ARGS 20
+
+/**
+ * Number of test cases run at the same time.
+ */
+#define TEST_JOBS 8
+
+/**
+ * Permissions of a FIFO created without (-m mode) under umask 022.
+ */
+#define TEST_DEFAULT_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+
+/**
+ * Default number of FIFO's created by each stress case.
+ */
+#define TEST_STRESS_FIFOS 100000
+
+/**
+ * Size of the file pumped into FIFO's.
+ */
+#define TEST_PUMP_LEN (300 * 1024 + 17)
+
+/**
+ * Number of records written by each merge or record pump writer.
+ */
+#define TEST_MERGE_RECORDS 200
+
+/**
+ * Thread running one side of a FIFO while @ref mkfifo_main runs the other.
+ */
+struct test_peer{
+  /**
+   * Thread running the peer.
+   */
+  pthread_t thread;
+
+  /**
+   * FIFO the peer reads or writes.
+   */
+  const char *path;
+
+  /**
+   * Input file of a record pump, or output file of a collector.
+   */
+  const char *file;
+
+  /**
+   * Number of bytes to read, or number of records to write.
+   */
+  size_t len;
+
+  /**
+   * Every payload byte of a record writer.
+   */
+  char c;
+
+  /**
+   * Records use length headers instead of newlines.
+   */
+  bool framed;
+};
+
+/**
+ * One test case, run in its own sandbox directory.
+ */
+struct test_case{
+  /**
+   * Name printed when the case fails to clean up.
+   */
+  const char *name;
+
+  /**
+   * Run the case with FIFO's and files created under @p dir.
+   */
+  void (*run)(const char *dir);
+};
+
+/**
+ * Build a path to @p name inside a sandbox directory.
+ *
+ * @param[out] path Buffer of PATH_MAX bytes.
+ * @param[in]  dir  Sandbox directory.
+ * @param[in]  name File name.
+ * @return          @p path
+ */
+static const char *
+test_path(char *const path,
+          const char *const dir,
+          const char *const name){
+  assert(snprintf(path, PATH_MAX, "%s/%s", dir, name) < PATH_MAX);
+  return path;
+}
+
+/**
+ * Call @ref mkfifo_main in this process with the given arguments.
  *
  * @param[in] mode_str           Corresponds to the (-m mode) argument.
  * @param[in] extra_arg          Add an invalid argument to the argument list.
@@ -31,50 +145,28 @@ test_mkfifo_main(const char *const mode_str,
                  const bool extra_arg,
                  const int expect_exit_status,
                  const char *const file_list, ...){
-  const size_t MAX_ARGS = 20;
-  const size_t MAX_ARG_LEN = 255;
-  size_t i;
-  int exit_status;
-  int status;
-  pid_t pid;
+  char *argv[TEST_MAX_ARGS + 1];
   int argc;
-  char **argv;
   const char *file;
   va_list ap;
 
   argc = 0;
-  argv = malloc(MAX_ARGS * sizeof(argv));
-  assert(argv);
-  for(i = 0; i < MAX_ARGS; i++){
-    argv[i] = malloc(MAX_ARG_LEN * sizeof(*argv));
-    assert(argv[i]);
-  }
-  strcpy(argv[argc++], "mkfifo");
+  argv[argc++] = "mkfifo";
   if(extra_arg){
-    strcpy(argv[argc++], "-a");
+    argv[argc++] = "-a";
   }
   if(mode_str){
-    strcpy(argv[argc++], "-m");
-    strcpy(argv[argc++], mode_str);
+    argv[argc++] = "-m";
+    argv[argc++] = (char *)mode_str;
   }
   va_start(ap, file_list);
   for(file = file_list; file; file = va_arg(ap, const char *const)){
-    strcpy(argv[argc++], file);
+    assert(argc < TEST_MAX_ARGS);
+    argv[argc++] = (char *)file;
   }
   va_end(ap);
-  pid = fork();
-  assert(pid >= 0);
-  if(pid == 0){
-    exit_status = mkfifo_main(argc, argv);
-    exit(exit_status);
-  }
-  assert(waitpid(pid, &status, 0) == pid);
-  assert(WIFEXITED(status));
-  assert(WEXITSTATUS(status) == expect_exit_status);
-  for(i = 0; i < MAX_ARGS; i++){
-    free(argv[i]);
-  }
-  free(argv);
+  argv[argc] = NULL;
+  assert(mkfifo_main(argc, argv) == expect_exit_status);
 }
 
 /**
@@ -99,70 +191,2229 @@ test_check_and_remove_fifo(const char *const path,
 }
 
 /**
- * Run all test cases for the mkfifo utility.
+ * Fill a buffer with a repeatable byte pattern.
+ *
+ * @param[out] buf Buffer to fill.
+ * @param[in]  len Number of bytes in @p buf.
+ */
+static void
+test_pattern(char *const buf,
+             const size_t len){
+  size_t i;
+
+  for(i = 0; i < len; i++){
+    buf[i] = (char)(i * 31 + 7);
+  }
+}
+
+/**
+ * Write @p len bytes of @ref test_pattern to a new file.
+ *
+ * @param[in] path File to create.
+ * @param[in] len  Number of bytes to write.
+ */
+static void
+test_write_pattern_file(const char *const path,
+                        const size_t len){
+  char *buf;
+  FILE *fp;
+
+  buf = malloc(len);
+  assert(buf);
+  test_pattern(buf, len);
+  fp = fopen(path, "we");
+  assert(fp);
+  assert(fwrite(buf, 1, len, fp) == len);
+  assert(fclose(fp) == 0);
+  free(buf);
+}
+
+/**
+ * Wait until @p path exists as a FIFO.
+ *
+ * @param[in] path FIFO created by @ref mkfifo_main on another thread.
+ */
+static void
+test_wait_fifo(const char *const path){
+  struct stat sb;
+
+  while(stat(path, &sb) != 0 || !S_ISFIFO(sb.st_mode)){
+    usleep(1000);
+  }
+}
+
+/**
+ * Start a thread running one side of a FIFO.
+ *
+ * @param[in] run  Thread body.
+ * @param[in] path FIFO to read or write.
+ * @param[in] file See @ref test_peer.
+ * @param[in] len  See @ref test_peer.
+ * @param[in] c    See @ref test_peer.
+ * @param[in] framed See @ref test_peer.
+ * @return         Peer to pass to @ref test_peer_wait.
+ */
+static struct test_peer *
+test_peer_start(void *(*run)(void *),
+                const char *const path,
+                const char *const file,
+                const size_t len,
+                const char c,
+                const bool framed){
+  struct test_peer *peer;
+
+  peer = malloc(sizeof(*peer));
+  assert(peer);
+  peer->path = path;
+  peer->file = file;
+  peer->len = len;
+  peer->c = c;
+  peer->framed = framed;
+  assert(pthread_create(&peer->thread, NULL, run, peer) == 0);
+  return peer;
+}
+
+/**
+ * Wait for a peer started by @ref test_peer_start to finish its checks.
+ *
+ * @param[in] peer Peer to join and free.
+ */
+static void
+test_peer_wait(struct test_peer *const peer){
+  assert(pthread_join(peer->thread, NULL) == 0);
+  free(peer);
+}
+
+/**
+ * Wait for a FIFO to appear, read it until end-of-file, and check the data
+ * matches @ref test_pattern.
+ *
+ * @param[in] arg See @ref test_peer, reading len bytes from path.
+ * @return        NULL
+ */
+static void *
+test_fifo_reader(void *const arg){
+  const struct test_peer *const peer = arg;
+  char *expect;
+  char *buf;
+  size_t total;
+  ssize_t nread;
+  int fd;
+
+  test_wait_fifo(peer->path);
+  fd = open(peer->path, O_RDONLY | O_CLOEXEC);
+  assert(fd >= 0);
+  expect = malloc(peer->len);
+  buf = malloc(peer->len + 1);
+  assert(expect && buf);
+  test_pattern(expect, peer->len);
+  total = 0;
+  while((nread = read(fd, buf + total, peer->len + 1 - total)) > 0){
+    total += (size_t)nread;
+  }
+  assert(close(fd) == 0);
+  assert(total == peer->len);
+  assert(memcmp(buf, expect, peer->len) == 0);
+  free(expect);
+  free(buf);
+  return NULL;
+}
+
+/**
+ * Read one byte from a FIFO and go away, leaving its writer to get EPIPE.
+ *
+ * @param[in] arg See @ref test_peer.
+ * @return        NULL.
+ */
+static void *
+test_fifo_quitter(void *const arg){
+  const struct test_peer *const peer = arg;
+  char c;
+  int fd;
+
+  test_wait_fifo(peer->path);
+  fd = open(peer->path, O_RDONLY | O_CLOEXEC);
+  assert(fd >= 0);
+  assert(read(fd, &c, 1) == 1);
+  assert(close(fd) == 0);
+  return NULL;
+}
+
+/**
+ * Start a @ref test_fifo_reader thread.
+ *
+ * @param[in] path FIFO to read.
+ * @param[in] len  Number of bytes expected.
+ * @return         See @ref test_peer_wait.
+ */
+static struct test_peer *
+test_fifo_reader_start(const char *const path,
+                       const size_t len){
+  return test_peer_start(test_fifo_reader, path, NULL, len, 0, false);
+}
+
+/**
+ * Payload length of a record written by @ref test_fifo_writer_start.
+ *
+ * @param[in] i Record index.
+ * @return      Payload length, some larger than PIPE_BUF.
+ */
+static size_t
+test_record_len(const size_t i){
+  return (i * 7919) % TEST_RECORD_MAX + 1;
+}
+
+/**
+ * Write records in small pieces, so that records from several writers
+ * would interleave if written to the same FIFO without coordination.
+ *
+ * @param[in] fd       File descriptor to write to.
+ * @param[in] c        Every payload byte of this writer.
+ * @param[in] nrecords Number of records to write.
+ * @param[in] framed   Use length headers instead of newlines.
+ * @return             Number of bytes written.
+ */
+static size_t
+test_write_records(const int fd,
+                   const char c,
+                   const size_t nrecords,
+                   const bool framed){
+  const size_t PIECE = 1000;
+  char *rec;
+  size_t total;
+  size_t len;
+  size_t off;
+  size_t n;
+  size_t i;
+
+  rec = malloc(TEST_RECORD_MAX + 4);
+  assert(rec);
+  total = 0;
+  for(i = 0; i < nrecords; i++){
+    len = test_record_len(i);
+    off = 0;
+    if(framed){
+      rec[off++] = (char)(len >> 24);
+      rec[off++] = (char)(len >> 16);
+      rec[off++] = (char)(len >> 8);
+      rec[off++] = (char)len;
+    }
+    memset(&rec[off], c, len);
+    off += len;
+    if(!framed){
+      rec[off++] = '\n';
+    }
+    for(n = 0; n < off; n += PIECE){
+      assert(write(fd, &rec[n], off - n < PIECE ? off - n : PIECE) > 0);
+    }
+    total += off;
+  }
+  free(rec);
+  return total;
+}
+
+/**
+ * Create a file holding records from @ref test_write_records.
+ *
+ * @param[in] path     File to create.
+ * @param[in] c        Every payload byte of this writer.
+ * @param[in] nrecords Number of records to write.
+ * @param[in] framed   Use length headers instead of newlines.
+ * @return             Size of the file.
+ */
+static size_t
+test_write_records_file(const char *const path,
+                        const char c,
+                        const size_t nrecords,
+                        const bool framed){
+  size_t total;
+  int fd;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  assert(fd >= 0);
+  total = test_write_records(fd, c, nrecords, framed);
+  assert(close(fd) == 0);
+  return total;
+}
+
+/**
+ * Wait for a FIFO to appear and then write records to it with
+ * @ref test_write_records.
+ *
+ * @param[in] arg See @ref test_peer, writing len records of c to path.
+ * @return        NULL
+ */
+static void *
+test_fifo_writer(void *const arg){
+  const struct test_peer *const peer = arg;
+  int fd;
+
+  test_wait_fifo(peer->path);
+  fd = open(peer->path, O_WRONLY | O_CLOEXEC);
+  assert(fd >= 0);
+  test_write_records(fd, peer->c, peer->len, peer->framed);
+  assert(close(fd) == 0);
+  return NULL;
+}
+
+/**
+ * Start a @ref test_fifo_writer thread.
+ *
+ * @param[in] path     FIFO to write.
+ * @param[in] c        Every payload byte of this writer.
+ * @param[in] nrecords Number of records to write.
+ * @param[in] framed   Use length headers instead of newlines.
+ * @return             See @ref test_peer_wait.
+ */
+static struct test_peer *
+test_fifo_writer_start(const char *const path,
+                       const char c,
+                       const size_t nrecords,
+                       const bool framed){
+  return test_peer_start(test_fifo_writer, path, NULL, nrecords, c, framed);
+}
+
+/**
+ * Run a record pump (-r format -p input) into a FIFO that other pumps may
+ * already have created.
+ *
+ * @param[in] arg See @ref test_peer, pumping file into path.
+ * @return        NULL
+ */
+static void *
+test_record_pump(void *const arg){
+  const struct test_peer *const peer = arg;
+  char *argv[7];
+
+  argv[0] = "mkfifo";
+  argv[1] = "-r";
+  argv[2] = peer->framed ? "length" : "line";
+  argv[3] = "-p";
+  argv[4] = (char *)peer->file;
+  argv[5] = (char *)peer->path;
+  argv[6] = NULL;
+  assert(mkfifo_main(6, argv) == EXIT_SUCCESS);
+  return NULL;
+}
+
+/**
+ * Start a @ref test_record_pump thread.
+ *
+ * @param[in] input  Input file of records.
+ * @param[in] path   FIFO to create or share.
+ * @param[in] framed Records use length headers instead of newlines.
+ * @return           See @ref test_peer_wait.
+ */
+static struct test_peer *
+test_record_pump_start(const char *const input,
+                       const char *const path,
+                       const bool framed){
+  return test_peer_start(test_record_pump, path, input, 0, 0, framed);
+}
+
+/**
+ * Wait for a FIFO to appear and copy exactly len bytes from it into a file,
+ * without stopping when one of several writers closes the FIFO.
+ *
+ * @param[in] arg See @ref test_peer, copying len bytes from path to file.
+ * @return        NULL
+ */
+static void *
+test_fifo_collect(void *const arg){
+  const struct test_peer *const peer = arg;
+  char *buf;
+  size_t total;
+  ssize_t nread;
+  int fd;
+  int hold_fd;
+  FILE *fp;
+
+  test_wait_fifo(peer->path);
+  fd = open(peer->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  assert(fd >= 0);
+  hold_fd = open(peer->path, O_WRONLY | O_CLOEXEC);
+  assert(hold_fd >= 0);
+  assert(fcntl(fd, F_SETFL, 0) == 0);
+  buf = malloc(peer->len);
+  assert(buf);
+  for(total = 0; total < peer->len; total += (size_t)nread){
+    nread = read(fd, &buf[total], peer->len - total);
+    assert(nread > 0);
+  }
+  assert(close(hold_fd) == 0);
+  assert(close(fd) == 0);
+  fp = fopen(peer->file, "we");
+  assert(fp);
+  assert(fwrite(buf, 1, peer->len, fp) == peer->len);
+  assert(fclose(fp) == 0);
+  free(buf);
+  return NULL;
+}
+
+/**
+ * Start a @ref test_fifo_collect thread.
+ *
+ * @param[in] path     FIFO to read.
+ * @param[in] out_path File to create with the data.
+ * @param[in] len      Number of bytes to copy.
+ * @return             See @ref test_peer_wait.
+ */
+static struct test_peer *
+test_fifo_collect_start(const char *const path,
+                        const char *const out_path,
+                        const size_t len){
+  return test_peer_start(test_fifo_collect, path, out_path, len, 0, false);
+}
+
+/**
+ * Check the output of merge mode contains every record written by the
+ * writers from @ref test_fifo_writer_start, whole and in per-writer order.
+ *
+ * @param[in] path     Merged output file, which gets removed.
+ * @param[in] nrecords Number of records from each writer.
+ * @param[in] framed   Records use length headers instead of newlines.
+ */
+static void
+test_check_merged(const char *const path,
+                  const size_t nrecords,
+                  const bool framed){
+  const unsigned char *p;
+  size_t count[256];
+  struct stat sb;
+  char *buf;
+  size_t off;
+  size_t len;
+  size_t i;
+  FILE *fp;
+
+  assert(stat(path, &sb) == 0);
+  buf = malloc((size_t)sb.st_size);
+  assert(buf);
+  fp = fopen(path, "re");
+  assert(fp);
+  assert(fread(buf, 1, (size_t)sb.st_size, fp) == (size_t)sb.st_size);
+  assert(fclose(fp) == 0);
+  memset(count, 0, sizeof(count));
+  off = 0;
+  while(off < (size_t)sb.st_size){
+    if(framed){
+      p = (const unsigned char *)&buf[off];
+      len = (size_t)p[0] << 24 | (size_t)p[1] << 16 |
+            (size_t)p[2] << 8 | (size_t)p[3];
+      off += 4;
+    }
+    else{
+      len = (size_t)((char *)memchr(&buf[off], '\n', (size_t)sb.st_size - off) -
+                     &buf[off]);
+    }
+    p = (const unsigned char *)&buf[off];
+    assert(len == test_record_len(count[p[0]]));
+    for(i = 0; i < len; i++){
+      assert(p[i] == p[0]);
+    }
+    count[p[0]] += 1;
+    off += len + (framed ? 0 : 1);
+  }
+  assert(off == (size_t)sb.st_size);
+  assert(count['a'] == nrecords);
+  assert(count['b'] == nrecords);
+  free(buf);
+  assert(remove(path) == 0);
+}
+
+/**
+ * Invalid and conflicting arguments.
+ *
+ * @param[in] dir Sandbox directory.
  */
 static void
-test_all(void){
-  const char *const PATH_NOEXIST = "build/noexist/test-fifo";
-  const char *const PATH_MKFIFO = "build/fifo";
-  const char *const PATH_MKFIFO_2 = "build/fifo-2";
-  const mode_t default_mode = S_IRUSR | S_IWUSR |
-                              S_IRGRP |
-                              S_IROTH;
+test_case_args(const char *const dir){
+  char fifo[PATH_MAX];
+  char noexist[PATH_MAX];
+  char out[PATH_MAX];
 
-  remove(PATH_MKFIFO);
-  remove(PATH_MKFIFO_2);
+  test_path(fifo, dir, "fifo");
+  test_path(noexist, dir, "noexist/fifo");
+  test_path(out, dir, "merge-out");
 
   /* No file arguments provided. */
   test_mkfifo_main(NULL, false, EXIT_FAILURE, NULL);
 
   /* Invalid mode_str argument. */
-  test_mkfifo_main("abc", false, EXIT_FAILURE, PATH_MKFIFO, NULL);
+  test_mkfifo_main("abc", false, EXIT_FAILURE, fifo, NULL);
 
   /* Unsupported argument. */
-  test_mkfifo_main(NULL, true, EXIT_FAILURE, PATH_MKFIFO, NULL);
+  test_mkfifo_main(NULL, true, EXIT_FAILURE, fifo, NULL);
+
+  /* Invalid engine. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-e", "abc", fifo, NULL);
+
+  /* Invalid pump backend. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-b", "abc", "-p", "-", fifo,
+                   NULL);
+
+  /* Invalid slow consumer policy. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-s", "abc", "-p", "-", fifo,
+                   NULL);
+
+  /* Invalid record format. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-M", out, "-r", "abc", fifo,
+                   NULL);
+
+  /* Pump and merge at the same time. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-M", out, "-p", out, fifo,
+                   NULL);
+}
+
+/**
+ * Create one or more FIFO's with the default engine.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_create(const char *const dir){
+  char fifo[PATH_MAX];
+  char fifo_2[PATH_MAX];
+  char noexist[PATH_MAX];
+
+  test_path(fifo, dir, "fifo");
+  test_path(fifo_2, dir, "fifo-2");
+  test_path(noexist, dir, "noexist/fifo");
 
   /* Does not have permission to create FIFO. */
-  test_mkfifo_main(NULL, false, EXIT_FAILURE, PATH_NOEXIST, NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, noexist, NULL);
 
   /* Create one FIFO. */
-  test_mkfifo_main(NULL, false, EXIT_SUCCESS, PATH_MKFIFO, NULL);
-  test_check_and_remove_fifo(PATH_MKFIFO, default_mode);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
 
   /* Create multiple FIFO's. */
-  test_mkfifo_main(NULL,
-                   false,
-                   EXIT_SUCCESS,
-                   PATH_MKFIFO,
-                   PATH_MKFIFO_2,
-                   NULL);
-  test_check_and_remove_fifo(PATH_MKFIFO, default_mode);
-  test_check_and_remove_fifo(PATH_MKFIFO_2, default_mode);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, fifo, fifo_2, NULL);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  test_check_and_remove_fifo(fifo_2, TEST_DEFAULT_MODE);
 
   /* Try to create multiple FIFO's but one fails. */
-  test_mkfifo_main(NULL,
-                   false,
-                   EXIT_FAILURE,
-                   PATH_MKFIFO,
-                   PATH_NOEXIST,
-                   NULL);
-  test_check_and_remove_fifo(PATH_MKFIFO, default_mode);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, fifo, noexist, NULL);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+}
+
+/**
+ * Create FIFO's with explicit modes.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_mode(const char *const dir){
+  char fifo[PATH_MAX];
+  struct stat sb;
+
+  test_path(fifo, dir, "fifo");
 
   /* Create FIFO with a different mode. */
-  test_mkfifo_main("123", false, EXIT_SUCCESS, PATH_MKFIFO, NULL);
-  test_check_and_remove_fifo(PATH_MKFIFO, 0123);
+  test_mkfifo_main("123", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0123);
+
+  /* Four-digit octal mode. */
+  test_mkfifo_main("0640", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0640);
+
+  /* Mode bits the umask would clear. */
+  test_mkfifo_main("666", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0666);
+
+  /* Symbolic modes start from a=rw and ignore the umask. */
+  test_mkfifo_main("=rw", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0666);
+  test_mkfifo_main("u=rw,go=r", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0644);
+  test_mkfifo_main("a-w,u+w", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0644);
+  test_mkfifo_main("go=u-w", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0644);
+  test_mkfifo_main("+X,o-rw", false, EXIT_SUCCESS, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0660);
+
+  /* Invalid symbolic modes create nothing. */
+  test_mkfifo_main("u+q", false, EXIT_FAILURE, fifo, NULL);
+  test_mkfifo_main("u", false, EXIT_FAILURE, fifo, NULL);
+  test_mkfifo_main("=rw,", false, EXIT_FAILURE, fifo, NULL);
+  assert(lstat(fifo, &sb) != 0 && errno == ENOENT);
 }
 
 /**
- * Test mkfifo utility.
+ * Create multiple FIFO's with each engine, with and without statistics.
  *
- * Usage: test
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_engines(const char *const dir){
+  const char *const ENGINES[] = {"serial", "dirfd", "thread"};
+  char fifo[PATH_MAX];
+  char fifo_2[PATH_MAX];
+  char noexist[PATH_MAX];
+  size_t i;
+
+  test_path(fifo, dir, "fifo");
+  test_path(fifo_2, dir, "fifo-2");
+  test_path(noexist, dir, "noexist/fifo");
+  for(i = 0; i < sizeof(ENGINES) / sizeof(ENGINES[0]); i++){
+    /* One failing. */
+    test_mkfifo_main(NULL,
+                     false,
+                     EXIT_FAILURE,
+                     "-e",
+                     ENGINES[i],
+                     fifo,
+                     noexist,
+                     fifo_2,
+                     NULL);
+    test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+    test_check_and_remove_fifo(fifo_2, TEST_DEFAULT_MODE);
+
+    /* Statistics, one failing. */
+    test_mkfifo_main("600",
+                     false,
+                     EXIT_FAILURE,
+                     "--stats",
+                     "-e",
+                     ENGINES[i],
+                     fifo,
+                     noexist,
+                     NULL);
+    test_check_and_remove_fifo(fifo, 0600);
+  }
+}
+
+/**
+ * Create FIFO's through the library interface with each engine.
  *
- * @retval 0 All tests passed.
+ * @param[in] dir Sandbox directory.
  */
-int
-main(void){
-  test_all();
-  return 0;
+static void
+test_case_batch(const char *const dir){
+  const enum mkfifo_engine ENGINES[] = {
+    MKFIFO_ENGINE_SERIAL,
+    MKFIFO_ENGINE_DIRFD,
+    MKFIFO_ENGINE_THREAD
+  };
+  struct mkfifo_batch_ctx batch_ctx;
+  char fifo[PATH_MAX];
+  char fifo_2[PATH_MAX];
+  char noexist[PATH_MAX];
+  const char *paths[3];
+  int results[3];
+  size_t i;
+
+  paths[0] = test_path(fifo, dir, "fifo");
+  paths[1] = test_path(noexist, dir, "noexist/fifo");
+  paths[2] = test_path(fifo_2, dir, "fifo-2");
+  for(i = 0; i < sizeof(ENGINES) / sizeof(ENGINES[0]); i++){
+    memset(&batch_ctx, 0, sizeof(batch_ctx));
+    batch_ctx.mode = 0666;
+    batch_ctx.exact_mode = true;
+    batch_ctx.engine = ENGINES[i];
+    assert(mkfifo_batch(&batch_ctx, paths, 3, results) == 1);
+    assert(results[0] == 0);
+    assert(results[1] == ENOENT);
+    assert(results[2] == 0);
+
+    /* Already exists. */
+    assert(mkfifo_batch(&batch_ctx, paths, 1, results) == 1);
+    assert(results[0] == EEXIST);
+    test_check_and_remove_fifo(fifo, 0666);
+    test_check_and_remove_fifo(fifo_2, 0666);
+
+    /* Without exact_mode the umask applies. */
+    batch_ctx.exact_mode = false;
+    assert(mkfifo_batch(&batch_ctx, paths, 1, results) == 0);
+    assert(results[0] == 0);
+    test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  }
+}
+
+#ifdef __linux__
+/**
+ * Result recorded by @ref test_async_open_cb.
+ */
+struct test_async_open{
+  /**
+   * Descriptor passed to the callback.
+   */
+  int fd;
+
+  /**
+   * Error passed to the callback.
+   */
+  int err;
+
+  /**
+   * Number of callback invocations.
+   */
+  int calls;
+};
+
+/**
+ * Record the completion of an asynchronous open.
+ *
+ * @param[in] arg See @ref test_async_open.
+ * @param[in] fd  Opened descriptor, or -1.
+ * @param[in] err 0, or why the open failed.
+ */
+static void
+test_async_open_cb(void *const arg,
+                   const int fd,
+                   const int err){
+  struct test_async_open *const result = arg;
+
+  result->fd = fd;
+  result->err = err;
+  result->calls += 1;
+}
+
+/**
+ * Wait for the opener descriptor to become readable and dispatch it.
+ *
+ * @param[in] opener See @ref mkfifo_opener.
+ * @return           Number of completed opens.
+ */
+static int
+test_async_open_dispatch(struct mkfifo_opener *const opener){
+  struct pollfd pfd;
+
+  pfd.fd = mkfifo_opener_fd(opener);
+  pfd.events = POLLIN;
+  assert(poll(&pfd, 1, 5000) == 1);
+  return mkfifo_opener_dispatch(opener);
 }
 
+/**
+ * Asynchronous opens complete when the other side opens, fail when the FIFO
+ * goes away, and get canceled with the opener.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_async_open(const char *const dir){
+  struct test_async_open result;
+  struct mkfifo_opener *opener;
+  struct test_peer *peer;
+  char reader[PATH_MAX];
+  char blocked[PATH_MAX];
+  char fifo[PATH_MAX];
+  char removed[PATH_MAX];
+  char canceled[PATH_MAX];
+  char noexist[PATH_MAX];
+  int fd;
+
+  /*
+   * Each step uses its own FIFO, since a reader opened by this thread may
+   * briefly live on in a process spawned by another case.
+   */
+  test_path(reader, dir, "reader");
+  test_path(fifo, dir, "fifo");
+  test_path(blocked, dir, "blocked");
+  test_path(removed, dir, "removed");
+  test_path(canceled, dir, "canceled");
+  test_path(noexist, dir, "noexist");
+  assert(mkfifo(reader, 0600) == 0);
+  assert(mkfifo(fifo, 0600) == 0);
+  assert(mkfifo(blocked, 0600) == 0);
+  assert(mkfifo(removed, 0600) == 0);
+  assert(mkfifo(canceled, 0600) == 0);
+  assert((opener = mkfifo_opener_create()) != NULL);
+
+  /* Readers never wait. */
+  memset(&result, 0, sizeof(result));
+  fd = mkfifo_opener_open(opener,
+                          reader,
+                          O_RDONLY,
+                          test_async_open_cb,
+                          &result);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  test_check_and_remove_fifo(reader, 0600);
+
+  /* Missing path. */
+  errno = 0;
+  assert(mkfifo_opener_open(opener,
+                            noexist,
+                            O_WRONLY,
+                            test_async_open_cb,
+                            &result) == -1);
+  assert(errno == ENOENT);
+
+  /* Writer completes once a reader opens. */
+  errno = 0;
+  assert(mkfifo_opener_open(opener,
+                            fifo,
+                            O_WRONLY,
+                            test_async_open_cb,
+                            &result) == -1);
+  assert(errno == EINPROGRESS);
+  assert(mkfifo_opener_dispatch(opener) == 0);
+  assert((fd = open(fifo, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) >= 0);
+  assert(test_async_open_dispatch(opener) == 1);
+  assert(result.calls == 1 && result.err == 0 && result.fd >= 0);
+  assert(write(result.fd, "x", 1) == 1);
+  assert(close(result.fd) == 0);
+  assert(close(fd) == 0);
+  test_check_and_remove_fifo(fifo, 0600);
+
+  /* Writer completes for a reader blocked in open(), which inotify does not
+     report. */
+  memset(&result, 0, sizeof(result));
+  assert(mkfifo_opener_open(opener,
+                            blocked,
+                            O_WRONLY,
+                            test_async_open_cb,
+                            &result) == -1);
+  assert(errno == EINPROGRESS);
+  peer = test_peer_start(test_fifo_quitter, blocked, NULL, 0, 0, false);
+  while(result.calls == 0){
+    assert(test_async_open_dispatch(opener) >= 0);
+  }
+  assert(result.calls == 1 && result.err == 0 && result.fd >= 0);
+  assert(write(result.fd, "x", 1) == 1);
+  test_peer_wait(peer);
+  assert(close(result.fd) == 0);
+  test_check_and_remove_fifo(blocked, 0600);
+
+  /* Removing the FIFO fails the waiting writer. */
+  memset(&result, 0, sizeof(result));
+  assert(mkfifo_opener_open(opener,
+                            removed,
+                            O_WRONLY,
+                            test_async_open_cb,
+                            &result) == -1);
+  assert(errno == EINPROGRESS);
+  assert(unlink(removed) == 0);
+  assert(test_async_open_dispatch(opener) == 1);
+  assert(result.calls == 1 && result.err == ENOENT && result.fd == -1);
+
+  /* Destroying the opener cancels the waiting writer. */
+  memset(&result, 0, sizeof(result));
+  assert(mkfifo_opener_open(opener,
+                            canceled,
+                            O_WRONLY,
+                            test_async_open_cb,
+                            &result) == -1);
+  assert(errno == EINPROGRESS);
+  mkfifo_opener_destroy(opener);
+  assert(result.calls == 1 && result.err == ECANCELED && result.fd == -1);
+  test_check_and_remove_fifo(canceled, 0600);
+}
+#endif /* __linux__ */
+
+/**
+ * Run @ref mkfifo_main as a daemon until it receives (q).
+ *
+ * @param[in] arg See @ref test_peer, serving on path.
+ * @return        NULL
+ */
+static void *
+test_daemon_run(void *const arg){
+  const struct test_peer *const peer = arg;
+
+  test_mkfifo_main(NULL,
+                   false,
+                   EXIT_SUCCESS,
+                   "--stats",
+                   "--daemon",
+                   peer->path,
+                   NULL);
+  return NULL;
+}
+
+/**
+ * Connect to a daemon, waiting for it to start listening.
+ *
+ * @param[in] path Daemon socket.
+ * @return         Connected socket.
+ */
+static int
+test_daemon_connect(const char *const path){
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  assert(strlen(path) < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  assert(fd >= 0);
+  while(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+    assert(errno == ENOENT || errno == ECONNREFUSED);
+    usleep(1000);
+  }
+  return fd;
+}
+
+/**
+ * Send one request to a daemon and check the reply.
+ *
+ * @param[in]  fd      Connected socket.
+ * @param[in]  request Newline-separated entries.
+ * @param[in]  expect  Expected reply.
+ * @param[out] fds     Receives passed descriptors, or NULL if none expected.
+ * @param[in]  nfds    Number of descriptors expected.
+ */
+static void
+test_daemon_request(const int fd,
+                    const char *const request,
+                    const char *const expect,
+                    int *const fds,
+                    const size_t nfds){
+  union{
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * 4)];
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  char reply[256];
+  ssize_t len;
+
+  assert(send(fd, request, strlen(request), 0) == (ssize_t)strlen(request));
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = reply;
+  iov.iov_len = sizeof(reply) - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  len = recvmsg(fd, &msg, 0);
+  assert(len >= 0);
+  reply[len] = '\0';
+  assert(strcmp(reply, expect) == 0);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if(nfds == 0){
+    assert(cmsg == NULL);
+    return;
+  }
+  assert(cmsg && cmsg->cmsg_type == SCM_RIGHTS);
+  assert(cmsg->cmsg_len == CMSG_LEN(sizeof(int) * nfds));
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+}
+
+/**
+ * From a child process running as a user other than root, ask the daemon
+ * to create a FIFO owned by root, which has to be refused.
+ *
+ * @param[in] dir  Sandbox directory.
+ * @param[in] sock Daemon socket in @p dir.
+ */
+static void
+test_daemon_refused(const char *const dir,
+                    const char *const sock){
+  char request[PATH_MAX + 8];
+  char path[PATH_MAX];
+  struct stat sb;
+  pid_t pid;
+  int status;
+  int fd;
+
+  test_path(path, dir, "refused");
+  snprintf(request, sizeof(request), "c - 0:0 %s", path);
+  if(geteuid() == 0){
+    assert(chmod(dir, 0711) == 0);
+    assert(chmod(sock, 0777) == 0);
+  }
+  pid = fork();
+  assert(pid >= 0);
+  if(pid == 0){
+    if(geteuid() == 0 &&
+       (setgroups(0, NULL) != 0 ||
+        setgid(65534) != 0 ||
+        setuid(65534) != 0)){
+      _exit(EXIT_FAILURE);
+    }
+    fd = test_daemon_connect(sock);
+    test_daemon_request(fd, request, "1\n", NULL, 0);
+    _exit(EXIT_SUCCESS);
+  }
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+  assert(chmod(dir, 0700) == 0);
+  assert(lstat(path, &sb) != 0 && errno == ENOENT);
+}
+
+/**
+ * Daemon creates, opens, chowns, and removes FIFOs in batches, follows
+ * directories replaced under its cache, refuses owners a client may not
+ * give, and stops on request.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_daemon(const char *const dir){
+  struct test_peer *daemon;
+  char request[PATH_MAX * 8];
+  char sock[PATH_MAX];
+  char sub[PATH_MAX];
+  struct stat sb;
+  char buf[4];
+  int fds[2];
+  int stalled;
+  int wfd;
+  int fd;
+  int i;
+
+  test_path(sock, dir, "sock");
+  test_path(sub, dir, "sub");
+  daemon = test_peer_start(test_daemon_run, sock, NULL, 0, 0, false);
+  fd = test_daemon_connect(sock);
+
+  /* Batch with failures and an empty line. */
+  snprintf(request, sizeof(request),
+           "c - - %s/a\nc 600 - %s/b\nc - - %s/noexist/c\n"
+           "x - - %s/a\nc abc - %s/a\nc - 1: %s/a\n\nc - - %s/a",
+           dir, dir, dir, dir, dir, dir, dir);
+  test_daemon_request(fd, request, "0\n0\n2\n22\n22\n22\n17\n", NULL, 0);
+
+  /* Descriptors for (o), in order, with a readable FIFO behind them. */
+  snprintf(request, sizeof(request),
+           "o - - %s/c\nc - %u:%u %s/d\no 640 - %s/e\no - - %s/a",
+           dir, (unsigned)getuid(), (unsigned)getgid(), dir, dir, dir);
+  test_daemon_request(fd, request, "0\n0\n0\n17\n", fds, 2);
+  wfd = open(test_path(request, dir, "c"), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  assert(wfd >= 0);
+  assert(write(wfd, "abc", 3) == 3);
+  assert(close(wfd) == 0);
+  assert(read(fds[0], buf, sizeof(buf)) == 3 && memcmp(buf, "abc", 3) == 0);
+  assert(close(fds[0]) == 0);
+  assert(fstat(fds[1], &sb) == 0 && S_ISFIFO(sb.st_mode));
+  assert((sb.st_mode & 0777) == 0640);
+  assert(close(fds[1]) == 0);
+
+  /* Removal only touches FIFOs. */
+  snprintf(request, sizeof(request),
+           "u - - %s/a\nu - - %s/b\nu - - %s/c\nu - - %s/d\nu - - %s/e\n"
+           "u - - %s/a\nu - - %s",
+           dir, dir, dir, dir, dir, dir, sock);
+  test_daemon_request(fd, request, "0\n0\n0\n0\n0\n2\n22\n", NULL, 0);
+
+  /* A directory removed and created again while cached. */
+  assert(mkdir(sub, 0755) == 0);
+  snprintf(request, sizeof(request), "c - - %s/f\nu - - %s/f", sub, sub);
+  test_daemon_request(fd, request, "0\n0\n", NULL, 0);
+  assert(rmdir(sub) == 0);
+  assert(mkdir(sub, 0755) == 0);
+  snprintf(request, sizeof(request), "c 600 - %s/f", sub);
+  test_daemon_request(fd, request, "0\n", NULL, 0);
+  test_check_and_remove_fifo(test_path(request, sub, "f"), 0600);
+  assert(rmdir(sub) == 0);
+
+  /* A client that never reads its replies gets dropped, not waited on. */
+  stalled = test_daemon_connect(sock);
+  snprintf(request, sizeof(request), "u - - %s/noexist", dir);
+  for(i = 0;
+      i < 100000 &&
+      send(stalled, request, strlen(request), MSG_NOSIGNAL) > 0;
+      i++){
+  }
+  assert(i < 100000);
+  test_daemon_request(fd, request, "2\n", NULL, 0);
+  assert(close(stalled) == 0);
+
+  test_daemon_refused(dir, sock);
+
+  test_daemon_request(fd, "q", "0\n", NULL, 0);
+  assert(close(fd) == 0);
+  test_peer_wait(daemon);
+  assert(stat(sock, &sb) != 0 && errno == ENOENT);
+}
+
+/**
+ * Count the lines of a file.
+ *
+ * @param[in] path File to read.
+ * @return         Number of newlines.
+ */
+static size_t
+test_count_lines(const char *const path){
+  size_t lines;
+  FILE *fp;
+  int c;
+
+  fp = fopen(path, "re");
+  assert(fp);
+  lines = 0;
+  while((c = fgetc(fp)) != EOF){
+    lines += c == '\n';
+  }
+  assert(fclose(fp) == 0);
+  return lines;
+}
+
+/**
+ * Append a lease line for an existing FIFO to a lease index.
+ *
+ * @param[in] index  Lease index file.
+ * @param[in] expiry Wall clock time the lease expires.
+ * @param[in] owner  Owner process.
+ * @param[in] path   FIFO covered by the lease.
+ */
+static void
+test_lease_append(const char *const index,
+                  const long long expiry,
+                  const pid_t owner,
+                  const char *const path){
+  struct stat sb;
+  FILE *fp;
+
+  assert(lstat(path, &sb) == 0);
+  fp = fopen(index, "ae");
+  assert(fp);
+  assert(fprintf(fp,
+                 "%lld %ld %llu %llu %s\n",
+                 expiry,
+                 (long)owner,
+                 (unsigned long long)sb.st_dev,
+                 (unsigned long long)sb.st_ino,
+                 path) > 0);
+  assert(fclose(fp) == 0);
+}
+
+/**
+ * Leases get recorded for created FIFOs only, and the collector removes
+ * expired FIFOs whose owner exited and that nobody has open, keeping the
+ * rest and never following a symlink put in place of a directory.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_lease(const char *const dir){
+  char index[PATH_MAX];
+  char live[PATH_MAX];
+  char expired[PATH_MAX];
+  char busy[PATH_MAX];
+  char replaced[PATH_MAX];
+  char owned[PATH_MAX];
+  char sub[PATH_MAX];
+  char moved[PATH_MAX];
+  char swapped[PATH_MAX];
+  char shell_index[PATH_MAX];
+  char shell_fifo[PATH_MAX];
+  char *argv[7];
+  struct stat sb;
+  long long now;
+  pid_t dead;
+  FILE *fp;
+  long owner;
+  int tries;
+  int fd;
+
+  test_path(index, dir, "leases");
+  test_path(live, dir, "live");
+  test_path(expired, dir, "expired");
+  test_path(busy, dir, "busy");
+  test_path(replaced, dir, "replaced");
+  test_path(owned, dir, "owned");
+  test_path(sub, dir, "sub");
+  test_path(moved, dir, "moved");
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--lease", "3600",
+                   "--lease-index", index, live, NULL);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--lease", "0",
+                   "--lease-index", index, "-e", "dirfd",
+                   expired, busy, replaced, NULL);
+  /* Existing FIFO, no second lease. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--lease", "0",
+                   "--lease-index", index, live, NULL);
+  assert(test_count_lines(index) == 4);
+
+  /* The parent process owns the leases and keeps them while it runs. */
+  fp = fopen(index, "re");
+  assert(fp);
+  assert(fscanf(fp, "%*s %ld", &owner) == 1);
+  assert(fclose(fp) == 0);
+  assert(owner == (long)getppid());
+  if(owner > 1){
+    test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--gc", "--lease-index",
+                     index, NULL);
+    assert(test_count_lines(index) == 4);
+    assert(stat(expired, &sb) == 0);
+  }
+
+  /* Run in-process like the bash builtin, the caller owns the lease. */
+  test_path(shell_index, dir, "shell-leases");
+  test_path(shell_fifo, dir, "shell-fifo");
+  argv[0] = "mkfifo";
+  argv[1] = "--lease";
+  argv[2] = "0";
+  argv[3] = "--lease-index";
+  argv[4] = shell_index;
+  argv[5] = shell_fifo;
+  argv[6] = NULL;
+  assert(mkfifo_run(6, argv, getpid()) == EXIT_SUCCESS);
+  fp = fopen(shell_index, "re");
+  assert(fp);
+  assert(fscanf(fp, "%*s %ld", &owner) == 1);
+  assert(fclose(fp) == 0);
+  assert(owner == (long)getpid());
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--gc", "--lease-index",
+                   shell_index, NULL);
+  assert(test_count_lines(shell_index) == 1);
+  test_check_and_remove_fifo(shell_fifo, TEST_DEFAULT_MODE);
+  assert(remove(shell_index) == 0);
+
+  /* Invalid combinations. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--lease", "x",
+                   "--lease-index", index, live, NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--lease", "1", live, NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--gc", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--gc", "--lease-index", index,
+                   live, NULL);
+
+  /*
+   * Hand the leases to a process that exited, except for one owned by this
+   * process, and swap a leased FIFO's directory for a symlink.
+   */
+  dead = fork();
+  assert(dead >= 0);
+  if(dead == 0){
+    _exit(EXIT_SUCCESS);
+  }
+  assert(waitpid(dead, NULL, 0) == dead);
+  assert(mkfifo(owned, 0600) == 0);
+  assert(mkdir(sub, 0700) == 0);
+  test_path(swapped, sub, "swapped");
+  assert(mkfifo(swapped, 0600) == 0);
+  now = (long long)time(NULL);
+  assert(remove(index) == 0);
+  test_lease_append(index, now + 3600, dead, live);
+  test_lease_append(index, 0, dead, expired);
+  test_lease_append(index, 0, dead, busy);
+  test_lease_append(index, 0, dead, replaced);
+  test_lease_append(index, 0, getpid(), owned);
+  test_lease_append(index, 0, dead, swapped);
+  assert(rename(sub, moved) == 0);
+  assert(symlink("moved", sub) == 0);
+
+  fd = open(busy, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  assert(fd >= 0);
+  assert(unlink(replaced) == 0);
+  assert(mkfifo(replaced, 0600) == 0);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--gc", "--lease-index", index,
+                   NULL);
+  assert(stat(expired, &sb) != 0 && errno == ENOENT);
+  assert(stat(live, &sb) == 0 && stat(busy, &sb) == 0);
+  assert(stat(replaced, &sb) == 0 && stat(owned, &sb) == 0);
+  assert(stat(swapped, &sb) == 0);
+  assert(test_count_lines(index) == 3);
+
+  /*
+   * A child forked by another case holds busy open until it execs or
+   * exits, so retry while something still has it open.
+   */
+  assert(close(fd) == 0);
+  for(tries = 0; tries < 100 && stat(busy, &sb) == 0; tries++){
+    if(tries > 0){
+      usleep(10000);
+    }
+    test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--gc", "--lease-index",
+                     index, NULL);
+  }
+  assert(stat(busy, &sb) != 0 && errno == ENOENT);
+  assert(test_count_lines(index) == 2);
+  test_check_and_remove_fifo(live, TEST_DEFAULT_MODE);
+  test_check_and_remove_fifo(replaced, 0600);
+  test_check_and_remove_fifo(owned, 0600);
+  test_check_and_remove_fifo(swapped, 0600);
+  assert(unlink(sub) == 0);
+  assert(rmdir(moved) == 0);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--gc", "--lease-index", index,
+                   NULL);
+  assert(test_count_lines(index) == 1);
+  assert(remove(index) == 0);
+}
+
+/**
+ * Commands run by --exec see their FIFOs and inherited descriptors, their
+ * exit status gets passed through, and the private directory is gone
+ * afterwards.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_exec(const char *const dir){
+  char record[PATH_MAX];
+  char seen[PATH_MAX];
+  struct stat sb;
+  FILE *fp;
+
+  test_path(record, dir, "record");
+  test_mkfifo_main("600", false, EXIT_SUCCESS, "--exec", "in,out", "--",
+                   "sh", "-c",
+                   "test -p \"$1\" && test -p \"$2\" && "
+                   "test \"$(stat -c %a \"$1\")\" = 600 && "
+                   "test \"$4\" = \"--$2--\" && printf %s \"$1\" > \"$3\"",
+                   "sh", "{in}", "{out}", record, "--{out}--", NULL);
+  fp = fopen(record, "re");
+  assert(fp);
+  assert(fgets(seen, sizeof(seen), fp));
+  assert(fclose(fp) == 0);
+  assert(remove(record) == 0);
+  assert(strstr(seen, "/mkfifo.") && strstr(seen, "/in"));
+  assert(stat(seen, &sb) != 0 && errno == ENOENT);
+  *strrchr(seen, '/') = '\0';
+  assert(stat(seen, &sb) != 0 && errno == ENOENT);
+
+  /* Inherited descriptors, left-over files, and literal braces. */
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--exec", "r:r,w:w", "--",
+                   "sh", "-c",
+                   "echo hi > \"{r}\"; read x <&{r.fd}; test \"$x\" = hi && "
+                   "echo ho >&{w.fd}; read y < \"{w}\"; test \"$y\" = ho && "
+                   "test {w.fd} = 4 && test \"$0\" = {x} && "
+                   "touch \"$(dirname \"{r}\")/extra\"",
+                   "{x}", NULL);
+
+  /* Exit status and failures. */
+  test_mkfifo_main(NULL, false, 3, "--exec", "a", "--",
+                   "sh", "-c", "exit 3", NULL);
+  test_mkfifo_main(NULL, false, 127, "--exec", "a", "--",
+                   "/nonexistent/command", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--exec", "a/b", "--",
+                   "true", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--exec", "a,,b", "--",
+                   "true", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--exec", "a,a", "--",
+                   "true", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--exec", "a", NULL);
+}
+
+/**
+ * Write a string to a new file.
+ *
+ * @param[in] path File to create.
+ * @param[in] text Contents.
+ */
+static void
+test_write_text(const char *const path,
+                const char *const text){
+  FILE *fp;
+
+  fp = fopen(path, "we");
+  assert(fp);
+  assert(fputs(text, fp) >= 0);
+  assert(fclose(fp) == 0);
+}
+
+/**
+ * Run a pipeline spec and expect an exit status.
+ *
+ * @param[in] spec          Spec file to write.
+ * @param[in] text          Contents of the spec.
+ * @param[in] expect_status Expected exit status.
+ */
+static void
+test_pipeline_run(const char *const spec,
+                  const char *const text,
+                  const int expect_status){
+  test_write_text(spec, text);
+  test_mkfifo_main(NULL, false, expect_status, "--pipeline", spec, NULL);
+  assert(remove(spec) == 0);
+}
+
+/**
+ * Stages joined by FIFOs, exit status, and invalid specs.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_pipeline(const char *const dir){
+  char spec[PATH_MAX];
+  char out[PATH_MAX];
+  char text[PATH_MAX * 2];
+  char seen[16];
+  FILE *fp;
+  size_t len;
+
+  test_path(spec, dir, "spec");
+  test_path(out, dir, "out");
+  snprintf(text,
+           sizeof(text),
+           "# gen -> sort -> sink\n"
+           "stage gen test -p {raw} && printf 'c\\nb\\na\\n' >&3\n"
+           "\n"
+           "stage sort sort <&3 >&4\n"
+           "stage sink test {sorted.fd} = 3 && cat <&3 > %s\n"
+           "edge raw gen sort\n"
+           "edge sorted sort sink 65536\n",
+           out);
+  test_pipeline_run(spec, text, EXIT_SUCCESS);
+  fp = fopen(out, "re");
+  assert(fp);
+  len = fread(seen, 1, sizeof(seen), fp);
+  assert(fclose(fp) == 0);
+  assert(len == 6 && memcmp(seen, "a\nb\nc\n", 6) == 0);
+  assert(remove(out) == 0);
+
+  /* Last failing stage, and a writer outliving its reader. */
+  test_pipeline_run(spec, "stage a exit 5\nstage b exit 6\nstage c true\n", 6);
+  test_pipeline_run(spec,
+                    "stage gen yes >&3\n"
+                    "stage head head -n 1 <&3 > /dev/null\n"
+                    "edge y gen head\n",
+                    128 + SIGPIPE);
+
+  /* Invalid specs. */
+  test_pipeline_run(spec,
+                    "stage a cat <&3 >&4\nstage b cat <&3 >&4\n"
+                    "edge x a b\nedge y b a\n",
+                    EXIT_FAILURE);
+  test_pipeline_run(spec, "stage a true\nedge x a b\n", EXIT_FAILURE);
+  test_pipeline_run(spec, "stage a true\nedge x a a\n", EXIT_FAILURE);
+  test_pipeline_run(spec, "stage a true\nstage a true\n", EXIT_FAILURE);
+  test_pipeline_run(spec,
+                    "stage a true\nstage b true\nedge x a b\nedge x b a\n",
+                    EXIT_FAILURE);
+  test_pipeline_run(spec, "stage a/b true\n", EXIT_FAILURE);
+  test_pipeline_run(spec, "stage a\n", EXIT_FAILURE);
+  test_pipeline_run(spec, "stage a true\nstage b true\nedge x a b 0\n",
+                    EXIT_FAILURE);
+  test_pipeline_run(spec, "pipe a b\n", EXIT_FAILURE);
+  test_pipeline_run(spec, "# nothing\n", EXIT_FAILURE);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--pipeline", spec, NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--pipeline", spec, out, NULL);
+}
+
+/**
+ * Performance counters, alone and with statistics.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_perf(const char *const dir){
+  char fifo[PATH_MAX];
+
+  test_path(fifo, dir, "fifo");
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--perf", fifo, NULL);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "--perf", "--stats", fifo,
+                   NULL);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+}
+
+/**
+ * Pump a file into one FIFO with the default and each forced backend.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_pump(const char *const dir){
+  const char *const PUMP_BACKENDS[] = {"rw", "splice", "vmsplice"};
+  char fifo[PATH_MAX];
+  char input[PATH_MAX];
+  char noexist[PATH_MAX];
+  struct test_peer *peer;
+  size_t i;
+
+  test_path(fifo, dir, "fifo");
+  test_path(input, dir, "pump-in");
+  test_path(noexist, dir, "noexist/fifo");
+  test_write_pattern_file(input, TEST_PUMP_LEN);
+
+  /* Pump a file into the FIFO. */
+  peer = test_fifo_reader_start(fifo, TEST_PUMP_LEN);
+  test_mkfifo_main(NULL, false, EXIT_SUCCESS, "-p", input, fifo, NULL);
+  test_peer_wait(peer);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+
+  /* Pump a file into the FIFO with each backend. */
+  for(i = 0; i < sizeof(PUMP_BACKENDS) / sizeof(PUMP_BACKENDS[0]); i++){
+    peer = test_fifo_reader_start(fifo, TEST_PUMP_LEN);
+    test_mkfifo_main(NULL,
+                     false,
+                     EXIT_SUCCESS,
+                     "-b",
+                     PUMP_BACKENDS[i],
+                     "-p",
+                     input,
+                     fifo,
+                     NULL);
+    test_peer_wait(peer);
+    test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  }
+
+  /* Pump input file does not exist. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-p", noexist, fifo, NULL);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  assert(remove(input) == 0);
+}
+
+/**
+ * Fan out a file into multiple FIFO's.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_fanout(const char *const dir){
+  char fifo[PATH_MAX];
+  char fifo_2[PATH_MAX];
+  char input[PATH_MAX];
+  struct test_peer *peer;
+  struct test_peer *peer_2;
+  struct sigaction sa;
+  sigset_t mask;
+
+  test_path(fifo, dir, "fifo");
+  test_path(fifo_2, dir, "fifo-2");
+  test_path(input, dir, "pump-in");
+  test_write_pattern_file(input, TEST_PUMP_LEN);
+  peer = test_fifo_reader_start(fifo, TEST_PUMP_LEN);
+  peer_2 = test_fifo_reader_start(fifo_2, TEST_PUMP_LEN);
+  test_mkfifo_main(NULL,
+                   false,
+                   EXIT_SUCCESS,
+                   "-p",
+                   input,
+                   "-s",
+                   "block",
+                   fifo,
+                   fifo_2,
+                   NULL);
+  test_peer_wait(peer);
+  test_peer_wait(peer_2);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  test_check_and_remove_fifo(fifo_2, TEST_DEFAULT_MODE);
+
+  /* A reader going away disconnects only its output, and SIGPIPE is left
+     as it was. */
+  peer = test_fifo_reader_start(fifo, TEST_PUMP_LEN);
+  peer_2 = test_peer_start(test_fifo_quitter, fifo_2, NULL, 0, 0, false);
+  test_mkfifo_main(NULL,
+                   false,
+                   EXIT_SUCCESS,
+                   "-p",
+                   input,
+                   "-s",
+                   "block",
+                   fifo,
+                   fifo_2,
+                   NULL);
+  test_peer_wait(peer);
+  test_peer_wait(peer_2);
+  assert(sigaction(SIGPIPE, NULL, &sa) == 0);
+  assert(sa.sa_handler == SIG_DFL);
+  assert(pthread_sigmask(SIG_BLOCK, NULL, &mask) == 0);
+  assert(sigismember(&mask, SIGPIPE) == 0);
+  assert(sigpending(&mask) == 0);
+  assert(sigismember(&mask, SIGPIPE) == 0);
+  test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  test_check_and_remove_fifo(fifo_2, TEST_DEFAULT_MODE);
+  assert(remove(input) == 0);
+}
+
+/**
+ * Merge newline-delimited and length-delimited records from multiple
+ * FIFO's.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_merge(const char *const dir){
+  char fifo[PATH_MAX];
+  char fifo_2[PATH_MAX];
+  char out[PATH_MAX];
+  struct test_peer *peer;
+  struct test_peer *peer_2;
+  int framed;
+
+  test_path(fifo, dir, "fifo");
+  test_path(fifo_2, dir, "fifo-2");
+  test_path(out, dir, "merge-out");
+  for(framed = 0; framed < 2; framed++){
+    peer = test_fifo_writer_start(fifo, 'a', TEST_MERGE_RECORDS, framed);
+    peer_2 = test_fifo_writer_start(fifo_2, 'b', TEST_MERGE_RECORDS, framed);
+    test_mkfifo_main(NULL,
+                     false,
+                     EXIT_SUCCESS,
+                     "-M",
+                     out,
+                     "-r",
+                     framed ? "length" : "line",
+                     fifo,
+                     fifo_2,
+                     NULL);
+    test_peer_wait(peer);
+    test_peer_wait(peer_2);
+    test_check_merged(out, TEST_MERGE_RECORDS, framed);
+    test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+    test_check_and_remove_fifo(fifo_2, TEST_DEFAULT_MODE);
+  }
+}
+
+/**
+ * Several record pumps sharing one FIFO.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_record_pump(const char *const dir){
+  char fifo[PATH_MAX];
+  char input[PATH_MAX];
+  char input_2[PATH_MAX];
+  char out[PATH_MAX];
+  struct test_peer *peer;
+  struct test_peer *peer_2;
+  struct test_peer *peer_3;
+  size_t len;
+  int framed;
+
+  test_path(fifo, dir, "fifo");
+  test_path(input, dir, "pump-in");
+  test_path(input_2, dir, "pump-in-2");
+  test_path(out, dir, "merge-out");
+  for(framed = 0; framed < 2; framed++){
+    len = test_write_records_file(input, 'a', TEST_MERGE_RECORDS, framed);
+    len += test_write_records_file(input_2, 'b', TEST_MERGE_RECORDS, framed);
+    peer_3 = test_fifo_collect_start(fifo, out, len);
+    peer = test_record_pump_start(input, fifo, framed);
+    peer_2 = test_record_pump_start(input_2, fifo, framed);
+    test_peer_wait(peer);
+    test_peer_wait(peer_2);
+    test_peer_wait(peer_3);
+    test_check_merged(out, TEST_MERGE_RECORDS, framed);
+    test_check_and_remove_fifo(fifo, TEST_DEFAULT_MODE);
+  }
+  assert(remove(input) == 0);
+  assert(remove(input_2) == 0);
+}
+
+/**
+ * Create a list of @p n FIFO paths under @p dir in one allocation, spread
+ * over @p nshards contiguous subdirectories (created here) or flat when
+ * @p nshards is 0.
+ *
+ * @param[in] dir     Sandbox directory.
+ * @param[in] n       Number of paths.
+ * @param[in] nshards Number of subdirectories, or 0.
+ * @param[in] tag     Prefix of each FIFO name, so several creators can
+ *                    share @p dir without colliding.
+ * @return            NULL-terminated path list, free() when done.
+ */
+static char **
+test_stress_paths(const char *const dir,
+                  const size_t n,
+                  const size_t nshards,
+                  const char *const tag){
+  const size_t PATH_LEN = strlen(dir) + strlen(tag) + 32;
+  char shard[PATH_MAX];
+  char **paths;
+  char *names;
+  size_t i;
+
+  paths = malloc((n + 1) * sizeof(*paths) + n * PATH_LEN);
+  assert(paths);
+  names = (char *)&paths[n + 1];
+  for(i = 0; i < nshards; i++){
+    assert(snprintf(shard, sizeof(shard), "%s/s%03zu", dir, i) <
+           (int)sizeof(shard));
+    assert(mkdir(shard, 0755) == 0 || errno == EEXIST);
+  }
+  for(i = 0; i < n; i++){
+    paths[i] = &names[i * PATH_LEN];
+    if(nshards){
+      snprintf(paths[i], PATH_LEN, "%s/s%03zu/%s%07zu",
+               dir, i * nshards / n, tag, i);
+    }
+    else{
+      snprintf(paths[i], PATH_LEN, "%s/%s%07zu", dir, tag, i);
+    }
+  }
+  paths[n] = NULL;
+  return paths;
+}
+
+/**
+ * Run @ref mkfifo_main on a large list of paths.
+ *
+ * @param[in] engine One of serial, dirfd, or thread.
+ * @param[in] mode   (-m mode) argument, or NULL.
+ * @param[in] paths  NULL-terminated list of FIFO's to create.
+ * @return           Exit status of @ref mkfifo_main.
+ */
+static int
+test_stress_mkfifo(const char *const engine,
+                   const char *const mode,
+                   char *const paths[]){
+  char **argv;
+  size_t n;
+  int argc;
+  int status;
+
+  for(n = 0; paths[n]; n++){
+  }
+  argv = malloc((n + 6) * sizeof(*argv));
+  assert(argv);
+  argc = 0;
+  argv[argc++] = "mkfifo";
+  argv[argc++] = "-e";
+  argv[argc++] = (char *)engine;
+  if(mode){
+    argv[argc++] = "-m";
+    argv[argc++] = (char *)mode;
+  }
+  memcpy(&argv[argc], paths, (n + 1) * sizeof(*argv));
+  status = mkfifo_main(argc + (int)n, argv);
+  free(argv);
+  return status;
+}
+
+/**
+ * Batched version of @ref test_check_and_remove_fifo: check that every
+ * entry of @p dir is a FIFO with the expected permissions and remove it,
+ * descending one level into subdirectories, which get removed too.
+ *
+ * @param[in] dir          Directory to empty.
+ * @param[in] expect_perms Expected permission bits of every FIFO.
+ * @return                 Number of FIFO's removed.
+ */
+static size_t
+test_check_and_remove_fifos(const char *const dir,
+                            const mode_t expect_perms){
+  char sub[PATH_MAX];
+  struct dirent *ent;
+  struct stat sb;
+  size_t count;
+  DIR *dp;
+  int fd;
+
+  dp = opendir(dir);
+  assert(dp);
+  fd = dirfd(dp);
+  count = 0;
+  while((ent = readdir(dp)) != NULL){
+    if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+      continue;
+    }
+    assert(fstatat(fd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0);
+    if(S_ISDIR(sb.st_mode)){
+      count += test_check_and_remove_fifos(test_path(sub, dir, ent->d_name),
+                                           expect_perms);
+      assert(unlinkat(fd, ent->d_name, AT_REMOVEDIR) == 0);
+      continue;
+    }
+    assert(S_ISFIFO(sb.st_mode));
+    assert((sb.st_mode & 0777) == expect_perms);
+    assert(unlinkat(fd, ent->d_name, 0) == 0);
+    count += 1;
+  }
+  assert(closedir(dp) == 0);
+  return count;
+}
+
+/**
+ * Create FIFO's from templates, which get distinct names.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_template(const char *const dir){
+  char sub[PATH_MAX];
+  char tmpl[PATH_MAX];
+  char tmpl_2[PATH_MAX];
+  char short_tmpl[PATH_MAX];
+  char inner[PATH_MAX];
+  char noexist[PATH_MAX];
+
+  test_path(sub, dir, "t");
+  test_path(tmpl, dir, "t/job.XXXXXX");
+  test_path(tmpl_2, dir, "t/XXXXXXXXXX");
+  test_path(short_tmpl, dir, "t/job.XXXXX");
+  test_path(inner, dir, "t/XXXXXX/job");
+  test_path(noexist, dir, "noexist/XXXXXX");
+  assert(mkdir(sub, 0700) == 0);
+
+  /* The same template several times. */
+  test_mkfifo_main("600", false, EXIT_SUCCESS, "-t", tmpl, tmpl, tmpl,
+                   tmpl_2, NULL);
+  assert(test_check_and_remove_fifos(sub, 0600) == 4);
+
+  /* Too few X characters, X characters not at the end, and no directory. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-t", short_tmpl, tmpl, NULL);
+  assert(test_check_and_remove_fifos(sub, TEST_DEFAULT_MODE) == 1);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-t", inner, NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-t", noexist, NULL);
+  assert(test_check_and_remove_fifos(sub, TEST_DEFAULT_MODE) == 0);
+  assert(rmdir(sub) == 0);
+}
+
+/**
+ * Thread body keeping a pool of four FIFO's filled.
+ *
+ * @param[in] arg See @ref test_peer, whose path is the pool directory.
+ * @return        NULL
+ */
+static void *
+test_pool_run(void *const arg){
+  const struct test_peer *const peer = arg;
+
+  test_mkfifo_main("600",
+                   false,
+                   EXIT_SUCCESS,
+                   "--pool",
+                   peer->path,
+                   "--pool-size",
+                   "4",
+                   NULL);
+  return NULL;
+}
+
+/**
+ * Wait until a pool holds a number of ready FIFO's.
+ *
+ * @param[in] pool  Pool directory.
+ * @param[in] count Number of entries not starting with '.'.
+ */
+static void
+test_pool_wait(const char *const pool,
+               const size_t count){
+  struct dirent *ent;
+  size_t n;
+  DIR *dp;
+
+  do{
+    usleep(1000);
+    dp = opendir(pool);
+    assert(dp);
+    n = 0;
+    while((ent = readdir(dp)) != NULL){
+      n += ent->d_name[0] != '.';
+    }
+    assert(closedir(dp) == 0);
+  } while(n != count);
+}
+
+/**
+ * Claim FIFO's from a pool through the library and the utility, fall back
+ * to creating them when the pool is empty, and stop the filler by removing
+ * the pool.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_case_pool(const char *const dir){
+  struct test_peer *filler;
+  struct dirent *ent;
+  char pool[PATH_MAX];
+  char empty[PATH_MAX];
+  char fifo[PATH_MAX];
+  char fifo_2[PATH_MAX];
+  char noexist[PATH_MAX];
+  char stale[PATH_MAX];
+  char name[64];
+  struct stat sb;
+  DIR *dp;
+  int fd;
+
+  test_path(pool, dir, "pool");
+  test_path(empty, dir, "empty");
+  test_path(fifo, dir, "fifo");
+  test_path(fifo_2, dir, "fifo-2");
+  test_path(noexist, dir, "noexist");
+  assert(mkdir(pool, 0700) == 0);
+  assert(mkdir(empty, 0700) == 0);
+
+  /* An entry left by an earlier filler with the same PID is not replaced. */
+  snprintf(name, sizeof(name), "fifo.%ld.0", (long)getpid());
+  test_path(stale, pool, name);
+  fd = open(stale, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  filler = test_peer_start(test_pool_run, pool, NULL, 0, 0, false);
+  test_pool_wait(pool, 4);
+  assert(lstat(stale, &sb) == 0 && S_ISREG(sb.st_mode));
+  assert(unlink(stale) == 0);
+  test_pool_wait(pool, 4);
+
+  /* Claimed FIFO's keep the mode from the pool, which gets refilled. */
+  assert(mkfifo_pool_claim(pool, fifo) == 0);
+  assert(mkfifo_pool_claim(pool, fifo) == -1 && errno == EEXIST);
+  test_check_and_remove_fifo(fifo, 0600);
+  test_mkfifo_main("644", false, EXIT_SUCCESS, "--claim", pool, fifo,
+                   fifo_2, NULL);
+  test_check_and_remove_fifo(fifo, 0600);
+  test_check_and_remove_fifo(fifo_2, 0600);
+  test_pool_wait(pool, 4);
+
+  /* Empty or missing pool. */
+  assert(mkfifo_pool_claim(empty, fifo) == -1 && errno == EAGAIN);
+  test_mkfifo_main("640", false, EXIT_SUCCESS, "--claim", empty, fifo, NULL);
+  test_check_and_remove_fifo(fifo, 0640);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--claim", noexist, fifo,
+                   NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "-t", "--claim", pool, fifo,
+                   NULL);
+  assert(rmdir(empty) == 0);
+
+  /* Invalid filler options. */
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--pool", empty, NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--pool", empty,
+                   "--pool-size", "0", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--pool", empty,
+                   "--pool-size", "1", NULL);
+  test_mkfifo_main(NULL, false, EXIT_FAILURE, "--pool", pool,
+                   "--pool-size", "1", fifo, NULL);
+
+  /* Removing the pool stops the filler. */
+  do{
+    dp = opendir(pool);
+    assert(dp);
+    while((ent = readdir(dp)) != NULL){
+      if(strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0){
+        unlinkat(dirfd(dp), ent->d_name, 0);
+      }
+    }
+    assert(closedir(dp) == 0);
+  } while(rmdir(pool) != 0);
+  test_peer_wait(filler);
+}
+
+/**
+ * Number of FIFO's created by each stress case, set by (test stress n).
+ */
+static size_t test_stress_fifos = TEST_STRESS_FIFOS;
+
+/**
+ * Print the creation rate of a stress run.
+ *
+ * @param[in] name  What was measured.
+ * @param[in] n     Number of FIFO's created.
+ * @param[in] start Time the run started, from clock_gettime().
+ */
+static void
+test_stress_report(const char *const name,
+                   const size_t n,
+                   const struct timespec *const start){
+  struct timespec end;
+  double sec;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  sec = (double)(end.tv_sec - start->tv_sec) +
+        (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+  fprintf(stderr,
+          "stress: %s: %zu fifos in %.2f s (%.0f/s)\n",
+          name,
+          n,
+          sec,
+          (double)n / sec);
+}
+
+/**
+ * Create @ref test_stress_fifos FIFO's with each engine, flat and sharded,
+ * with the default mode and with (-m mode).
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_stress_engines(const char *const dir){
+  const char *const ENGINES[] = {"serial", "dirfd", "thread"};
+  const size_t SHARDS[] = {0, 256};
+  const size_t n = test_stress_fifos;
+  struct timespec start;
+  char name[64];
+  char **paths;
+  size_t i;
+  size_t j;
+  size_t k;
+
+  for(i = 0; i < sizeof(ENGINES) / sizeof(ENGINES[0]); i++){
+    for(j = 0; j < sizeof(SHARDS) / sizeof(SHARDS[0]); j++){
+      for(k = 0; k < 2; k++){
+        paths = test_stress_paths(dir, n, SHARDS[j], "f");
+        snprintf(name, sizeof(name), "%s %s%s", ENGINES[i],
+                 SHARDS[j] ? "sharded" : "flat", k ? " -m 600" : "");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        assert(test_stress_mkfifo(ENGINES[i],
+                                  k ? "600" : NULL,
+                                  paths) == EXIT_SUCCESS);
+        test_stress_report(name, n, &start);
+        assert(test_check_and_remove_fifos(dir,
+                                           k ? 0600 : TEST_DEFAULT_MODE) == n);
+        free(paths);
+      }
+    }
+  }
+}
+
+/**
+ * Arguments of one @ref test_stress_creator.
+ */
+struct test_stress_creator_arg{
+  /**
+   * Thread running the creator.
+   */
+  pthread_t thread;
+
+  /**
+   * Engine passed to (-e engine).
+   */
+  const char *engine;
+
+  /**
+   * FIFO's to create.
+   */
+  char **paths;
+
+  /**
+   * Exit status of @ref mkfifo_main.
+   */
+  int status;
+};
+
+/**
+ * Thread creating a list of FIFO's with @ref mkfifo_main.
+ *
+ * @param[in,out] arg See @ref test_stress_creator_arg.
+ * @return            NULL
+ */
+static void *
+test_stress_creator(void *const arg){
+  struct test_stress_creator_arg *const creator = arg;
+
+  creator->status = test_stress_mkfifo(creator->engine, NULL, creator->paths);
+  return NULL;
+}
+
+/**
+ * Run one creator per engine at the same time.
+ *
+ * @param[in] dir     Sandbox directory.
+ * @param[in] subdirs Give each creator its own directory.
+ * @param[in] overlap Have every creator try the same names.
+ */
+static void
+test_stress_concurrent(const char *const dir,
+                       const bool subdirs,
+                       const bool overlap){
+  const char *const ENGINES[] = {"serial", "dirfd", "thread"};
+  const size_t NCREATORS = sizeof(ENGINES) / sizeof(ENGINES[0]);
+  struct test_stress_creator_arg creators[3];
+  const size_t n = test_stress_fifos / NCREATORS;
+  struct timespec start;
+  char sub[PATH_MAX];
+  char tag[8];
+  size_t i;
+
+  for(i = 0; i < NCREATORS; i++){
+    snprintf(tag, sizeof(tag), "c%zu-", overlap ? 0 : i);
+    if(subdirs){
+      snprintf(tag, sizeof(tag), "d%zu", i);
+      test_path(sub, dir, tag);
+      assert(mkdir(sub, 0755) == 0);
+      creators[i].paths = test_stress_paths(sub, n, 0, "f");
+    }
+    else{
+      creators[i].paths = test_stress_paths(dir, n, 0, tag);
+    }
+    creators[i].engine = ENGINES[i];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i = 0; i < NCREATORS; i++){
+    assert(pthread_create(&creators[i].thread,
+                          NULL,
+                          test_stress_creator,
+                          &creators[i]) == 0);
+  }
+  for(i = 0; i < NCREATORS; i++){
+    assert(pthread_join(creators[i].thread, NULL) == 0);
+    assert(overlap || creators[i].status == EXIT_SUCCESS);
+    free(creators[i].paths);
+  }
+  test_stress_report(subdirs ? "concurrent, own directories" :
+                     overlap ? "concurrent, same names" :
+                     "concurrent, same directory",
+                     overlap ? n : n * NCREATORS,
+                     &start);
+  assert(test_check_and_remove_fifos(dir, TEST_DEFAULT_MODE) ==
+         (overlap ? n : n * NCREATORS));
+}
+
+/**
+ * Concurrent creators in their own directories.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_stress_concurrent_dirs(const char *const dir){
+  test_stress_concurrent(dir, true, false);
+}
+
+/**
+ * Concurrent creators sharing one directory with different names.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_stress_concurrent_same_dir(const char *const dir){
+  test_stress_concurrent(dir, false, false);
+}
+
+/**
+ * Concurrent creators racing for the same names, where each FIFO must be
+ * created exactly once.
+ *
+ * @param[in] dir Sandbox directory.
+ */
+static void
+test_stress_concurrent_same_names(const char *const dir){
+  test_stress_concurrent(dir, false, true);
+}
+
+/**
+ * Stress cases, run by (test stress) instead of the regular cases.
+ */
+static const struct test_case test_stress_cases[] = {
+  {"stress-engines", test_stress_engines},
+  {"stress-concurrent-dirs", test_stress_concurrent_dirs},
+  {"stress-concurrent-same-dir", test_stress_concurrent_same_dir},
+  {"stress-concurrent-same-names", test_stress_concurrent_same_names}
+};
+
+/**
+ * Every regular test case, run in parallel by @ref test_run.
+ */
+static const struct test_case test_cases[] = {
+  {"args", test_case_args},
+  {"create", test_case_create},
+  {"mode", test_case_mode},
+  {"engines", test_case_engines},
+  {"batch", test_case_batch},
+  {"template", test_case_template},
+  {"pool", test_case_pool},
+#ifdef __linux__
+  {"async-open", test_case_async_open},
+#endif /* __linux__ */
+  {"daemon", test_case_daemon},
+  {"lease", test_case_lease},
+  {"exec", test_case_exec},
+  {"pipeline", test_case_pipeline},
+  {"perf", test_case_perf},
+  {"pump", test_case_pump},
+  {"fanout", test_case_fanout},
+  {"merge", test_case_merge},
+  {"record-pump", test_case_record_pump}
+};
+
+/**
+ * Directory holding the per-case sandboxes, on tmpfs when available.
+ */
+static const char *test_sandbox_root;
+
+/**
+ * Cases being run by @ref test_run.
+ */
+static const struct test_case *test_run_cases;
+
+/**
+ * Number of cases in @ref test_run_cases.
+ */
+static size_t test_run_ncases;
+
+/**
+ * Index of the next case in @ref test_run_cases to run.
+ */
+static size_t test_next_case;
+
+/**
+ * Protects @ref test_next_case.
+ */
+static pthread_mutex_t test_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Run test cases until none are left, each in a fresh sandbox directory
+ * that must be empty again when the case returns.
+ *
+ * @param[in] arg Unused.
+ * @return        NULL
+ */
+static void *
+test_worker(void *const arg){
+  char dir[PATH_MAX];
+  size_t i;
+
+  (void)arg;
+  for(;;){
+    pthread_mutex_lock(&test_lock);
+    i = test_next_case++;
+    pthread_mutex_unlock(&test_lock);
+    if(i >= test_run_ncases){
+      return NULL;
+    }
+    test_path(dir, test_sandbox_root, "mkfifo-test-XXXXXX");
+    assert(mkdtemp(dir));
+    test_run_cases[i].run(dir);
+    if(rmdir(dir) != 0){
+      fprintf(stderr,
+              "%s: sandbox not empty: %s\n",
+              test_run_cases[i].name,
+              dir);
+      abort();
+    }
+  }
+}
+
+/**
+ * Run test cases for the mkfifo utility, several at a time.
+ *
+ * $TMPDIR points at a directory whose name has a space and a quote in it,
+ * so the private directories of --exec and --pipeline do too.
+ *
+ * @param[in] cases  Cases to run.
+ * @param[in] ncases Number of cases in @p cases.
+ */
+static void
+test_run(const struct test_case *const cases,
+         const size_t ncases){
+  pthread_t threads[TEST_JOBS];
+  char tmp[PATH_MAX];
+  size_t i;
+
+  test_run_cases = cases;
+  test_run_ncases = ncases;
+  test_next_case = 0;
+  test_sandbox_root = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "build";
+  test_path(tmp, test_sandbox_root, "mkfifo-test tmp'XXXXXX");
+  assert(mkdtemp(tmp));
+  assert(setenv("TMPDIR", tmp, 1) == 0);
+  for(i = 0; i < TEST_JOBS; i++){
+    assert(pthread_create(&threads[i], NULL, test_worker, NULL) == 0);
+  }
+  for(i = 0; i < TEST_JOBS; i++){
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  assert(rmdir(tmp) == 0);
+  assert(unsetenv("TMPDIR") == 0);
+}
+
+/**
+ * Test mkfifo utility.
+ *
+ * Usage: test [stress [fifos]]
+ *
+ * With stress, runs the large-scale creation and removal cases instead,
+ * each creating @ref TEST_STRESS_FIFOS FIFO's or the given number.
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Argument list.
+ * @retval    0    All tests passed.
+ */
+int
+main(int argc,
+     char *argv[]){
+  /* Cases expect TEST_DEFAULT_MODE without (-m mode). */
+  umask(022);
+  if(argc > 1 && strcmp(argv[1], "stress") == 0){
+    if(argc > 2){
+      test_stress_fifos = strtoul(argv[2], NULL, 10);
+      assert(test_stress_fifos > 0);
+    }
+    test_run(test_stress_cases,
+             sizeof(test_stress_cases) / sizeof(test_stress_cases[0]));
+  }
+  else{
+    test_run(test_cases, sizeof(test_cases) / sizeof(test_cases[0]));
+  }
+  return 0;
+}
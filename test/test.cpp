@@ -0,0 +1,247 @@
+/**
+ * @file
+ * @brief test suite for the C++ wrappers
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Build from the top-level directory, with the library from src/mkfifo.c:
+ * cc -c -DMKFIFO_LIBRARY -o build/mkfifo-lib.o src/mkfifo.c
+ * c++ -std=c++17 -o build/test-cxx test/test.cpp build/mkfifo-lib.o -lpthread
+ *
+ * Build with -std=c++20 to also test the coroutine interface.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include "../src/mkfifo.hpp"
+
+/**
+ * Check whether a FIFO exists.
+ *
+ * @param[in] path Path to check.
+ * @return         true if @p path is a FIFO.
+ */
+static bool
+test_is_fifo(const char *const path){
+  struct stat sb;
+
+  return stat(path, &sb) == 0 && S_ISFIFO(sb.st_mode);
+}
+
+/**
+ * Fifo removes its FIFO on destruction, on unwinding, and when moved over,
+ * but not after release().
+ */
+static void
+test_fifo(void){
+  const char *const PATH = "build/cxx-fifo";
+  const char *path;
+  bool thrown;
+
+  std::remove(PATH);
+  {
+    libmkfifo::Fifo fifo(PATH);
+    assert(fifo && test_is_fifo(PATH));
+  }
+  assert(!test_is_fifo(PATH));
+
+  thrown = false;
+  try{
+    libmkfifo::Fifo fifo(PATH, 0600, true);
+    libmkfifo::Fifo moved(std::move(fifo));
+    assert(!fifo && moved);
+    libmkfifo::Fifo again(PATH);
+  }
+  catch(const std::system_error &e){
+    thrown = e.code().value() == EEXIST;
+  }
+  assert(thrown && !test_is_fifo(PATH));
+
+  {
+    libmkfifo::Fifo fifo(PATH);
+    path = fifo.release();
+  }
+  assert(test_is_fifo(path));
+  {
+    libmkfifo::Fifo adopted = libmkfifo::Fifo::adopt(path);
+  }
+  assert(!test_is_fifo(PATH));
+}
+
+/**
+ * Fifo::claim takes a FIFO out of a pool and throws once it is empty.
+ */
+static void
+test_fifo_claim(void){
+  const char *const POOL = "build/cxx-pool";
+  const char *const PATH = "build/cxx-fifo";
+  bool thrown;
+
+  assert(mkdir(POOL, 0700) == 0);
+  assert(mkfifo("build/cxx-pool/fifo.1", 0600) == 0);
+  {
+    libmkfifo::Fifo fifo = libmkfifo::Fifo::claim(POOL, PATH);
+    assert(fifo && test_is_fifo(PATH));
+  }
+  assert(!test_is_fifo(PATH));
+
+  thrown = false;
+  try{
+    libmkfifo::Fifo fifo = libmkfifo::Fifo::claim(POOL, PATH);
+  }
+  catch(const std::system_error &e){
+    thrown = e.code().value() == EAGAIN;
+  }
+  assert(thrown && !test_is_fifo(PATH));
+  assert(rmdir(POOL) == 0);
+}
+
+/**
+ * FifoSet reports per-path errors and removes what it created.
+ */
+static void
+test_fifo_set(void){
+  const std::string_view PATHS[] = {
+    std::string_view("build/cxx-set-1-and-more", 15),
+    "build/noexist/cxx-set",
+    "build/cxx-set-2"
+  };
+  bool thrown;
+
+  {
+    libmkfifo::FifoSet set(PATHS, 3);
+    assert(set.size() == 3 && set.failed() == 1);
+    assert(!set.error(0) && !set.error(2));
+    assert(set.error(1) == std::errc::no_such_file_or_directory);
+    assert(test_is_fifo("build/cxx-set-1") && test_is_fifo(set.path(2)));
+    libmkfifo::FifoSet moved;
+    moved = std::move(set);
+    assert(set.size() == 0 && moved.size() == 3);
+  }
+  assert(!test_is_fifo("build/cxx-set-1") && !test_is_fifo("build/cxx-set-2"));
+
+  thrown = false;
+  try{
+    libmkfifo::FifoSet set(PATHS, 3, 0600, true, MKFIFO_ENGINE_THREAD);
+    set.release(2);
+    throw std::runtime_error("unwind");
+  }
+  catch(const std::runtime_error &){
+    thrown = true;
+  }
+  assert(thrown);
+  assert(!test_is_fifo("build/cxx-set-1") && test_is_fifo("build/cxx-set-2"));
+  assert(std::remove("build/cxx-set-2") == 0);
+
+#ifdef __cpp_lib_span
+  {
+    libmkfifo::FifoSet set{std::span<const std::string_view>(PATHS)};
+    assert(set.size() == 3 && set.failed() == 1);
+  }
+  assert(!test_is_fifo("build/cxx-set-1") && !test_is_fifo("build/cxx-set-2"));
+#endif /* __cpp_lib_span */
+}
+
+#if defined(__linux__) && defined(MKFIFO_HPP_COROUTINE)
+/**
+ * Coroutine that starts right away and is never resumed after finishing.
+ */
+struct test_task{
+  /**
+   * Promise of a coroutine returning nothing.
+   */
+  struct promise_type{
+    test_task get_return_object() noexcept{ return {}; }
+    std::suspend_never initial_suspend() noexcept{ return {}; }
+    std::suspend_never final_suspend() noexcept{ return {}; }
+    void return_void() noexcept{}
+    void unhandled_exception() noexcept{ std::terminate(); }
+  };
+};
+
+/**
+ * Await a write open and record the descriptor or error.
+ *
+ * @param[in]  opener Opener to await on.
+ * @param[in]  path   FIFO path.
+ * @param[out] fd     Descriptor, or -1.
+ * @param[out] err    errno of the failure, or 0.
+ * @return            Task.
+ */
+static test_task
+test_await_writer(const libmkfifo::Opener &opener,
+                  const char *const path,
+                  int &fd,
+                  int &err){
+  try{
+    fd = co_await opener.open(path, O_WRONLY);
+  }
+  catch(const std::system_error &e){
+    err = e.code().value();
+  }
+}
+
+/**
+ * Opener resumes a waiting coroutine once a reader opens the FIFO and
+ * throws into it when canceled.
+ */
+static void
+test_opener(void){
+  const char *const PATH = "build/cxx-opener";
+  struct pollfd pfd;
+  int reader;
+  int fd;
+  int err;
+
+  assert(mkfifo(PATH, 0600) == 0);
+  {
+    libmkfifo::Opener opener;
+
+    fd = -1;
+    err = 0;
+    test_await_writer(opener, PATH, fd, err);
+    assert(fd == -1 && err == 0);
+    reader = open(PATH, O_RDONLY | O_NONBLOCK);
+    assert(reader >= 0);
+    pfd.fd = opener.fd();
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(opener.dispatch() == 1);
+    assert(fd >= 0 && err == 0);
+    assert(close(fd) == 0);
+    assert(close(reader) == 0);
+
+    fd = -1;
+    test_await_writer(opener, PATH, fd, err);
+  }
+  assert(fd == -1 && err == ECANCELED);
+  assert(std::remove(PATH) == 0);
+}
+#endif /* __linux__ && MKFIFO_HPP_COROUTINE */
+
+/**
+ * Test the C++ wrappers.
+ *
+ * @retval 0 All tests passed.
+ */
+int
+main(){
+  test_fifo();
+  test_fifo_claim();
+  test_fifo_set();
+#if defined(__linux__) && defined(MKFIFO_HPP_COROUTINE)
+  test_opener();
+#endif /* __linux__ && MKFIFO_HPP_COROUTINE */
+  return 0;
+}
@@ -8,6 +8,11 @@
 #ifndef MKFIFO_TEST_H
 #define MKFIFO_TEST_H
 
+int
+mkfifo_run(int argc,
+           char *argv[],
+           pid_t owner);
+
 int
 mkfifo_main(int argc,
             char *argv[]);